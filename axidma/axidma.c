@@ -11,6 +11,7 @@
 #include <linux/irqdomain.h> //For irq_find_host
 #include <linux/of.h> //For device tree struct types
 #include <linux/irq.h> //For irq_desc struct and irq_to_desc
+#include "irq_latency_hist.h"
 
 #define REGS_SPAN 0x1000
 
@@ -26,6 +27,8 @@ static int axidma_enable = 0;
 static unsigned long axidma_phys_base = 0xA0000000;
 static int axidma_irq_line = 0;
 
+//Interrupt-to-userspace latency, see irq_latency_hist.h
+static struct irq_lat_hist axidma_lat_hist;
 
 //AXI DMA interrupt handler
 static irqreturn_t axidma_irq_handler(int irq, struct uio_info *dev) {
@@ -39,6 +42,7 @@ static irqreturn_t axidma_irq_handler(int irq, struct uio_info *dev) {
     }
     
     if (((*MM2S_DMASR >> 12) & 0b111) || ((*S2MM_DMASR >> 12) & 0b111)) {
+        irq_lat_hist_irq(&axidma_lat_hist);
         *MM2S_DMASR = 0xFFFFFFFF;
         *S2MM_DMASR = 0xFFFFFFFF;
         return IRQ_HANDLED; 
@@ -47,6 +51,14 @@ static irqreturn_t axidma_irq_handler(int irq, struct uio_info *dev) {
     return IRQ_NONE; 
 }
 
+//Userspace writes to the UIO file after its read() returns. We clear the
+//interrupt at the source, so there's nothing to re-enable here; this is just
+//how we find out userspace is awake
+static int axidma_irqcontrol(struct uio_info *info, s32 irq_on) {
+    irq_lat_hist_ack(&axidma_lat_hist);
+    return 0;
+}
+
 //UIO driver file operations
 int axidma_open (struct uio_info *info, struct inode *inode) {
     mutex_lock(&in_use_mutex);
@@ -220,11 +232,24 @@ static ssize_t irq_line_store (struct kobject *kobj, struct kobj_attribute *attr
     return count; 
 }
 
+//Reading gives the latency histogram, writing anything clears it
+static ssize_t irq_latency_show  (struct kobject *kobj, struct kobj_attribute *attr, char *buf) {
+    return irq_lat_hist_show(&axidma_lat_hist, buf);
+}
+
+static ssize_t irq_latency_store (struct kobject *kobj, struct kobj_attribute *attr, 
+                            const char *buf, size_t count)
+{
+    irq_lat_hist_reset(&axidma_lat_hist);
+    return count;
+}
+
 //Structs needed for sysfs
 static struct kobject *axidma_kobject;
 static struct kobj_attribute axidma_enable_attr;
 static struct kobj_attribute axidma_phys_base_attr;
 static struct kobj_attribute axidma_irq_line_attr;
+static struct kobj_attribute axidma_irq_latency_attr;
 
 //structs needed to register with uio
 //Just to satisfy the struct device
@@ -240,6 +265,7 @@ static struct uio_info axidma_uio_info = {
     //.irq = TBD, 
     .irq_flags = IRQF_SHARED,
     .handler = axidma_irq_handler,
+    .irqcontrol = axidma_irqcontrol,
     //Unlike tutorial doc, I take a shortcut and don't separately defien the uio_mem struct
     .mem = {
         {
@@ -279,6 +305,11 @@ static int __init axidma_init(void) {
     axidma_irq_line_attr.show = irq_line_show;
     axidma_irq_line_attr.store = irq_line_store;
     
+    axidma_irq_latency_attr.attr.name = "irq_latency";
+    axidma_irq_latency_attr.attr.mode = 0666;
+    axidma_irq_latency_attr.show = irq_latency_show;
+    axidma_irq_latency_attr.store = irq_latency_store;
+    
     rc = sysfs_create_file(axidma_kobject, &(axidma_enable_attr.attr));
     if (rc) {
         printk(KERN_ERR "Could not create sysfs files");
@@ -303,6 +334,14 @@ static int __init axidma_init(void) {
         return rc;
     }
     
+    rc = sysfs_create_file(axidma_kobject, &(axidma_irq_latency_attr.attr));
+    if (rc) {
+        printk(KERN_ERR "Could not create sysfs files");
+        device_unregister(&axidma_device);
+        kobject_put(axidma_kobject);
+        return rc;
+    }
+    
     return 0;
 }
 
@@ -0,0 +1,67 @@
+#ifndef IRQ_LATENCY_HIST_H
+#define IRQ_LATENCY_HIST_H 1
+
+//Log2 histogram of how long it takes userspace to respond to an interrupt,
+//shared by the UIO drivers. (There are copies of this file in ../axidma and
+//../mpsoc_uio; keep them in sync).
+//
+//The hard IRQ handler calls irq_lat_hist_irq() to timestamp the interrupt.
+//Userspace is expected to write() to the UIO file once its read() returns
+//(that's the usual way to re-arm a UIO interrupt), which lands in the
+//driver's irqcontrol callback. That calls irq_lat_hist_ack(), which adds the
+//time since the interrupt to the histogram. So each sample is the time from
+//the hard IRQ to userspace being awake and running, plus one syscall entry.
+//
+//Bucket i counts samples in [2^i, 2^(i+1)) ns. If several interrupts arrive
+//before userspace gets around to writing, we measure from the first one.
+
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/log2.h>
+
+#define IRQ_LAT_HIST_BUCKETS 32
+
+struct irq_lat_hist {
+    atomic_t buckets[IRQ_LAT_HIST_BUCKETS];
+    u64 pending_ns; //Timestamp of the oldest unacknowledged IRQ, or 0
+};
+
+static inline void irq_lat_hist_irq(struct irq_lat_hist *h) {
+    cmpxchg(&h->pending_ns, 0, ktime_get_ns());
+}
+
+static inline void irq_lat_hist_ack(struct irq_lat_hist *h) {
+    u64 t = xchg(&h->pending_ns, 0);
+    u64 delta;
+    int b;
+
+    if (!t) return;
+    delta = ktime_get_ns() - t;
+    b = delta ? ilog2(delta) : 0;
+    if (b >= IRQ_LAT_HIST_BUCKETS) b = IRQ_LAT_HIST_BUCKETS - 1;
+    atomic_inc(&h->buckets[b]);
+}
+
+static inline void irq_lat_hist_reset(struct irq_lat_hist *h) {
+    int i;
+    for (i = 0; i < IRQ_LAT_HIST_BUCKETS; i++) atomic_set(&h->buckets[i], 0);
+    h->pending_ns = 0;
+}
+
+//Prints "<bucket upper bound in ns> <count>" lines, up to the last non-empty
+//bucket, for use in a sysfs show function
+static inline ssize_t irq_lat_hist_show(struct irq_lat_hist *h, char *buf) {
+    ssize_t len = 0;
+    int last = -1;
+    int i;
+
+    for (i = 0; i < IRQ_LAT_HIST_BUCKETS; i++) {
+        if (atomic_read(&h->buckets[i])) last = i;
+    }
+    for (i = 0; i <= last; i++) {
+        len += sprintf(buf + len, "%llu %d\n", 2ULL << i, atomic_read(&h->buckets[i]));
+    }
+    return len;
+}
+
+#endif
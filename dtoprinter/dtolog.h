@@ -0,0 +1,49 @@
+#ifndef DTOLOG_H
+#define DTOLOG_H 1
+
+//Binary format of the device tree event log in /dev/dtolog. Used by both
+//dtoprinter.c and dtolog_decode.c.
+//
+//Reading /dev/dtolog returns a stream of records, each one a struct
+//dtolog_record followed by path_len bytes of node path, name_len bytes of
+//property name, value_len bytes of property value and old_value_len bytes of
+//the old value (only for DTOLOG_UPDATE_PROPERTY). None of the strings are
+//NUL-terminated. The whole record is padded to a multiple of 8 bytes, and
+//len includes the padding.
+//
+//Values are logged in full. The only limit is that a record can't be bigger
+//than the log itself, which is the dtoprinter module's log_size parameter
+//(see /sys/module/dtoprinter/parameters/log_size). A read() only ever
+//returns whole records, and fails with EINVAL if the next one doesn't fit in
+//your buffer, so either make the buffer log_size bytes or grow it and retry.
+
+#include <linux/types.h>
+
+//Same values as OF_RECONFIG_*
+#define DTOLOG_ATTACH_NODE     1
+#define DTOLOG_DETACH_NODE     2
+#define DTOLOG_ADD_PROPERTY    3
+#define DTOLOG_REMOVE_PROPERTY 4
+#define DTOLOG_UPDATE_PROPERTY 5
+
+//Set in flags if anything (path, name, value or old value) was cut short
+#define DTOLOG_TRUNCATED 0x1
+
+#define DTOLOG_MAX_PATH 256
+#define DTOLOG_MAX_NAME 64
+
+struct dtolog_record {
+    __u32 len;
+    __u16 action;
+    __u16 flags;
+    __u64 timestamp_ns; //CLOCK_MONOTONIC
+    __u32 seq; //Counts every event, including dropped ones
+    __u32 dropped; //Number of events dropped (log full) right before this one
+    __u16 path_len;
+    __u16 name_len;
+    __u32 value_len;
+    __u32 old_value_len;
+    __u32 reserved;
+};
+
+#endif
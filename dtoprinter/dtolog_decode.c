@@ -0,0 +1,179 @@
+//Prints the device tree event log recorded by dtoprinter.
+//
+//    ./dtolog_decode            Print whatever is in /dev/dtolog and exit
+//    ./dtolog_decode -f         Keep printing events as they happen
+//    ./dtolog_decode dump.bin   Decode a saved copy (e.g. cat /dev/dtolog > dump.bin)
+//
+//Reading /dev/dtolog consumes the events, so only run one of these at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h> //open
+#include <unistd.h> //read, close
+#include "dtolog.h"
+
+static char const *action_names[] = {
+    "???", "ATTACH NODE", "DETACH NODE", "ADD PROPERTY", "REMOVE PROPERTY", "UPDATE PROPERTY"
+};
+
+//Prints a property value as a string if it looks like one (or a list of
+//them), otherwise as big-endian 32-bit cells, otherwise as bytes
+static void print_value(unsigned char const *v, unsigned len) {
+    int is_string = (len > 0 && v[len - 1] == 0 && v[0] != 0);
+    unsigned i;
+
+    for (i = 0; is_string && i < len; i++) {
+        if (v[i] == 0) {
+            if (i > 0 && v[i - 1] == 0) is_string = 0; //Two NULs in a row
+        } else if (!isprint(v[i])) {
+            is_string = 0;
+        }
+    }
+
+    if (len == 0) {
+        printf("(empty)");
+    } else if (is_string) {
+        for (i = 0; i < len; i += strlen((char const *) v + i) + 1) {
+            printf("%s\"%s\"", i ? ", " : "", v + i);
+        }
+    } else if (len % 4 == 0) {
+        printf("<");
+        for (i = 0; i < len; i += 4) {
+            printf("%s0x%02x%02x%02x%02x", i ? " " : "", v[i], v[i + 1], v[i + 2], v[i + 3]);
+        }
+        printf(">");
+    } else {
+        printf("[");
+        for (i = 0; i < len; i++) printf("%s%02x", i ? " " : "", v[i]);
+        printf("]");
+    }
+}
+
+static void print_record(struct dtolog_record const *r) {
+    char const *p = (char const *) (r + 1);
+    char const *path = p;
+    char const *name = path + r->path_len;
+    unsigned char const *value = (unsigned char const *) name + r->name_len;
+    unsigned char const *old_value = value + r->value_len;
+
+    if (r->dropped) printf("*** %u events dropped (log was full) ***\n", r->dropped);
+
+    printf("[%llu.%09llu] #%u %s %.*s",
+        (unsigned long long) r->timestamp_ns / 1000000000ULL,
+        (unsigned long long) r->timestamp_ns % 1000000000ULL,
+        r->seq,
+        action_names[(r->action <= DTOLOG_UPDATE_PROPERTY) ? r->action : 0],
+        r->path_len, path
+    );
+
+    if (r->action >= DTOLOG_ADD_PROPERTY) {
+        printf(": %.*s = ", r->name_len, name);
+        print_value(value, r->value_len);
+        if (r->action == DTOLOG_UPDATE_PROPERTY) {
+            printf(" (was ");
+            print_value(old_value, r->old_value_len);
+            printf(")");
+        }
+    }
+    if (r->flags & DTOLOG_TRUNCATED) printf(" (truncated)");
+    printf("\n");
+}
+
+//Nothing sane needs a bigger log than this, so anything past it is garbage
+#define MAX_BUF (1UL << 30)
+
+//Returns 0 on success
+static int grow(unsigned char **buf, size_t *cap, size_t want) {
+    unsigned char *bigger = realloc(*buf, want);
+    if (!bigger) {
+        perror("Could not grow read buffer");
+        return -1;
+    }
+    *buf = bigger;
+    *cap = want;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int follow = 0;
+    char const *path = "/dev/dtolog";
+    int ret = 0;
+    int fd;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f")) follow = 1;
+        else path = argv[i];
+    }
+
+    //Only block on the device if we're following it
+    fd = open(path, O_RDONLY | (follow ? 0 : O_NONBLOCK));
+    if (fd == -1) {
+        perror("Could not open event log");
+        return -1;
+    }
+
+    //A saved file can split records across read() calls, so keep leftovers
+    //around and only print complete records. Records can be as big as the
+    //log, so start small and grow the buffer whenever one doesn't fit
+    size_t cap = 64 << 10;
+    unsigned char *buf = malloc(cap);
+    size_t have = 0;
+    if (!buf) {
+        perror("Could not allocate read buffer");
+        close(fd);
+        return -1;
+    }
+    for (;;) {
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0 && errno == EAGAIN) break; //Device is empty
+        if (n < 0 && errno == EINVAL && cap < MAX_BUF) {
+            //The device's next record is bigger than our buffer
+            if (grow(&buf, &cap, cap * 2) < 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        if (n < 0) {
+            perror("Could not read event log");
+            ret = -1;
+            break;
+        }
+        if (n == 0) break; //End of saved file
+        have += n;
+
+        size_t pos = 0;
+        while (have - pos >= sizeof(struct dtolog_record)) {
+            struct dtolog_record const *r = (struct dtolog_record const *) (buf + pos);
+            if (r->len < sizeof(*r) || r->len % 8 || r->len > MAX_BUF) {
+                fprintf(stderr, "Corrupt record at offset %zu\n", pos);
+                ret = -1;
+                goto done;
+            }
+            if (have - pos < r->len) break;
+            print_record(r);
+            pos += r->len;
+        }
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+        fflush(stdout);
+
+        //A partial record that won't fit in what's left of the buffer
+        if (have >= sizeof(struct dtolog_record)) {
+            struct dtolog_record const *r = (struct dtolog_record const *) buf;
+            if (r->len > cap && grow(&buf, &cap, r->len) < 0) {
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    done:
+    if (have && ret == 0) fprintf(stderr, "Ignoring %zu bytes of incomplete record at the end\n", have);
+    free(buf);
+    close(fd);
+    return ret;
+}
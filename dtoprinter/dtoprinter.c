@@ -3,6 +3,36 @@
 #include <linux/module.h> //for module init and exit macros
 #include <linux/notifier.h> //For notification struct types
 #include <linux/of.h> //For device tree struct types
+#include <linux/of_address.h> //of_address_to_resource
+#include <linux/of_irq.h> //irq_of_parse_and_map
+#include <linux/of_platform.h> //of_platform_device_create
+#include <linux/platform_device.h> //For making the UIO devices
+#include <linux/slab.h> //kzalloc
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/miscdevice.h> //For /dev/dtolog
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h> //copy_to_user
+#include <linux/ktime.h>
+#include <linux/log2.h> //roundup_pow_of_two
+#include "mpsoc_genuio.h"
+#include "dtolog.h"
+
+//Printing every event to the console is slow, truncates long values and
+//floods dmesg during big overlays. Everything goes to /dev/dtolog instead
+//(see dtolog.h and dtolog_decode.c); set this to get the old printks too
+static bool verbose = 0;
+module_param(verbose, bool, 0644);
+MODULE_PARM_DESC(verbose, "Also print every device tree event to the kernel log (default 0)");
+
+static unsigned long log_size = 1 << 20;
+module_param(log_size, ulong, 0444);
+MODULE_PARM_DESC(log_size, "Size of the event log in bytes, rounded up to a power of 2 (default 1 MiB)");
+#define MIN_LOG_SIZE (64UL << 10)
 
 
 //I don't know why, but for some reason <linux/of.h> isn't defining these?
@@ -84,6 +114,413 @@ static void print_device_node(struct device_node *dn, int levels) {
 	}
 }
 
+/*
+ * Hot-plug manager. When an overlay attaches a node for an IP we know about,
+ * make an mpsoc_genuio device for it (mpsoc_genuio.ko has to be loaded), and
+ * get rid of it again when the node is detached. That way swapping a partial
+ * bitstream doesn't mean running insmod and poking sysfs by hand.
+ * 
+ * For IPs that have their own drivers in the kernel (AXI DMA, AXI timer) we
+ * don't use the node itself, since the kernel may already have made a
+ * platform device for it. Instead we make separate mpsoc_genuio devices with
+ * the right ack recipe. Those ack the IP's interrupts in a shared handler, so
+ * they would steal them from xilinx_dma or the Xilinx timer driver: that's
+ * only done if you ask for it with kernel_ips=1, and never for a node that
+ * already has a driver bound.
+ */
+
+static bool manage = 1;
+module_param(manage, bool, 0444);
+MODULE_PARM_DESC(manage, "Make UIO devices for known IPs in device tree overlays (default 1)");
+
+static bool kernel_ips = 0;
+module_param(kernel_ips, bool, 0444);
+MODULE_PARM_DESC(kernel_ips, "Also make UIO devices for AXI DMA and AXI timer nodes, unless their kernel driver is bound (default 0)");
+
+struct managed_dev {
+	struct list_head list;
+	struct device_node *dn; //We hold a reference
+	struct platform_device *pdev; //NULL if we used of_platform_device_create
+	unsigned int virq; //Mapping we made for pdev, or 0
+};
+
+static LIST_HEAD(managed_devs);
+static DEFINE_MUTEX(managed_mutex);
+
+static int track(struct device_node *dn, struct platform_device *pdev, unsigned int virq) {
+	struct managed_dev *m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m) return -ENOMEM;
+	m->dn = of_node_get(dn);
+	m->pdev = pdev;
+	m->virq = virq;
+	mutex_lock(&managed_mutex);
+	list_add_tail(&m->list, &managed_devs);
+	mutex_unlock(&managed_mutex);
+	return 0;
+}
+
+static void untrack(struct managed_dev *m) {
+	if (m->pdev) {
+		platform_device_unregister(m->pdev);
+		//Otherwise every partial reconfiguration leaks a mapping
+		if (m->virq) irq_dispose_mapping(m->virq);
+	} else if (of_node_check_flag(m->dn, OF_POPULATED)) {
+		struct platform_device *pdev = of_find_device_by_node(m->dn);
+		if (pdev) {
+			of_platform_device_destroy(&pdev->dev, NULL);
+			put_device(&pdev->dev);
+		}
+	}
+	of_node_put(m->dn);
+	list_del(&m->list);
+	kfree(m);
+}
+
+//Makes an mpsoc_genuio device using dn's first reg entry and its irq_idx-th
+//interrupt (or no interrupt if irq_idx < 0)
+static int make_genuio(struct device_node *dn, int irq_idx, struct mpsoc_genuio_pdata const *pdata) {
+	struct resource res[2];
+	int num_res = 1;
+	struct mpsoc_genuio_pdata pd = *pdata;
+	struct platform_device *pdev;
+	unsigned int virq = 0;
+	int rc;
+	
+	//Name the UIO device after the node, so userspace can find it in
+	///sys/class/uio/uioN/name
+	strlcpy(pd.name, dn->name, sizeof(pd.name));
+	
+	if (of_address_to_resource(dn, 0, &res[0])) {
+		printk(KERN_ERR "dtoprinter: %s has no reg property\n", dn->full_name);
+		return -EINVAL;
+	}
+	
+	if (irq_idx >= 0) {
+		virq = irq_of_parse_and_map(dn, irq_idx);
+		if (virq > 0) {
+			res[1] = (struct resource) DEFINE_RES_IRQ(virq);
+			num_res = 2;
+		}
+	}
+	
+	pdev = platform_device_register_resndata(NULL, MPSOC_GENUIO_NAME, PLATFORM_DEVID_AUTO,
+		res, num_res, &pd, sizeof(pd));
+	if (IS_ERR(pdev)) {
+		printk(KERN_ERR "dtoprinter: could not make UIO device for %s\n", dn->full_name);
+		if (virq) irq_dispose_mapping(virq);
+		return PTR_ERR(pdev);
+	}
+	
+	rc = track(dn, pdev, virq);
+	if (rc) {
+		platform_device_unregister(pdev);
+		if (virq) irq_dispose_mapping(virq);
+	}
+	return rc;
+}
+
+//AXI DMA: MM2S_DMASR is at 0x04 and S2MM_DMASR is at 0x34. Bits 12-14 are
+//IOC, delay and error, all write-1-to-clear. Each channel has its own
+//interrupt, so make one UIO device per interrupt and only ack the matching
+//channel (if interrupt-names tells us which one it is)
+#define DMA_IRQ_MASK 0x7000
+static struct mpsoc_genuio_pdata const dma_mm2s_acks = {
+	.num_acks = 1,
+	.acks = {{0x04, DMA_IRQ_MASK, 1}}
+};
+static struct mpsoc_genuio_pdata const dma_s2mm_acks = {
+	.num_acks = 1,
+	.acks = {{0x34, DMA_IRQ_MASK, 1}}
+};
+static struct mpsoc_genuio_pdata const dma_both_acks = {
+	.num_acks = 2,
+	.acks = {{0x04, DMA_IRQ_MASK, 1}, {0x34, DMA_IRQ_MASK, 1}}
+};
+
+//Whether the kernel already has a driver on dn's own platform device (e.g.
+//xilinx_dma). If so, we must not ack its interrupts behind its back
+static bool has_bound_driver(struct device_node *dn) {
+	struct platform_device *pdev = of_find_device_by_node(dn);
+	bool bound;
+	
+	if (!pdev) return false;
+	bound = pdev->dev.driver != NULL;
+	put_device(&pdev->dev);
+	if (bound) {
+		printk(KERN_INFO "dtoprinter: %s already has a driver, not making a UIO device for it\n", dn->full_name);
+	}
+	return bound;
+}
+
+static int attach_axidma(struct device_node *dn) {
+	int i;
+	
+	if (!kernel_ips || has_bound_driver(dn)) return -EBUSY;
+	
+	for (i = 0; i < 2; i++) {
+		struct mpsoc_genuio_pdata const *acks = &dma_both_acks;
+		struct of_phandle_args oirq;
+		char const *name;
+		int rc;
+		
+		//Just checking it's there. make_genuio does the mapping
+		if (of_irq_parse_one(dn, i, &oirq)) break;
+		of_node_put(oirq.np);
+		
+		if (!of_property_read_string_index(dn, "interrupt-names", i, &name)) {
+			if (!strcmp(name, "mm2s_introut")) acks = &dma_mm2s_acks;
+			else if (!strcmp(name, "s2mm_introut")) acks = &dma_s2mm_acks;
+		}
+		
+		rc = make_genuio(dn, i, acks);
+		if (rc) return rc;
+	}
+	
+	//No interrupts at all? Still give userspace the registers
+	return (i == 0) ? make_genuio(dn, -1, &dma_both_acks) : 0;
+}
+
+//AXI timer: T0INT and T1INT are bit 8 of TCSR0 (0x00) and TCSR1 (0x10),
+//write-1-to-clear
+static struct mpsoc_genuio_pdata const timer_acks = {
+	.num_acks = 2,
+	.acks = {{0x00, 0x100, 1}, {0x10, 0x100, 1}}
+};
+
+static int attach_axitimer(struct device_node *dn) {
+	if (!kernel_ips || has_bound_driver(dn)) return -EBUSY;
+	return make_genuio(dn, 0, &timer_acks);
+}
+
+//Nodes meant for mpsoc_genuio in the first place. If the overlay targets a
+//bus that's already populated the kernel makes the device itself; otherwise
+//(e.g. under fpga-full) we do it
+static int attach_genuio(struct device_node *dn) {
+	struct platform_device *pdev;
+	int rc;
+	
+	if (of_node_check_flag(dn, OF_POPULATED)) return 0;
+	
+	pdev = of_platform_device_create(dn, NULL, NULL);
+	if (!pdev) {
+		printk(KERN_ERR "dtoprinter: could not create device for %s\n", dn->full_name);
+		return -ENODEV;
+	}
+	
+	rc = track(dn, NULL, 0);
+	if (rc) of_platform_device_destroy(&pdev->dev, NULL);
+	return rc;
+}
+
+struct known_ip {
+	char const *compatible;
+	int (*attach)(struct device_node *dn);
+};
+
+static struct known_ip const known_ips[] = {
+	{"xlnx,axi-dma-1.00.a", attach_axidma},
+	{"xlnx,xps-timer-1.00.a", attach_axitimer},
+	{"uoft,mpsoc-genuio", attach_genuio},
+};
+
+static void manage_attach(struct device_node *dn) {
+	int i;
+	for (i = 0; i < ARRAY_SIZE(known_ips); i++) {
+		if (of_device_is_compatible(dn, known_ips[i].compatible)) {
+			if (known_ips[i].attach(dn) == 0) {
+				printk(KERN_INFO "dtoprinter: attached %s\n", dn->full_name);
+			}
+			return;
+		}
+	}
+}
+
+static void manage_detach(struct device_node *dn) {
+	struct managed_dev *m, *tmp;
+	
+	mutex_lock(&managed_mutex);
+	list_for_each_entry_safe(m, tmp, &managed_devs, list) {
+		if (m->dn == dn) untrack(m);
+	}
+	mutex_unlock(&managed_mutex);
+}
+
+/*
+ * Event log. This is a byte ring with one consumer and any number of
+ * producers:
+ * 
+ *  - The producers are the notifier. The OF code calls the reconfig chain
+ *    after dropping of_mutex (and it's a blocking notifier chain, which
+ *    allows concurrent callers), so several can run at once. They're
+ *    serialized by log_write_lock, which covers log_head, log_seq and
+ *    log_pending_drops. Each record is published with a store-release to
+ *    log_head once it has been completely copied in.
+ *  - The consumer is read() on /dev/dtolog (readers are serialized by
+ *    log_read_mutex). It never takes log_write_lock: it only ever writes
+ *    log_tail, with a store-release after it's done copying records out.
+ * 
+ * Head and tail count bytes forever and are masked to index the buffer, so
+ * head - tail is always the number of bytes in use. If a record doesn't fit,
+ * we drop it and tell the reader in the next record's dropped field.
+ */
+static char *log_buf;
+static u64 log_head;
+static u64 log_tail;
+static u32 log_seq;
+static u32 log_pending_drops;
+static DEFINE_SPINLOCK(log_write_lock);
+static DEFINE_MUTEX(log_read_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(log_wq);
+
+//Copy into/out of the ring at byte position pos, wrapping around the end
+static void log_put(u64 pos, void const *src, size_t n) {
+	size_t off = pos & (log_size - 1);
+	size_t first = min(n, (size_t) (log_size - off));
+	memcpy(log_buf + off, src, first);
+	memcpy(log_buf, src + first, n - first);
+}
+
+static void log_get(void *dst, u64 pos, size_t n) {
+	size_t off = pos & (log_size - 1);
+	size_t first = min(n, (size_t) (log_size - off));
+	memcpy(dst, log_buf + off, first);
+	memcpy(dst + first, log_buf, n - first);
+}
+
+static int log_get_user(char __user *dst, u64 pos, size_t n) {
+	size_t off = pos & (log_size - 1);
+	size_t first = min(n, (size_t) (log_size - off));
+	if (copy_to_user(dst, log_buf + off, first)) return -EFAULT;
+	if (copy_to_user(dst + first, log_buf, n - first)) return -EFAULT;
+	return 0;
+}
+
+static void log_event(unsigned long action, struct device_node *dn, struct property *p, struct property *oldp) {
+	struct dtolog_record r = {0};
+	char path[DTOLOG_MAX_PATH];
+	char const *name = (p && p->name) ? p->name : "";
+	u64 tail;
+	u64 head;
+	u64 pos;
+	u32 len;
+	u32 room; //Value bytes that still fit in a record as big as the log
+	int n;
+	
+	r.action = action;
+	if (dn) {
+		n = snprintf(path, sizeof(path), "%pOF", dn);
+		r.path_len = min(n, (int) sizeof(path) - 1);
+		if (r.path_len < n) r.flags |= DTOLOG_TRUNCATED;
+	}
+	r.name_len = min(strlen(name), (size_t) DTOLOG_MAX_NAME);
+	if (r.name_len < strlen(name)) r.flags |= DTOLOG_TRUNCATED;
+	
+	//Values go in whole unless the record would outgrow the log, in which
+	//case it could never be written
+	room = log_size - sizeof(r) - r.path_len - r.name_len;
+	if (p && p->value && p->length > 0) {
+		r.value_len = min((u32) p->length, room);
+		if (r.value_len < p->length) r.flags |= DTOLOG_TRUNCATED;
+		room -= r.value_len;
+	}
+	if (action == OF_RECONFIG_UPDATE_PROPERTY && oldp && oldp->value && oldp->length > 0) {
+		r.old_value_len = min((u32) oldp->length, room);
+		if (r.old_value_len < oldp->length) r.flags |= DTOLOG_TRUNCATED;
+	}
+	
+	len = ALIGN(sizeof(r) + r.path_len + r.name_len + r.value_len + r.old_value_len, 8);
+	
+	spin_lock(&log_write_lock);
+	//Stamp inside the lock so seq and time both follow the order in the ring
+	r.timestamp_ns = ktime_get_ns();
+	r.seq = log_seq++;
+	tail = smp_load_acquire(&log_tail);
+	head = log_head;
+	if (len > log_size - (head - tail)) {
+		log_pending_drops++;
+		spin_unlock(&log_write_lock);
+		return;
+	}
+	r.len = len;
+	r.dropped = log_pending_drops;
+	log_pending_drops = 0;
+	
+	pos = head;
+	log_put(pos, &r, sizeof(r)); pos += sizeof(r);
+	log_put(pos, path, r.path_len); pos += r.path_len;
+	log_put(pos, name, r.name_len); pos += r.name_len;
+	if (r.value_len) log_put(pos, p->value, r.value_len);
+	pos += r.value_len;
+	if (r.old_value_len) log_put(pos, oldp->value, r.old_value_len);
+	
+	smp_store_release(&log_head, head + len);
+	spin_unlock(&log_write_lock);
+	wake_up_interruptible(&log_wq);
+}
+
+static ssize_t dtolog_read(struct file *filp, char __user *buf, size_t count, loff_t *off) {
+	ssize_t copied = 0;
+	u64 head, tail;
+	int rc;
+	
+	if (mutex_lock_interruptible(&log_read_mutex)) return -ERESTARTSYS;
+	
+	tail = log_tail;
+	if (smp_load_acquire(&log_head) == tail) {
+		if (filp->f_flags & O_NONBLOCK) {
+			copied = -EAGAIN;
+			goto done;
+		}
+		rc = wait_event_interruptible(log_wq, smp_load_acquire(&log_head) != tail);
+		if (rc) {
+			copied = rc;
+			goto done;
+		}
+	}
+	
+	head = smp_load_acquire(&log_head);
+	while (tail != head) {
+		u32 len;
+		log_get(&len, tail, sizeof(len));
+		if (copied + len > count) break;
+		if (log_get_user(buf + copied, tail, len)) {
+			if (!copied) copied = -EFAULT;
+			break;
+		}
+		tail += len;
+		copied += len;
+	}
+	
+	//Not even one record fit
+	if (copied == 0) copied = -EINVAL;
+	
+	smp_store_release(&log_tail, tail);
+	
+	done:
+	mutex_unlock(&log_read_mutex);
+	return copied;
+}
+
+static unsigned int dtolog_poll(struct file *filp, poll_table *wait) {
+	poll_wait(filp, &log_wq, wait);
+	if (smp_load_acquire(&log_head) != READ_ONCE(log_tail)) return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static struct file_operations const dtolog_fops = {
+	.owner = THIS_MODULE,
+	.read = dtolog_read,
+	.poll = dtolog_poll,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice dtolog_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "dtolog",
+	.fops = &dtolog_fops,
+	.mode = 0444,
+};
+
 static int print_dt_updates(struct notifier_block *nb, unsigned long action, void *arg) {
 	//Add nicer names to the stuff we were given
 	struct of_reconfig_data *rd = (struct of_reconfig_data *) arg;
@@ -91,39 +528,50 @@ static int print_dt_updates(struct notifier_block *nb, unsigned long action, voi
 	struct property *newp = rd->prop;
 	struct property *oldp = rd->old_prop;
 	
-	printk(KERN_ALERT "Received a device tree update:\n");
-	switch (action) {
-		case OF_RECONFIG_ATTACH_NODE:
-			printk(KERN_ALERT "\tATTACH NODE\n");
-			print_device_node(dn, 1);
-			break;
-		case OF_RECONFIG_DETACH_NODE     :
-			printk(KERN_ALERT "\tDETACH NODE\n");
-			print_device_node(dn, 1);
-			break;
-		case OF_RECONFIG_ADD_PROPERTY    :
-			printk(KERN_ALERT "\tADD PROPERTY\n");
-			print_property(newp);
-			printk(KERN_ALERT "\tOF\n");
-			print_device_node(dn, 1);
-			break;
-		case OF_RECONFIG_REMOVE_PROPERTY :
-			printk(KERN_ALERT "\tREMOVE PROPERTY\n");
-			print_property(newp);
-			printk(KERN_ALERT "\tOF\n");
-			print_device_node(dn, 1);
-			break;
-		case OF_RECONFIG_UPDATE_PROPERTY :
-			printk(KERN_ALERT "\tUPDATE PROPERTY\n");
-			print_property(newp);
-			printk(KERN_ALERT "\tOF\n");
-			print_device_node(dn, 1);
-			printk(KERN_ALERT "\tWHICH USED TO BE\n");
-			print_property(oldp);
-			break;
-		default:
-			printk(KERN_ERR "\tUNRECOGNIZED DEVICE TREE UPDATE CODE%ld\n", action);
-			break;
+	log_event(action, dn, newp, oldp);
+	
+	if (verbose) {
+		printk(KERN_ALERT "Received a device tree update:\n");
+		switch (action) {
+			case OF_RECONFIG_ATTACH_NODE:
+				printk(KERN_ALERT "\tATTACH NODE\n");
+				print_device_node(dn, 1);
+				break;
+			case OF_RECONFIG_DETACH_NODE     :
+				printk(KERN_ALERT "\tDETACH NODE\n");
+				print_device_node(dn, 1);
+				break;
+			case OF_RECONFIG_ADD_PROPERTY    :
+				printk(KERN_ALERT "\tADD PROPERTY\n");
+				print_property(newp);
+				printk(KERN_ALERT "\tOF\n");
+				print_device_node(dn, 1);
+				break;
+			case OF_RECONFIG_REMOVE_PROPERTY :
+				printk(KERN_ALERT "\tREMOVE PROPERTY\n");
+				print_property(newp);
+				printk(KERN_ALERT "\tOF\n");
+				print_device_node(dn, 1);
+				break;
+			case OF_RECONFIG_UPDATE_PROPERTY :
+				printk(KERN_ALERT "\tUPDATE PROPERTY\n");
+				print_property(newp);
+				printk(KERN_ALERT "\tOF\n");
+				print_device_node(dn, 1);
+				printk(KERN_ALERT "\tWHICH USED TO BE\n");
+				print_property(oldp);
+				break;
+			default:
+				printk(KERN_ERR "\tUNRECOGNIZED DEVICE TREE UPDATE CODE%ld\n", action);
+				break;
+		}
+	}
+	
+	//The overlay code sends these after all of its changes are applied, so
+	//the node's properties are all there by now
+	if (manage) {
+		if (action == OF_RECONFIG_ATTACH_NODE) manage_attach(dn);
+		else if (action == OF_RECONFIG_DETACH_NODE) manage_detach(dn);
 	}
 	
 	return 0;
@@ -136,10 +584,30 @@ static struct notifier_block dtoprinter_notifier = {
 int registered = 0;
 
 static int __init our_init(void) { 
+	int err;
+	
+	//Has to be a power of two for the masking to work. The final value shows
+	//up in /sys/module/dtoprinter/parameters/log_size, which is how readers
+	//know how big a record can get
+	log_size = roundup_pow_of_two(max(log_size, MIN_LOG_SIZE));
+	log_buf = vmalloc(log_size);
+	if (!log_buf) {
+		printk(KERN_ERR "Could not allocate %lu byte event log\n", log_size);
+		return -ENOMEM;
+	}
+	
+	err = misc_register(&dtolog_dev);
+	if (err < 0) {
+		printk(KERN_ERR "Could not register /dev/dtolog\n");
+		vfree(log_buf);
+		return err;
+	}
 	
-	int err = of_reconfig_notifier_register(&dtoprinter_notifier);
+	err = of_reconfig_notifier_register(&dtoprinter_notifier);
 	if (err < 0) {
 		printk(KERN_ERR "Could not register notifier\n");
+		misc_deregister(&dtolog_dev);
+		vfree(log_buf);
 	} else {
 		printk(KERN_ALERT "DTO printer inserted!\n"); 
 		registered = 1;
@@ -149,8 +617,20 @@ static int __init our_init(void) {
 } 
 
 static void our_exit(void) { 
+	struct managed_dev *m, *tmp;
+	
 	if (registered) of_reconfig_notifier_unregister(&dtoprinter_notifier);
 	
+	//Anything whose overlay is still applied
+	mutex_lock(&managed_mutex);
+	list_for_each_entry_safe(m, tmp, &managed_devs, list) {
+		untrack(m);
+	}
+	mutex_unlock(&managed_mutex);
+	
+	misc_deregister(&dtolog_dev);
+	vfree(log_buf);
+	
 	printk(KERN_ALERT "DTO printer removed!\n"); 
 } 
 
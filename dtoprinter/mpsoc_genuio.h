@@ -0,0 +1,31 @@
+#ifndef MPSOC_GENUIO_H
+#define MPSOC_GENUIO_H 1
+
+#include <linux/types.h>
+
+//Platform data for the mpsoc_genuio driver, for code that creates the
+//platform device itself instead of going through the device tree. (There's
+//a copy of this file in ../dtoprinter; keep them in sync).
+
+#define MPSOC_GENUIO_NAME "mpsoc_genuio"
+#define MPSOC_GENUIO_MAX_ACKS 4
+
+//How to acknowledge an interrupt: read the 32-bit register at offset, and if
+//any bits in mask are set, the interrupt was ours. Clear them by writing them
+//back as ones (w1c) or by writing the register back with them zeroed.
+struct mpsoc_genuio_ack {
+    u32 offset;
+    u32 mask;
+    int w1c;
+};
+
+//If num_acks is 0, there's no way to clear the interrupt at its source. The
+//driver then masks the interrupt line in the handler, and userspace unmasks
+//it by writing a 1 to the UIO file (same as uio_pdrv_genirq)
+struct mpsoc_genuio_pdata {
+    char name[32]; //UIO device name (optional)
+    unsigned num_acks;
+    struct mpsoc_genuio_ack acks[MPSOC_GENUIO_MAX_ACKS];
+};
+
+#endif
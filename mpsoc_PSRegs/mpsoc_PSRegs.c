@@ -19,6 +19,8 @@ Driver originally written by Clark and Camilo.
 #include <linux/uaccess.h>
 #include <linux/sysfs.h> 
 #include <linux/kobject.h> 
+#include <linux/mutex.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 #define CLK_BASE 0xFF5E0000U
@@ -27,37 +29,212 @@ Driver originally written by Clark and Camilo.
 #define PLCLK2 0xC8
 #define PLCLK3 0xCC
 
+//PLL control registers. The FRAC_CFG register is always 8 bytes after CTRL
+#define CRF_APB_BASE 0xFD1A0000U
+#define IOPLL_CTRL (CLK_BASE + 0x20)
+#define RPLL_CTRL (CLK_BASE + 0x30)
+#define DPLL_CTRL (CRF_APB_BASE + 0x2C)
+#define DPLL_TO_LPD_CTRL (CRF_APB_BASE + 0x4C)
+#define PLL_FRAC_CFG_OFFSET 0x8
+
+#define PLL_BYPASS_MASK 0x00000008U
+#define PLL_FBDIV_MASK 0x00007F00U
+#define PLL_FBDIV_SHIFT 8
+#define PLL_DIV2_MASK 0x00010000U
+#define PLL_FRAC_EN_MASK 0x80000000U
+#define PLL_FRAC_DATA_MASK 0x0000FFFFU
+
+//Fields in the PLx_REF_CTRL registers
 #define ENABLE_MASK 0x01000000U
 #define ENABLE_MASK_INV 0xFEFFFFFFU
-#define ENABLE_AWAYS_TRUE 0x00010002U
-#define ENABLE_AWAYS_TRUE_INV 0xFFC0FFFDU
-#define FREQ_MASK 0x00003F00U
-#define FREQ_MASK_INV 0xFFFFFC0FFU
+#define SRCSEL_MASK 0x00000007U
+#define DIV0_MASK 0x00003F00U
+#define DIV0_SHIFT 8
+#define DIV1_MASK 0x003F0000U
+#define DIV1_SHIFT 16
+#define DIV_MAX 63
+
+//Values for SRCSEL
+#define SRC_IOPLL 0
+#define SRC_RPLL 2
+#define SRC_DPLL 3
 
-int base_freq = 800;
+static unsigned long ps_ref_clk = 33333333;
+module_param(ps_ref_clk, ulong, 0444);
+MODULE_PARM_DESC(ps_ref_clk, "Frequency of PS_REF_CLK in Hz (default 33333333)");
 
 struct plclk {
     struct kobject *kobj;
     int hex;
-    int freq;
+    unsigned long freq; //In Hz
     int ena;
     void *clk_virt;
     
     struct kobj_attribute attr_ena;
     struct kobj_attribute attr_freq;
+    struct kobj_attribute attr_src;
 };
 
-int freq_find(int freq) {
-	int minIndex = 32;
-	int min = 9999;
-	int i;
-	for (i = 1; i <= 32; i++) {
-		if (min > abs(base_freq/i-freq)) {
-			min = abs(base_freq/i-freq);
-			minIndex = i;
-		}
-	}
-	return minIndex;
+//Rates of the PLLs we can choose from, read out of the PS at load time.
+//Indexed by SRCSEL value; 0 means "don't use this one"
+static unsigned long src_rates[SRCSEL_MASK + 1];
+
+static char const *src_names[SRCSEL_MASK + 1] = {
+    [SRC_IOPLL] = "iopll",
+    [SRC_RPLL] = "rpll",
+    [SRC_DPLL] = "dpll",
+};
+
+static unsigned long read_pll_rate(unsigned long ctrl_phys) {
+    void *virt = ioremap_nocache(ctrl_phys, PLL_FRAC_CFG_OFFSET + 4);
+    u32 ctrl, frac;
+    unsigned long rate;
+    
+    if (!virt) {
+        printk(KERN_ERR "mpsoc_PSRegs: could not map PLL registers at 0x%lx\n", ctrl_phys);
+        return 0;
+    }
+    ctrl = readl(virt);
+    frac = readl(virt + PLL_FRAC_CFG_OFFSET);
+    iounmap(virt);
+    
+    if (ctrl & PLL_BYPASS_MASK) return ps_ref_clk;
+    
+    //rate = ref * (FBDIV + FRAC/2^16), then halved if DIV2 is set
+    rate = ps_ref_clk * ((ctrl & PLL_FBDIV_MASK) >> PLL_FBDIV_SHIFT);
+    if (frac & PLL_FRAC_EN_MASK) {
+        rate += (ps_ref_clk * (frac & PLL_FRAC_DATA_MASK)) >> 16;
+    }
+    if (ctrl & PLL_DIV2_MASK) rate /= 2;
+    return rate;
+}
+
+//Fills in src_rates. Returns the number of sources we can use
+static int read_src_rates(void) {
+    void *virt;
+    int usable = 0;
+    int src;
+    
+    src_rates[SRC_IOPLL] = read_pll_rate(IOPLL_CTRL);
+    src_rates[SRC_RPLL] = read_pll_rate(RPLL_CTRL);
+    
+    //The DPLL goes through one more divider on its way over to the LPD
+    src_rates[SRC_DPLL] = 0;
+    virt = ioremap_nocache(DPLL_TO_LPD_CTRL, 4);
+    if (virt) {
+        unsigned div = (readl(virt) & DIV0_MASK) >> DIV0_SHIFT;
+        iounmap(virt);
+        if (div) src_rates[SRC_DPLL] = read_pll_rate(DPLL_CTRL) / div;
+    }
+    
+    printk(KERN_INFO "mpsoc_PSRegs: IOPLL = %lu Hz, RPLL = %lu Hz, DPLL_TO_LPD = %lu Hz\n",
+        src_rates[SRC_IOPLL], src_rates[SRC_RPLL], src_rates[SRC_DPLL]);
+    
+    for (src = 0; src <= SRCSEL_MASK; src++) {
+        if (!src_names[src]) continue;
+        if (src_rates[src]) usable++;
+        else printk(KERN_WARNING "mpsoc_PSRegs: could not work out the %s rate, so it won't be used\n", src_names[src]);
+    }
+    return usable;
+}
+
+//Works out the rate a PLx_REF_CTRL value will give
+static unsigned long hex_to_freq(int hex) {
+    unsigned src = hex & SRCSEL_MASK;
+    unsigned div0 = (hex & DIV0_MASK) >> DIV0_SHIFT;
+    unsigned div1 = (hex & DIV1_MASK) >> DIV1_SHIFT;
+    if (div0 == 0 || div1 == 0) return 0;
+    return src_rates[src] / (div0 * div1);
+}
+
+//Searches every source and both divisors for the rate closest to freq. Returns
+//the new PLx_REF_CTRL value (based on old_hex, with CLKACT untouched)
+static int freq_find(unsigned long freq, int old_hex) {
+    unsigned long best_err = ULONG_MAX;
+    int best_hex = old_hex;
+    unsigned src;
+    
+    for (src = 0; src <= SRCSEL_MASK; src++) {
+        unsigned long rate = src_rates[src];
+        unsigned div0;
+        if (rate == 0) continue;
+        
+        for (div0 = 1; div0 <= DIV_MAX; div0++) {
+            //For a given div0, the best div1 is the rounded quotient. Check
+            //its neighbours too, since rounding happens twice
+            long guess = DIV_ROUND_CLOSEST(rate, (unsigned long) div0 * freq);
+            long div1;
+            guess = clamp(guess, 1L, (long) DIV_MAX);
+            for (div1 = guess - 1; div1 <= guess + 1; div1++) {
+                unsigned long achieved, err;
+                if (div1 < 1 || div1 > DIV_MAX) continue;
+                achieved = rate / (div0 * div1);
+                err = (achieved > freq) ? achieved - freq : freq - achieved;
+                if (err < best_err) {
+                    best_err = err;
+                    best_hex = (old_hex & ~(SRCSEL_MASK | DIV0_MASK | DIV1_MASK)) 
+                        | src | (div0 << DIV0_SHIFT) | (div1 << DIV1_SHIFT);
+                }
+            }
+        }
+    }
+    return best_hex;
+}
+
+#define NUM_PLCLKS 4
+
+static struct plclk pl_clocks[NUM_PLCLKS];
+
+//Protects pl_clocks. Every change to the PLx_REF_CTRL registers goes through
+//apply_plan with this held
+static DEFINE_MUTEX(clk_mutex);
+
+struct plan_entry {
+    int change;         //If 0, leave this clock alone
+    unsigned long freq; //Target rate in Hz
+    int ena;
+};
+
+//Reprograms every clock in the plan without letting any of them run at an
+//in-between setting: first gate all the clocks we're changing, then write the
+//new sources and divisors, then ungate them in order (fclk0 first). Caller
+//must hold clk_mutex.
+static void apply_plan(struct plan_entry const *plan) {
+    int new_hex[NUM_PLCLKS];
+    int i;
+    
+    //Work out all the new values before touching any hardware
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        new_hex[i] = pl_clocks[i].hex;
+        if (!plan[i].change) continue;
+        if (plan[i].freq) new_hex[i] = freq_find(plan[i].freq, new_hex[i]);
+        new_hex[i] = (new_hex[i] & ENABLE_MASK_INV) | (plan[i].ena ? ENABLE_MASK : 0);
+    }
+    
+    //Gate
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        if (plan[i].change && (pl_clocks[i].hex & ENABLE_MASK)) {
+            writel(pl_clocks[i].hex & ENABLE_MASK_INV, pl_clocks[i].clk_virt);
+        }
+    }
+    
+    //Reprogram while gated
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        if (plan[i].change) writel(new_hex[i] & ENABLE_MASK_INV, pl_clocks[i].clk_virt);
+    }
+    
+    //Give the dividers a moment to settle (a microsecond is hundreds of 
+    //cycles of even the slowest source) before letting the clocks out
+    udelay(1);
+    
+    //Ungate
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        if (!plan[i].change) continue;
+        if (new_hex[i] & ENABLE_MASK) writel(new_hex[i], pl_clocks[i].clk_virt);
+        pl_clocks[i].hex = new_hex[i];
+        pl_clocks[i].ena = (new_hex[i] & ENABLE_MASK) ? 1 : 0;
+        pl_clocks[i].freq = hex_to_freq(new_hex[i]);
+    }
 }
 
 static ssize_t ena_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
@@ -75,45 +252,353 @@ static ssize_t ena_store(struct kobject *kobj, struct kobj_attribute *attr,const
 		return count;
 	}
     
+	mutex_lock(&clk_mutex);
 	clk->ena = enatmp ? 1 : 0;
-	clk->hex = (((clk->hex & ENABLE_MASK_INV) | ((clk->ena << 24) & ENABLE_MASK)) & ENABLE_AWAYS_TRUE_INV) | ENABLE_AWAYS_TRUE;
+	clk->hex = (clk->hex & ENABLE_MASK_INV) | ((clk->ena << 24) & ENABLE_MASK);
 	if (clk->ena) {
 		printk(KERN_INFO "enabling %s\n", kobj->name);
 	} else {
 		printk(KERN_INFO "disabling %s\n", kobj->name);
 	}
 	writel(clk->hex,clk->clk_virt);
+	mutex_unlock(&clk_mutex);
 	return count;
 }
 
 static ssize_t freq_show /* "freak show" */ (struct kobject *kobj, struct kobj_attribute *attr, char *buf)
 {
     struct plclk *clk = container_of(attr, struct plclk, attr_freq);
-	return sprintf(buf, "%d MHz\n", clk->freq);
+	return sprintf(buf, "%lu\n", clk->freq);
 }
 
 static ssize_t freq_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
 {
     struct plclk *clk = container_of(attr, struct plclk, attr_freq);
-	int freqtmp;
-	int divider;
-	if (sscanf(buf,"%d",&freqtmp) != 1) {
+    struct plan_entry plan[NUM_PLCLKS] = {};
+	unsigned long freqtmp;
+	if (sscanf(buf,"%lu",&freqtmp) != 1 || freqtmp == 0) {
 		printk(KERN_ERR "it is illegal to write non-numeric value to mpsoc regs!\n");
 		return count;
 	}
-	divider = freq_find(freqtmp);
-	clk->freq = base_freq / divider;
-	printk(KERN_INFO "changing %s's frequency to %d\n", kobj->name, clk->freq);
-	clk->hex = (clk->hex & FREQ_MASK_INV) | ((divider << 8) & FREQ_MASK);
-	writel(clk->hex, clk->clk_virt);
+	//Old scripts wrote the frequency in MHz. Nobody wants a PL clock below
+	//1 kHz, so treat small numbers that way
+	if (freqtmp < 1000) freqtmp *= 1000000;
+	
+	mutex_lock(&clk_mutex);
+	plan[clk - pl_clocks].change = 1;
+	plan[clk - pl_clocks].freq = freqtmp;
+	plan[clk - pl_clocks].ena = clk->ena;
+	apply_plan(plan);
+	printk(KERN_INFO "changing %s's frequency to %lu Hz (from %s)\n", kobj->name, clk->freq, src_names[clk->hex & SRCSEL_MASK]);
+	mutex_unlock(&clk_mutex);
 	return count;
 }
 
-static struct plclk pl_clocks[4];
+static ssize_t src_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct plclk *clk = container_of(attr, struct plclk, attr_src);
+    char const *name = src_names[clk->hex & SRCSEL_MASK];
+	return sprintf(buf, "%s\n", name ? name : "unknown");
+}
+
+//clocks/plan reads back the achieved rate of all four clocks in Hz (0 if the
+//clock is off). Writing four space-separated values changes all of them in
+//one go: a rate in Hz turns the clock on at that rate, 0 turns it off, and -
+//leaves it alone. e.g.
+//    echo "250000000 100000000 - 0" > /sys/mpsoc/clocks/plan
+static ssize_t plan_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    int i;
+    int pos = 0;
+    mutex_lock(&clk_mutex);
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        pos += sprintf(buf + pos, "%lu%c", pl_clocks[i].ena ? pl_clocks[i].freq : 0,
+            (i == NUM_PLCLKS - 1) ? '\n' : ' ');
+    }
+    mutex_unlock(&clk_mutex);
+    return pos;
+}
+
+static ssize_t plan_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    struct plan_entry plan[NUM_PLCLKS] = {};
+    char tok[NUM_PLCLKS][24];
+    int i;
+    
+    if (sscanf(buf, "%23s %23s %23s %23s", tok[0], tok[1], tok[2], tok[3]) != NUM_PLCLKS) {
+        printk(KERN_ERR "mpsoc_PSRegs: clock plan needs exactly %d entries\n", NUM_PLCLKS);
+        return -EINVAL;
+    }
+    
+    //Parse everything first, so a bad plan leaves the hardware alone
+    for (i = 0; i < NUM_PLCLKS; i++) {
+        if (!strcmp(tok[i], "-")) continue;
+        if (kstrtoul(tok[i], 0, &plan[i].freq)) {
+            printk(KERN_ERR "mpsoc_PSRegs: could not parse clock plan entry \"%s\"\n", tok[i]);
+            return -EINVAL;
+        }
+        plan[i].change = 1;
+        plan[i].ena = (plan[i].freq != 0);
+    }
+    
+    mutex_lock(&clk_mutex);
+    apply_plan(plan);
+    mutex_unlock(&clk_mutex);
+    return count;
+}
+
+static struct kobj_attribute attr_plan = __ATTR(plan, 0664, plan_show, plan_store);
+
 static struct kobject *mpsoc_root, *clocks;
 
+//AFI FM (the PS side of the S_AXI_HP/HPC/LPD ports) registers
+#define AFI_RDCTRL 0x00
+#define AFI_RDISSUE 0x04
+#define AFI_RDQOS 0x08
+#define AFI_WRCTRL 0x14
+#define AFI_WRISSUE 0x18
+#define AFI_WRQOS 0x1C
+#define AFI_SPAN 0x20
+
+//Encodings for the FABRIC_WIDTH field of RDCTRL/WRCTRL
+#define AFI_WIDTH_128 0
+#define AFI_WIDTH_64 1
+#define AFI_WIDTH_32 2
+
+struct afi_field {
+    char const *name;
+    unsigned offset;
+    unsigned shift;
+    unsigned mask; //Applied after shifting
+    int is_width;  //Shown and written as 32/64/128 instead of the raw encoding
+};
+
+//Each of these shows up as a file in /sys/mpsoc/afi/<port>/
+//  rd_width, wr_width: data width of the PL side of the port, in bits. Must
+//                      match the width of your PL master, and should only be
+//                      changed when nothing is using the port
+//  rd_issue, wr_issue: issuing capability (max outstanding commands, minus one)
+//  rd_qos, wr_qos:     static AXI QoS value used for the port's commands
+//  rd_fabric_qos, wr_fabric_qos: if 1, use the AxQOS signals from the PL
+//                      instead of rd_qos/wr_qos
+static struct afi_field const afi_fields[] = {
+    {"rd_width",      AFI_RDCTRL,  0, 0x3, 1},
+    {"rd_fabric_qos", AFI_RDCTRL,  2, 0x1, 0},
+    {"rd_issue",      AFI_RDISSUE, 0, 0x3, 0},
+    {"rd_qos",        AFI_RDQOS,   0, 0xF, 0},
+    {"wr_width",      AFI_WRCTRL,  0, 0x3, 1},
+    {"wr_fabric_qos", AFI_WRCTRL,  2, 0x1, 0},
+    {"wr_issue",      AFI_WRISSUE, 0, 0x3, 0},
+    {"wr_qos",        AFI_WRQOS,   0, 0xF, 0},
+};
+
+#define NUM_AFI_FIELDS ARRAY_SIZE(afi_fields)
+
+struct afi_port;
+
+struct afi_attr {
+    struct kobj_attribute attr;
+    struct afi_port *port;
+    struct afi_field const *field;
+};
+
+struct afi_port {
+    char const *name;
+    unsigned long phys;
+    struct kobject *kobj;
+    void *virt;
+    struct afi_attr attrs[NUM_AFI_FIELDS];
+};
+
+static struct afi_port afi_ports[] = {
+    {.name = "hpc0", .phys = 0xFD360000},
+    {.name = "hpc1", .phys = 0xFD370000},
+    {.name = "hp0",  .phys = 0xFD380000},
+    {.name = "hp1",  .phys = 0xFD390000},
+    {.name = "hp2",  .phys = 0xFD3A0000},
+    {.name = "hp3",  .phys = 0xFD3B0000},
+    {.name = "lpd",  .phys = 0xFF9B0000},
+};
+
+#define NUM_AFI_PORTS ARRAY_SIZE(afi_ports)
+
+static DEFINE_MUTEX(afi_mutex);
+static struct kobject *afi;
+
+static ssize_t afi_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct afi_attr *a = container_of(attr, struct afi_attr, attr);
+    unsigned val = (readl(a->port->virt + a->field->offset) >> a->field->shift) & a->field->mask;
+    
+    if (a->field->is_width) {
+        switch (val) {
+            case AFI_WIDTH_128: return sprintf(buf, "128\n");
+            case AFI_WIDTH_64:  return sprintf(buf, "64\n");
+            case AFI_WIDTH_32:  return sprintf(buf, "32\n");
+            default:            return sprintf(buf, "unknown (%u)\n", val);
+        }
+    }
+    return sprintf(buf, "%u\n", val);
+}
+
+static ssize_t afi_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    struct afi_attr *a = container_of(attr, struct afi_attr, attr);
+    unsigned val;
+    u32 reg;
+    
+    if (kstrtouint(buf, 0, &val)) {
+        printk(KERN_ERR "it is illegal to write non-numeric value to mpsoc regs!\n");
+        return -EINVAL;
+    }
+    
+    if (a->field->is_width) {
+        switch (val) {
+            case 128: val = AFI_WIDTH_128; break;
+            case 64:  val = AFI_WIDTH_64; break;
+            case 32:  val = AFI_WIDTH_32; break;
+            default:
+                printk(KERN_ERR "mpsoc_PSRegs: AFI width must be 32, 64 or 128\n");
+                return -EINVAL;
+        }
+    } else if (val > a->field->mask) {
+        printk(KERN_ERR "mpsoc_PSRegs: %s must be at most %u\n", a->field->name, a->field->mask);
+        return -EINVAL;
+    }
+    
+    mutex_lock(&afi_mutex);
+    reg = readl(a->port->virt + a->field->offset);
+    reg &= ~(a->field->mask << a->field->shift);
+    reg |= val << a->field->shift;
+    writel(reg, a->port->virt + a->field->offset);
+    mutex_unlock(&afi_mutex);
+    
+    printk(KERN_INFO "mpsoc_PSRegs: set %s/%s to %s", a->port->name, a->field->name, buf);
+    return count;
+}
+
+//Coherency controls for the S_AXI_HPC ports. HPC0/HPC1 reach DDR through
+//slave interface 3 of the CCI-400, which only snoops the APU caches if its
+//snoop control register says so.
+//
+//Snooping is only half the story: the PL master also has to mark its
+//transactions as cacheable and shareable (AxCACHE = 4'b1111 or 4'b1011 and
+//AxPROT[1] matching the buffer's security state). That's set in your PL
+//design (e.g. the cache/prot settings of an HLS m_axi port or the AXI DMA's
+//SG/data cache parameters), not here.
+#define CCI_BASE 0xFD6E0000U
+#define CCI_S3_SNOOP_CTRL (CCI_BASE + 0x4000)
+#define CCI_SNOOP_EN_MASK 0x1U
+
+static void *cci_s3_virt;
+static struct kobject *coherency;
+
+//hpc_snoop: 1 if the CCI snoops HPC0/HPC1 traffic. Write 1 to turn it on
+static ssize_t hpc_snoop_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%d\n", (readl(cci_s3_virt) & CCI_SNOOP_EN_MASK) ? 1 : 0);
+}
+
+static ssize_t hpc_snoop_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    int en;
+    u32 reg;
+    
+    if (sscanf(buf, "%d", &en) != 1) {
+        printk(KERN_ERR "it is illegal to write non-numeric value to mpsoc regs!\n");
+        return -EINVAL;
+    }
+    
+    reg = readl(cci_s3_virt);
+    reg = en ? (reg | CCI_SNOOP_EN_MASK) : (reg & ~CCI_SNOOP_EN_MASK);
+    writel(reg, cci_s3_virt);
+    printk(KERN_INFO "mpsoc_PSRegs: %s CCI snooping for HPC ports\n", en ? "enabled" : "disabled");
+    return count;
+}
+
+static struct kobj_attribute attr_hpc_snoop = __ATTR(hpc_snoop, 0664, hpc_snoop_show, hpc_snoop_store);
+
+static void coherency_unregister(void) {
+    if (coherency) kobject_put(coherency);
+    if (cci_s3_virt) iounmap(cci_s3_virt);
+    coherency = NULL;
+    cci_s3_virt = NULL;
+}
+
+static int coherency_register(void) {
+    cci_s3_virt = ioremap_nocache(CCI_S3_SNOOP_CTRL, 4);
+    coherency = kobject_create_and_add("coherency", mpsoc_root);
+    if (!cci_s3_virt || !coherency || sysfs_create_file(coherency, &attr_hpc_snoop.attr)) {
+        printk(KERN_ERR "mpsoc_PSRegs: could not set up coherency controls\n");
+        coherency_unregister();
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void afi_unregister(void) {
+    int i;
+    for (i = 0; i < NUM_AFI_PORTS; i++) {
+        if (afi_ports[i].kobj) kobject_put(afi_ports[i].kobj);
+        if (afi_ports[i].virt) iounmap(afi_ports[i].virt);
+        afi_ports[i].kobj = NULL;
+        afi_ports[i].virt = NULL;
+    }
+    if (afi) kobject_put(afi);
+    afi = NULL;
+}
+
+static int afi_register(void) {
+    int i, j;
+    
+    afi = kobject_create_and_add("afi", mpsoc_root);
+    if (!afi) return -ENOMEM;
+    
+    for (i = 0; i < NUM_AFI_PORTS; i++) {
+        struct afi_port *port = &afi_ports[i];
+        
+        port->virt = ioremap_nocache(port->phys, AFI_SPAN);
+        port->kobj = kobject_create_and_add(port->name, afi);
+        if (!port->virt || !port->kobj) {
+            printk(KERN_ERR "mpsoc_PSRegs: could not set up AFI port %s\n", port->name);
+            afi_unregister();
+            return -ENOMEM;
+        }
+        
+        for (j = 0; j < NUM_AFI_FIELDS; j++) {
+            struct afi_attr *a = &port->attrs[j];
+            int retval;
+            
+            a->port = port;
+            a->field = &afi_fields[j];
+            sysfs_attr_init(&a->attr.attr);
+            a->attr.attr.name = afi_fields[j].name;
+            a->attr.attr.mode = 0664;
+            a->attr.show = afi_show;
+            a->attr.store = afi_store;
+            
+            retval = sysfs_create_file(port->kobj, &a->attr.attr);
+            if (retval) {
+                printk(KERN_ERR "mpsoc_PSRegs: could not create %s/%s\n", port->name, afi_fields[j].name);
+                afi_unregister();
+                return retval;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+
 static int __init mpsoc_psregs_init(void) {
     int i;
+    
+    //Everything below (reading back and setting frequencies) depends on these
+    if (read_src_rates() == 0) {
+        printk(KERN_ERR "mpsoc_PSRegs: could not read any PLL rates\n");
+        return -ENODEV;
+    }
+    
 	mpsoc_root = kobject_create_and_add("mpsoc",NULL);
 	clocks = kobject_create_and_add("clocks",mpsoc_root); 
     
@@ -129,8 +614,8 @@ static int __init mpsoc_psregs_init(void) {
         pl_clocks[i].kobj = kobject_create_and_add(name, clocks);
         
         pl_clocks[i].hex = readl(pl_clocks[i].clk_virt);
-        pl_clocks[i].ena = pl_clocks[i].hex >> 24;
-        pl_clocks[i].freq = base_freq / ((pl_clocks[i].hex & FREQ_MASK) >> 8);
+        pl_clocks[i].ena = (pl_clocks[i].hex & ENABLE_MASK) ? 1 : 0;
+        pl_clocks[i].freq = hex_to_freq(pl_clocks[i].hex);
         
         pl_clocks[i].attr_ena.attr.name = "enable";
         pl_clocks[i].attr_ena.attr.mode = 0664;
@@ -142,6 +627,11 @@ static int __init mpsoc_psregs_init(void) {
         pl_clocks[i].attr_freq.show = freq_show;
         pl_clocks[i].attr_freq.store = freq_store;
         
+        pl_clocks[i].attr_src.attr.name = "source";
+        pl_clocks[i].attr_src.attr.mode = 0444;
+        pl_clocks[i].attr_src.show = src_show;
+        pl_clocks[i].attr_src.store = NULL;
+        
         retval = sysfs_create_file(pl_clocks[i].kobj, &(pl_clocks[i].attr_ena.attr));
         if (retval) {
             printk(KERN_ERR "Everything is now broken! Please reboot!");
@@ -155,6 +645,31 @@ static int __init mpsoc_psregs_init(void) {
             printk(KERN_ERR "Everything is now broken! Please reboot!");
             return retval;
         }
+        
+        retval = sysfs_create_file(pl_clocks[i].kobj, &(pl_clocks[i].attr_src.attr));
+        if (retval) {
+            printk(KERN_ERR "Everything is now broken! Please reboot!");
+            return retval;
+        }
+    }
+    
+    //Changes several clocks at once, see plan_store
+    if (sysfs_create_file(clocks, &attr_plan.attr)) {
+        printk(KERN_ERR "Everything is now broken! Please reboot!");
+        return -ENOMEM;
+    }
+    
+    if (afi_register()) {
+        printk(KERN_ERR "Everything is now broken! Please reboot!");
+        sysfs_remove_file(clocks, &attr_plan.attr);
+        return -ENOMEM;
+    }
+    
+    if (coherency_register()) {
+        printk(KERN_ERR "Everything is now broken! Please reboot!");
+        afi_unregister();
+        sysfs_remove_file(clocks, &attr_plan.attr);
+        return -ENOMEM;
     }
 
 	printk(KERN_INFO "Finished registering MPSOC sysfs register file group!\n");
@@ -164,6 +679,9 @@ static int __init mpsoc_psregs_init(void) {
 void __exit mpsoc_psregs_exit(void)
 {
     int i;
+    coherency_unregister();
+    afi_unregister();
+    sysfs_remove_file(clocks, &attr_plan.attr);
     for (i = 0; i < 4; i++)	{
         iounmap(pl_clocks[i].clk_virt);
         kobject_put(pl_clocks[i].kobj);
@@ -0,0 +1,129 @@
+//Measures how fast we can memcpy into (and out of) PL memory for each of the
+//mpsoc_axiregs mapping types. Point it at a BRAM (or any AXI memory) in the PL:
+//
+//    ./bram_bench <window index> <offset in window> <size>
+//
+//e.g. ./bram_bench 0 0x10000 0x8000 for a 32K BRAM at 0xA0010000
+//
+//Keep the size a multiple of the page size. libc's memcpy will happily do
+//unaligned accesses, which fault on the Device mapping types.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap
+#include <sys/ioctl.h> //ioctl
+#include <unistd.h> //close
+#include <time.h> //clock_gettime
+#include "mpsoc_axiregs.h"
+
+#define NUM_REPS 64
+
+static char const *type_names[] = {"nocache", "device", "wc", "cached"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//With a cached mapping, the data isn't in the PL until we clean it out of the
+//cache. Count that as part of the copy, otherwise the numbers are a lie
+static void clean_range(void *p, size_t sz) {
+#if defined(__aarch64__)
+    uintptr_t addr = ((uintptr_t) p) & ~((uintptr_t) 63);
+    uintptr_t end = (uintptr_t) p + sz;
+    for (; addr < end; addr += 64) {
+        asm volatile("dc cvac, %0" :: "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+#else
+    (void) p;
+    (void) sz;
+#endif
+}
+
+static void inval_range(void *p, size_t sz) {
+#if defined(__aarch64__)
+    uintptr_t addr = ((uintptr_t) p) & ~((uintptr_t) 63);
+    uintptr_t end = (uintptr_t) p + sz;
+    for (; addr < end; addr += 64) {
+        asm volatile("dc civac, %0" :: "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+#else
+    (void) p;
+    (void) sz;
+#endif
+}
+
+int main(int argc, char **argv) {
+    int ret = 0;
+    int fd = -1;
+    char *src = NULL;
+
+    if (argc != 4) {
+        puts("Usage: bram_bench <window index> <offset in window> <size>");
+        return 0;
+    }
+
+    unsigned win = strtoul(argv[1], NULL, 0);
+    unsigned long off = strtoul(argv[2], NULL, 0);
+    size_t sz = strtoul(argv[3], NULL, 0);
+
+    fd = open("/dev/mpsoc_axiregs", O_RDWR);
+    if (fd == -1) {
+        perror("Could not open /dev/mpsoc_axiregs");
+        ret = -1;
+        goto cleanup;
+    }
+
+    struct mpsoc_axiregs_window info = {.index = win};
+    if (ioctl(fd, MPSOC_AXIREGS_GET_WINDOW, &info) < 0) {
+        perror("Could not get window info");
+        ret = -1;
+        goto cleanup;
+    }
+    printf("Window %u is %s at 0x%lx; testing 0x%zx bytes at 0x%lx\n", win, info.name, info.phys, sz, info.phys + off);
+
+    src = malloc(sz);
+    if (!src) {
+        perror("Could not allocate source buffer");
+        ret = -1;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < sz; i++) src[i] = i;
+
+    printf("%-8s %12s %12s\n", "type", "write MB/s", "read MB/s");
+    for (unsigned type = MPSOC_AXIREGS_MAP_NOCACHE; type <= MPSOC_AXIREGS_MAP_CACHED; type++) {
+        void *dst = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, MPSOC_AXIREGS_MMAP_OFFSET_TYPE(win, off, type));
+        if (dst == MAP_FAILED) {
+            perror("Could not mmap PL memory");
+            continue;
+        }
+
+        double start = now();
+        for (int i = 0; i < NUM_REPS; i++) {
+            memcpy(dst, src, sz);
+            if (type == MPSOC_AXIREGS_MAP_CACHED) clean_range(dst, sz);
+        }
+        double wr = (double) sz * NUM_REPS / (now() - start) / 1e6;
+
+        start = now();
+        for (int i = 0; i < NUM_REPS; i++) {
+            if (type == MPSOC_AXIREGS_MAP_CACHED) inval_range(dst, sz);
+            memcpy(src, dst, sz);
+        }
+        double rd = (double) sz * NUM_REPS / (now() - start) / 1e6;
+
+        printf("%-8s %12.1f %12.1f\n", type_names[type], wr, rd);
+        munmap(dst, sz);
+    }
+
+    cleanup:
+    if (src) free(src);
+    if (fd != -1) close(fd);
+    return ret;
+}
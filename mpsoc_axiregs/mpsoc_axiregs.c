@@ -7,20 +7,157 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/poll.h>
+#include <linux/io.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/sched/signal.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/irqdomain.h>
+#include <linux/eventfd.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <asm/uaccess.h>
+#include "mpsoc_axiregs.h"
 #define VMEM_FLAGS (VM_IO | VM_DONTEXPAND | VM_DONTDUMP)
+
+//Each window is one physical aperture that userspace is allowed to mmap
+struct mpsoc_axireg_window {
+	char name[16];
+	unsigned long phys;
+	unsigned long size;
+};
+
+//Longest we'll sleep between reads when polling a register
+#define MAX_POLL_SLEEP_US 1000
+//With sleep_us = 0, how long we spin before falling back to sleeping (from
+//POLL_FALLBACK_SLEEP_US up). A batch can hold hundreds of polls with huge
+//timeouts, and we can't hog a CPU for that long
+#define MAX_POLL_SPIN_US 20
+#define POLL_FALLBACK_SLEEP_US 10
+
+//Batched ops only ioremap the pages they touch, and only while the batch
+//runs. Mapping whole windows at load time ate about 1 GB of vmalloc space
+//with the defaults, and left a Device alias of memory that userspace maps WC
+//or cached
+#define BATCH_MAP_SLOTS 8
+
+struct mpsoc_axireg_batch_map {
+	struct {
+		unsigned long page;
+		void __iomem *virt; //NULL if the slot is free
+	} slots[BATCH_MAP_SLOTS];
+	unsigned next; //Slot to reuse once they're all taken
+};
+
+static struct mpsoc_axireg_window windows[MPSOC_AXIREGS_MAX_WINDOWS];
+static int num_windows;
+
+//Used if no windows are given as module parameters
+static struct mpsoc_axireg_window default_windows[] = {
+	{.name = "hpm0_fpd", .phys = 0xA0000000, .size = 0x10000000},
+	{.name = "hpm1_fpd", .phys = 0xB0000000, .size = 0x10000000},
+	{.name = "hpm0_lpd", .phys = 0x80000000, .size = 0x20000000},
+};
+
+//Windows can be overridden at load time, e.g.
+//    insmod mpsoc_axiregs.ko win_phys=0xA0000000,0xA0010000 win_size=0x1000,0x10000
+static unsigned long win_phys[MPSOC_AXIREGS_MAX_WINDOWS];
+static int num_win_phys;
+module_param_array(win_phys, ulong, &num_win_phys, 0444);
+MODULE_PARM_DESC(win_phys, "Physical base address of each window (replaces the HPM0/HPM1/LPD defaults)");
+
+static unsigned long win_size[MPSOC_AXIREGS_MAX_WINDOWS];
+static int num_win_size;
+module_param_array(win_size, ulong, &num_win_size, 0444);
+MODULE_PARM_DESC(win_size, "Size in bytes of each window given in win_phys");
+
+//Any node compatible with this string has its reg entries appended to the
+//window list (named with reg-names, if present)
+#define MPSOC_AXIREGS_DT_COMPAT "uoft,mpsoc-axiregs"
+
+//PL-to-PS interrupt lines we've been asked to bind. The pl_ps_irq0 lines are
+//GIC SPIs 89 to 96, and pl_ps_irq1 are 104 to 111
+static unsigned int irq_spi[MPSOC_AXIREGS_MAX_IRQS];
+static int num_irq_spi;
+module_param_array(irq_spi, uint, &num_irq_spi, 0444);
+MODULE_PARM_DESC(irq_spi, "GIC SPI number of each PL-to-PS interrupt to deliver through poll/read/eventfd");
+
+struct mpsoc_axireg_irq {
+	unsigned spi;
+	int virq;
+	unsigned count;	//Number of times this line has fired
+	int masked;	//Set by the handler, cleared by MPSOC_AXIREGS_IRQ_UNMASK
+	struct eventfd_ctx *efd;
+	struct file *efd_owner;
+};
+
+static struct mpsoc_axireg_irq irqs[MPSOC_AXIREGS_MAX_IRQS];
+static int num_irqs;
+static DEFINE_SPINLOCK(irq_lock); //Protects everything in irqs[]
+static DECLARE_WAIT_QUEUE_HEAD(irq_wq);
+
 struct mpsoc_axireg_priv {
-	wait_queue_head_t wq;
+	unsigned last_seen[MPSOC_AXIREGS_MAX_IRQS]; //Event counts as of our last read()
 	unsigned int num_pages;
 	char **page_ptr;
 };
 
+static irqreturn_t mpsoc_axireg_irq_handler(int irq, void *data)
+{
+	struct mpsoc_axireg_irq *line = data;
+
+	//We don't know how to clear the interrupt in the PL, so mask the line
+	//until userspace has dealt with it
+	spin_lock(&irq_lock);
+	disable_irq_nosync(irq);
+	line->masked = 1;
+	line->count++;
+	if (line->efd)
+		eventfd_signal(line->efd, 1);
+	spin_unlock(&irq_lock);
+
+	wake_up_interruptible(&irq_wq);
+	return IRQ_HANDLED;
+}
+
+//Returns nonzero if any line has fired since this file last looked
+static int mpsoc_axireg_irq_pending(struct mpsoc_axireg_priv *priv)
+{
+	unsigned long flags;
+	int i;
+	int ret = 0;
+
+	spin_lock_irqsave(&irq_lock, flags);
+	for (i = 0; i < num_irqs; i++) {
+		if (irqs[i].count != priv->last_seen[i]) {
+			ret = 1;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&irq_lock, flags);
+	return ret;
+}
+
+static int mpsoc_axireg_line_fired(struct mpsoc_axireg_priv *priv, unsigned line)
+{
+	return READ_ONCE(irqs[line].count) != priv->last_seen[line];
+}
+
 static int mpsoc_axireg_open(struct inode *inode, struct file *filp)
 {
 	struct mpsoc_axireg_priv *priv = (struct mpsoc_axireg_priv *) kzalloc(sizeof(struct mpsoc_axireg_priv), GFP_KERNEL);
+	unsigned long flags;
+	int i;
 	if (priv == NULL)
 		return -ENOMEM;
-	init_waitqueue_head(&priv->wq);
+	//Only report interrupts that happen after the file is opened
+	spin_lock_irqsave(&irq_lock, flags);
+	for (i = 0; i < num_irqs; i++)
+		priv->last_seen[i] = irqs[i].count;
+	spin_unlock_irqrestore(&irq_lock, flags);
 	filp->private_data = (void *) priv;
 	printk(KERN_INFO "open MPSOC axi reg charactor device\n");
 	return 0;
@@ -29,7 +166,20 @@ static int mpsoc_axireg_open(struct inode *inode, struct file *filp)
 static int mpsoc_axireg_release(struct inode *inode, struct file *filp)
 {
 	struct mpsoc_axireg_priv *priv = (struct mpsoc_axireg_priv *) filp->private_data;
+	unsigned long flags;
 	unsigned int i;
+
+	//Drop any eventfds this file attached
+	spin_lock_irqsave(&irq_lock, flags);
+	for (i = 0; i < num_irqs; i++) {
+		if (irqs[i].efd && irqs[i].efd_owner == filp) {
+			eventfd_ctx_put(irqs[i].efd);
+			irqs[i].efd = NULL;
+			irqs[i].efd_owner = NULL;
+		}
+	}
+	spin_unlock_irqrestore(&irq_lock, flags);
+
 	for (i = 0; i < priv->num_pages; i++)
 		free_page((unsigned long) priv->page_ptr[i]);
 	if (priv->page_ptr)
@@ -39,6 +189,52 @@ static int mpsoc_axireg_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+static ssize_t mpsoc_axireg_read(struct file *filp, char __user *buf, size_t sz, loff_t *off)
+{
+	struct mpsoc_axireg_priv *priv = (struct mpsoc_axireg_priv *) filp->private_data;
+	unsigned counts[MPSOC_AXIREGS_MAX_IRQS];
+	unsigned long flags;
+	int i;
+	int rc;
+
+	if (num_irqs == 0)
+		return -ENODEV;
+	if (sz < num_irqs * sizeof(unsigned))
+		return -EINVAL;
+
+	if (filp->f_flags & O_NONBLOCK) {
+		if (!mpsoc_axireg_irq_pending(priv))
+			return -EAGAIN;
+	} else {
+		rc = wait_event_interruptible(irq_wq, mpsoc_axireg_irq_pending(priv));
+		if (rc)
+			return rc;
+	}
+
+	spin_lock_irqsave(&irq_lock, flags);
+	for (i = 0; i < num_irqs; i++) {
+		counts[i] = irqs[i].count;
+		priv->last_seen[i] = counts[i];
+	}
+	spin_unlock_irqrestore(&irq_lock, flags);
+
+	if (copy_to_user(buf, counts, num_irqs * sizeof(unsigned)))
+		return -EFAULT;
+	return num_irqs * sizeof(unsigned);
+}
+
+static unsigned int mpsoc_axireg_poll(struct file *filp, poll_table *wait)
+{
+	struct mpsoc_axireg_priv *priv = (struct mpsoc_axireg_priv *) filp->private_data;
+
+	if (num_irqs == 0)
+		return POLLERR;
+	poll_wait(filp, &irq_wq, wait);
+	if (mpsoc_axireg_irq_pending(priv))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 static int mpsoc_axireg_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	int rc;
@@ -46,12 +242,45 @@ static int mpsoc_axireg_mmap(struct file *filp, struct vm_area_struct *vma)
 	unsigned long phys;
 	unsigned long vsize;
 	unsigned long psize;
+	unsigned win;
+	unsigned type;
 
 	off = vma->vm_pgoff << PAGE_SHIFT;
-	phys = 0xA0000000 + off;
+	win = (off >> MPSOC_AXIREGS_WIN_SHIFT) & MPSOC_AXIREGS_WIN_MASK;
+	type = (off >> MPSOC_AXIREGS_MAP_SHIFT) & MPSOC_AXIREGS_MAP_MASK;
+	off &= MPSOC_AXIREGS_OFF_MASK;
 	vsize = vma->vm_end - vma->vm_start;
 	psize = vsize;
-	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	if (win >= num_windows) {
+		printk(KERN_ERR "mpsoc_axiregs: no window at index %u\n", win);
+		return -EINVAL;
+	}
+	if (off >= windows[win].size || vsize > windows[win].size - off) {
+		printk(KERN_ERR "mpsoc_axiregs: mapping of 0x%lx bytes at offset 0x%lx does not fit in window %s\n",
+			vsize, off, windows[win].name);
+		return -EINVAL;
+	}
+	phys = windows[win].phys + off;
+
+	switch (type) {
+	case MPSOC_AXIREGS_MAP_NOCACHE:
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		break;
+	case MPSOC_AXIREGS_MAP_DEVICE:
+		vma->vm_page_prot = pgprot_device(vma->vm_page_prot);
+		break;
+	case MPSOC_AXIREGS_MAP_WC:
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+		break;
+	case MPSOC_AXIREGS_MAP_CACHED:
+		//Leave vm_page_prot alone; MAP_SHARED already gives us normal
+		//cacheable memory
+		break;
+	default:
+		printk(KERN_ERR "mpsoc_axiregs: unknown mapping type %u\n", type);
+		return -EINVAL;
+	}
 
 	vma->vm_flags |= VMEM_FLAGS;
 	rc = io_remap_pfn_range(vma, vma->vm_start, phys >> PAGE_SHIFT,
@@ -60,10 +289,266 @@ static int mpsoc_axireg_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 }
 
+static int mpsoc_axireg_poll_reg(void __iomem *addr, struct mpsoc_axiregs_op *op)
+{
+	ktime_t timeout = ktime_add_us(ktime_get(), op->timeout_us);
+	ktime_t spin_until = ktime_add_us(ktime_get(), MAX_POLL_SPIN_US);
+	unsigned long delay = op->sleep_us;
+	u32 val;
+
+	for (;;) {
+		val = readl(addr);
+		if ((val & op->mask) == op->val)
+			break;
+		if (ktime_compare(ktime_get(), timeout) > 0) {
+			//Check one last time, in case we slept through the change
+			val = readl(addr);
+			if ((val & op->mask) == op->val)
+				break;
+			op->result = val;
+			return -ETIMEDOUT;
+		}
+		if (signal_pending(current)) {
+			op->result = val;
+			return -EINTR;
+		}
+		if (!delay && ktime_compare(ktime_get(), spin_until) > 0)
+			delay = POLL_FALLBACK_SLEEP_US;
+		if (delay) {
+			usleep_range(delay, delay * 2);
+			delay = min(delay * 2, (unsigned long) MAX_POLL_SLEEP_US);
+		} else {
+			cpu_relax();
+			cond_resched();
+		}
+	}
+
+	op->result = val;
+	return 0;
+}
+
+static int mpsoc_axireg_wait_irq(struct mpsoc_axireg_priv *priv, struct mpsoc_axiregs_op *op)
+{
+	unsigned line = op->val;
+	long rc;
+
+	if (line >= num_irqs) {
+		printk(KERN_ERR "mpsoc_axiregs: bad irq line %u in register op\n", line);
+		return -EINVAL;
+	}
+	if (op->timeout_us == 0) {
+		printk(KERN_ERR "mpsoc_axiregs: wait op needs a timeout\n");
+		return -EINVAL;
+	}
+
+	rc = wait_event_interruptible_timeout(irq_wq, mpsoc_axireg_line_fired(priv, line),
+		usecs_to_jiffies(op->timeout_us));
+	if (rc < 0)
+		return rc;
+	if (rc == 0 && !mpsoc_axireg_line_fired(priv, line))
+		return -ETIMEDOUT;
+
+	op->result = READ_ONCE(irqs[line].count);
+	priv->last_seen[line] = op->result;
+	return 0;
+}
+
+//Returns a kernel address for the register at phys, mapping its page if
+//this batch hasn't already, or NULL if the ioremap failed
+static void __iomem *mpsoc_axireg_batch_map_reg(struct mpsoc_axireg_batch_map *map, unsigned long phys)
+{
+	unsigned long page = phys & PAGE_MASK;
+	unsigned i;
+
+	for (i = 0; i < BATCH_MAP_SLOTS; i++) {
+		if (map->slots[i].virt && map->slots[i].page == page)
+			return map->slots[i].virt + (phys - page);
+	}
+
+	i = map->next;
+	map->next = (map->next + 1) % BATCH_MAP_SLOTS;
+	if (map->slots[i].virt)
+		iounmap(map->slots[i].virt);
+	map->slots[i].page = page;
+	map->slots[i].virt = ioremap_nocache(page, PAGE_SIZE);
+	if (!map->slots[i].virt)
+		return NULL;
+	return map->slots[i].virt + (phys - page);
+}
+
+static void mpsoc_axireg_batch_unmap(struct mpsoc_axireg_batch_map *map)
+{
+	unsigned i;
+	for (i = 0; i < BATCH_MAP_SLOTS; i++) {
+		if (map->slots[i].virt)
+			iounmap(map->slots[i].virt);
+		map->slots[i].virt = NULL;
+	}
+}
+
+static int mpsoc_axireg_do_op(struct mpsoc_axireg_priv *priv, struct mpsoc_axireg_batch_map *map,
+	struct mpsoc_axiregs_op *op)
+{
+	void __iomem *addr;
+
+	if (op->cmd == MPSOC_AXIREGS_OP_WAIT_IRQ)
+		return mpsoc_axireg_wait_irq(priv, op);
+
+	if (op->win >= num_windows) {
+		printk(KERN_ERR "mpsoc_axiregs: bad window index %u in register op\n", op->win);
+		return -EINVAL;
+	}
+	if ((op->offset & 3) || op->offset >= windows[op->win].size) {
+		printk(KERN_ERR "mpsoc_axiregs: bad offset 0x%lx in register op\n", op->offset);
+		return -EINVAL;
+	}
+	addr = mpsoc_axireg_batch_map_reg(map, windows[op->win].phys + op->offset);
+	if (!addr) {
+		printk(KERN_ERR "mpsoc_axiregs: could not ioremap 0x%lx for register op\n",
+			windows[op->win].phys + op->offset);
+		return -ENOMEM;
+	}
+
+	switch (op->cmd) {
+	case MPSOC_AXIREGS_OP_READ:
+		op->result = readl(addr);
+		return 0;
+	case MPSOC_AXIREGS_OP_WRITE:
+		writel(op->val, addr);
+		return 0;
+	case MPSOC_AXIREGS_OP_POLL:
+		if (op->timeout_us == 0) {
+			printk(KERN_ERR "mpsoc_axiregs: poll op needs a timeout\n");
+			return -EINVAL;
+		}
+		return mpsoc_axireg_poll_reg(addr, op);
+	default:
+		printk(KERN_ERR "mpsoc_axiregs: unknown register op %u\n", op->cmd);
+		return -EINVAL;
+	}
+}
+
+static long mpsoc_axireg_do_batch(struct mpsoc_axireg_priv *priv, void __user *arg)
+{
+	struct mpsoc_axiregs_batch batch;
+	struct mpsoc_axiregs_op *ops;
+	struct mpsoc_axireg_batch_map map = {0};
+	unsigned i;
+	long rc = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+	if (batch.num_ops == 0 || batch.num_ops > MPSOC_AXIREGS_MAX_OPS)
+		return -EINVAL;
+
+	ops = kmalloc_array(batch.num_ops, sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+	if (copy_from_user(ops, (void __user *) batch.ops, batch.num_ops * sizeof(*ops))) {
+		rc = -EFAULT;
+		goto batch_done;
+	}
+
+	for (i = 0; i < batch.num_ops; i++) {
+		rc = mpsoc_axireg_do_op(priv, &map, &ops[i]);
+		if (rc)
+			break;
+	}
+	batch.num_done = i;
+	mpsoc_axireg_batch_unmap(&map);
+
+	if (copy_to_user((void __user *) batch.ops, ops, batch.num_ops * sizeof(*ops)) ||
+	    copy_to_user(arg, &batch, sizeof(batch)))
+		rc = -EFAULT;
+
+batch_done:
+	kfree(ops);
+	return rc;
+}
+
+static long mpsoc_axireg_irq_unmask(unsigned long mask)
+{
+	unsigned long flags;
+	int i;
+
+	if (mask >> num_irqs)
+		return -EINVAL;
+
+	spin_lock_irqsave(&irq_lock, flags);
+	for (i = 0; i < num_irqs; i++) {
+		if ((mask & (1UL << i)) && irqs[i].masked) {
+			irqs[i].masked = 0;
+			enable_irq(irqs[i].virq);
+		}
+	}
+	spin_unlock_irqrestore(&irq_lock, flags);
+	return 0;
+}
+
+static long mpsoc_axireg_irq_set_eventfd(struct file *filp, void __user *arg)
+{
+	struct mpsoc_axiregs_irq_eventfd req;
+	struct eventfd_ctx *efd = NULL;
+	struct eventfd_ctx *old;
+	unsigned long flags;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+	if (req.line >= num_irqs)
+		return -EINVAL;
+
+	if (req.fd >= 0) {
+		efd = eventfd_ctx_fdget(req.fd);
+		if (IS_ERR(efd))
+			return PTR_ERR(efd);
+	}
+
+	spin_lock_irqsave(&irq_lock, flags);
+	old = irqs[req.line].efd;
+	irqs[req.line].efd = efd;
+	irqs[req.line].efd_owner = efd ? filp : NULL;
+	spin_unlock_irqrestore(&irq_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+static long mpsoc_axireg_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct mpsoc_axireg_priv *priv = (struct mpsoc_axireg_priv *) filp->private_data;
+	struct mpsoc_axiregs_window info;
+
+	switch (cmd) {
+	case MPSOC_AXIREGS_GET_WINDOW:
+		if (copy_from_user(&info, (void __user *) arg, sizeof(info)))
+			return -EFAULT;
+		if (info.index >= num_windows)
+			return -EINVAL;
+		info.phys = windows[info.index].phys;
+		info.size = windows[info.index].size;
+		memcpy(info.name, windows[info.index].name, sizeof(info.name));
+		if (copy_to_user((void __user *) arg, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+	case MPSOC_AXIREGS_BATCH:
+		return mpsoc_axireg_do_batch(priv, (void __user *) arg);
+	case MPSOC_AXIREGS_IRQ_UNMASK:
+		return mpsoc_axireg_irq_unmask(arg);
+	case MPSOC_AXIREGS_IRQ_EVENTFD:
+		return mpsoc_axireg_irq_set_eventfd(filp, (void __user *) arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
 static struct file_operations mpsoc_axireg_fops = {
 	.owner = THIS_MODULE,
 	.open = mpsoc_axireg_open,
+	.read = mpsoc_axireg_read,
+	.poll = mpsoc_axireg_poll,
 	.mmap = mpsoc_axireg_mmap,
+	.unlocked_ioctl = mpsoc_axireg_ioctl,
 	.release = mpsoc_axireg_release,
 };
 
@@ -73,8 +558,145 @@ struct miscdevice mpsoc_axireg_cdevsw = {
 	&mpsoc_axireg_fops,
 };
 
+static int mpsoc_axireg_add_window(const char *name, unsigned long phys, unsigned long size)
+{
+	struct mpsoc_axireg_window *w;
+
+	if (num_windows >= MPSOC_AXIREGS_MAX_WINDOWS) {
+		printk(KERN_ERR "mpsoc_axiregs: too many windows, ignoring %s\n", name);
+		return -ENOSPC;
+	}
+	if (size == 0 || (phys & ~PAGE_MASK) || (size & ~PAGE_MASK)) {
+		printk(KERN_ERR "mpsoc_axiregs: window %s (0x%lx, 0x%lx) is not page-aligned, ignoring it\n",
+			name, phys, size);
+		return -EINVAL;
+	}
+
+	w = &windows[num_windows++];
+	strlcpy(w->name, name, sizeof(w->name));
+	w->phys = phys;
+	w->size = size;
+	printk(KERN_INFO "mpsoc_axiregs: window %d is %s at 0x%lx (0x%lx bytes)\n",
+		num_windows - 1, w->name, w->phys, w->size);
+	return 0;
+}
+
+static void mpsoc_axireg_add_dt_windows(void)
+{
+	struct device_node *np = NULL;
+
+	while ((np = of_find_compatible_node(np, NULL, MPSOC_AXIREGS_DT_COMPAT)) != NULL) {
+		struct resource res;
+		int i;
+		for (i = 0; of_address_to_resource(np, i, &res) == 0; i++) {
+			const char *name;
+			char tmp[16];
+			if (of_property_read_string_index(np, "reg-names", i, &name)) {
+				snprintf(tmp, sizeof(tmp), "%s.%d", np->name, i);
+				name = tmp;
+			}
+			mpsoc_axireg_add_window(name, res.start, resource_size(&res));
+		}
+	}
+}
+
+//Same trick as mpsoc_uio/interrupt_numbers.txt: build the fwspec the GIC
+//would have gotten from a device tree and ask it for a Linux irq number
+static int mpsoc_axireg_map_spi(unsigned spi)
+{
+	struct device_node *dn;
+	struct irq_domain *dom;
+	struct irq_fwspec fwspec = {
+		.param_count = 3,
+		.param = {0, spi, 4}
+	};
+
+	dn = of_find_node_by_name(NULL, "interrupt-controller");
+	if (!dn) {
+		printk(KERN_ERR "mpsoc_axiregs: could not find device node for \"interrupt-controller\"\n");
+		return -ENODEV;
+	}
+	dom = irq_find_host(dn);
+	of_node_put(dn);
+	if (!dom) {
+		printk(KERN_ERR "mpsoc_axiregs: could not find irq domain\n");
+		return -ENODEV;
+	}
+
+	fwspec.fwnode = dom->fwnode;
+	return irq_create_fwspec_mapping(&fwspec);
+}
+
+static void mpsoc_axireg_free_irqs(void)
+{
+	int i;
+	for (i = 0; i < num_irqs; i++) {
+		free_irq(irqs[i].virq, &irqs[i]);
+		irq_dispose_mapping(irqs[i].virq);
+		if (irqs[i].efd)
+			eventfd_ctx_put(irqs[i].efd);
+	}
+	num_irqs = 0;
+}
+
+static int mpsoc_axireg_bind_irqs(void)
+{
+	int i;
+	int rc;
+
+	for (i = 0; i < num_irq_spi; i++) {
+		struct mpsoc_axireg_irq *line = &irqs[num_irqs];
+		int virq = mpsoc_axireg_map_spi(irq_spi[i]);
+		if (virq <= 0) {
+			printk(KERN_ERR "mpsoc_axiregs: could not allocate irq for SPI %u\n", irq_spi[i]);
+			rc = virq ? virq : -ECANCELED;
+			goto bind_irqs_error;
+		}
+
+		line->spi = irq_spi[i];
+		line->virq = virq;
+		rc = request_irq(virq, mpsoc_axireg_irq_handler, 0, "mpsoc_axiregs", line);
+		if (rc) {
+			printk(KERN_ERR "mpsoc_axiregs: could not request irq for SPI %u\n", irq_spi[i]);
+			irq_dispose_mapping(virq);
+			goto bind_irqs_error;
+		}
+		num_irqs++;
+		printk(KERN_INFO "mpsoc_axiregs: irq line %d is SPI %u\n", i, line->spi);
+	}
+	return 0;
+
+bind_irqs_error:
+	mpsoc_axireg_free_irqs();
+	return rc;
+}
+
 static int __init mpsoc_axireg_module_init(void)
 {
+	int i;
+	int rc;
+
+	if (num_win_phys != num_win_size) {
+		printk(KERN_ERR "mpsoc_axiregs: win_phys and win_size must have the same number of entries\n");
+		return -EINVAL;
+	}
+
+	if (num_win_phys) {
+		for (i = 0; i < num_win_phys; i++) {
+			char name[16];
+			snprintf(name, sizeof(name), "win%d", i);
+			mpsoc_axireg_add_window(name, win_phys[i], win_size[i]);
+		}
+	} else {
+		for (i = 0; i < ARRAY_SIZE(default_windows); i++)
+			mpsoc_axireg_add_window(default_windows[i].name, default_windows[i].phys, default_windows[i].size);
+	}
+	mpsoc_axireg_add_dt_windows();
+
+	rc = mpsoc_axireg_bind_irqs();
+	if (rc)
+		return rc;
+
 	mpsoc_axireg_cdevsw.mode = 0666;
 	misc_register(&mpsoc_axireg_cdevsw);
 	printk(KERN_INFO "MPSOC axi register driver is loaded\n");
@@ -84,6 +706,7 @@ static int __init mpsoc_axireg_module_init(void)
 static void __exit mpsoc_axireg_module_exit(void)
 {
 	misc_deregister(&mpsoc_axireg_cdevsw);
+	mpsoc_axireg_free_irqs();
 	printk(KERN_INFO "MPSOC axi register driver is unloaded\n");
 }
 
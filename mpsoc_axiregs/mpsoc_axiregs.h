@@ -0,0 +1,119 @@
+#ifndef MPSOC_AXIREGS_H
+#define MPSOC_AXIREGS_H 1
+
+#include <linux/ioctl.h>
+
+//Max number of address windows the driver will manage
+#define MPSOC_AXIREGS_MAX_WINDOWS 8
+
+//The mmap offset selects the window, the offset inside it, and the type of
+//mapping:
+//
+//    bits [31:0]  byte offset into the window (must be page-aligned)
+//    bits [39:32] window index
+//    bits [43:40] mapping type (see below)
+//
+//Window 0 is HPM0_FPD (0xA0000000) unless you override the defaults, so old
+//code that just mmaps at an offset from 0xA0000000 keeps working.
+#define MPSOC_AXIREGS_WIN_SHIFT 32
+#define MPSOC_AXIREGS_WIN_MASK 0xFFUL
+#define MPSOC_AXIREGS_OFF_MASK 0xFFFFFFFFUL
+
+#define MPSOC_AXIREGS_MAP_SHIFT 40
+#define MPSOC_AXIREGS_MAP_MASK 0xFUL
+
+//Mapping types. NOCACHE is what the driver always did before, and is still
+//the default. Pick one of the others for bulk copies into PL memory:
+//  NOCACHE: Device-nGnRnE. Every access goes out on its own, in order
+//  DEVICE:  Device-nGnRE. Same, but writes can be acked early by the interconnect
+//  WC:      Normal non-cacheable. Lets the CPU merge stores and issue bursts,
+//           but gives no ordering between accesses. Only use it on memory
+//           (BRAM, FIFOs you drain in bulk), never on control registers
+//  CACHED:  Normal cacheable. Fastest, but you must clean/invalidate the
+//           cache yourself (e.g. with dc cvac / dc civac) around PL accesses
+#define MPSOC_AXIREGS_MAP_NOCACHE 0
+#define MPSOC_AXIREGS_MAP_DEVICE 1
+#define MPSOC_AXIREGS_MAP_WC 2
+#define MPSOC_AXIREGS_MAP_CACHED 3
+
+#define MPSOC_AXIREGS_MMAP_OFFSET(win, off) \
+    ((((unsigned long)(win)) << MPSOC_AXIREGS_WIN_SHIFT) | ((unsigned long)(off) & MPSOC_AXIREGS_OFF_MASK))
+
+#define MPSOC_AXIREGS_MMAP_OFFSET_TYPE(win, off, type) \
+    (MPSOC_AXIREGS_MMAP_OFFSET(win, off) | (((unsigned long)(type)) << MPSOC_AXIREGS_MAP_SHIFT))
+
+//Used with MPSOC_AXIREGS_GET_WINDOW to ask the driver what lives at a given
+//window index
+struct mpsoc_axiregs_window {
+    unsigned index;     //Filled in by the user
+    unsigned long phys; //Filled in by the driver
+    unsigned long size; //Filled in by the driver
+    char name[16];      //Filled in by the driver
+};
+
+//One register operation in a batch. All accesses are 32 bits wide
+#define MPSOC_AXIREGS_OP_READ 0  //result = reg
+#define MPSOC_AXIREGS_OP_WRITE 1 //reg = val
+#define MPSOC_AXIREGS_OP_POLL 2  //Wait until (reg & mask) == val. result = last value read
+#define MPSOC_AXIREGS_OP_WAIT_IRQ 3 //Sleep until IRQ line val fires (see below). result = event count.
+                                    //win, offset and mask are ignored
+
+struct mpsoc_axiregs_op {
+    unsigned cmd;
+    unsigned win;         //Window index
+    unsigned long offset; //Byte offset into the window. Must be 4-byte aligned
+    unsigned val;
+    unsigned mask;
+    unsigned sleep_us;    //POLL: initial delay between reads. Doubles every
+                          //time up to 1 ms. 0 means spin, but only for the
+                          //first 20 us; after that it sleeps as if this were 10
+    unsigned timeout_us;  //POLL: give up with -ETIMEDOUT after this long. Must
+                          //not be 0
+    unsigned result;      //Filled in by the driver
+};
+
+//Max number of ops in a single batch
+#define MPSOC_AXIREGS_MAX_OPS 256
+
+struct mpsoc_axiregs_batch {
+    unsigned num_ops;
+    unsigned num_done; //Filled in by the driver. If the ioctl fails, this is
+                       //the index of the op that failed
+    struct mpsoc_axiregs_op *ops;
+};
+
+//Max number of PL-to-PS interrupt lines the driver can bind (see the irq_spi
+//module parameter).
+//
+//When a line fires, the driver masks it, bumps its event count, wakes up
+//anyone in read()/poll() and signals the line's eventfd (if one is attached).
+//Since the driver doesn't know how to clear the interrupt in your IP, you have
+//to do that through your mmap, then unmask the line with MPSOC_AXIREGS_IRQ_UNMASK.
+//
+//read() blocks until at least one line has fired since the last read() on
+//this file, then returns one unsigned event count per bound line. poll()
+//reports POLLIN under the same condition.
+#define MPSOC_AXIREGS_MAX_IRQS 16
+
+struct mpsoc_axiregs_irq_eventfd {
+    unsigned line;
+    int fd; //eventfd to signal whenever this line fires, or -1 to detach
+};
+
+#define MPSOC_AXIREGS_IOC_MAGIC 'x'
+
+//Returns -EINVAL if index is past the last window
+#define MPSOC_AXIREGS_GET_WINDOW _IOWR(MPSOC_AXIREGS_IOC_MAGIC, 1, struct mpsoc_axiregs_window)
+
+//Runs the ops in order, in the kernel, and stops at the first one that fails.
+//The results are copied back into the user's ops array either way.
+#define MPSOC_AXIREGS_BATCH _IOWR(MPSOC_AXIREGS_IOC_MAGIC, 2, struct mpsoc_axiregs_batch)
+
+//Argument is a bitmask of the lines to unmask
+#define MPSOC_AXIREGS_IRQ_UNMASK _IOW(MPSOC_AXIREGS_IOC_MAGIC, 3, unsigned long)
+
+//Attach (or detach) an eventfd to an interrupt line. Only one eventfd per line;
+//it gets detached when the file that attached it is closed
+#define MPSOC_AXIREGS_IRQ_EVENTFD _IOW(MPSOC_AXIREGS_IOC_MAGIC, 4, struct mpsoc_axiregs_irq_eventfd)
+
+#endif
@@ -0,0 +1,377 @@
+/*
+
+Exposes the ZynqMP PS AXI performance monitors (APMs) through sysfs, so you
+can see how many bytes each DDR port (or the OCM/CCI/LPD interconnect) moved
+while your DMA was running.
+
+The PS has four APMs, all the same IP (see "AXI Performance Monitor" in
+UG1085 and PG037 for the register map):
+    ddr     0xFD0B0000  sits in front of the DDR controller's six AXI ports
+    cci     0xFD490000  between the CCI-400 and the rest of the FPD
+    ocm     0xFFA00000  in front of the OCM
+    lpd_fpd 0xFFA10000  on the LPD to FPD interconnect
+Each one has ten 32-bit metric counters. We use five per monitored port
+(read/write bytes, read/write transactions and total read latency), so each
+APM watches two ports. For the DDR monitor, pick which ports with the
+ddr_ports module parameter. Which masters share which DDR port is in the
+"DDR Memory Controller" chapter of UG1085; by default we watch ports 3 and 4,
+which carry S_AXI_HP0 to HP2 (along with the DisplayPort).
+
+Layout:
+    /sys/mpsoc_perfmon/<apm>/enable        1 = counting, 0 = stopped
+    /sys/mpsoc_perfmon/<apm>/sample        write anything to take a sample
+    /sys/mpsoc_perfmon/<apm>/interval_ns   length of the last sample
+    /sys/mpsoc_perfmon/<apm>/cycles        same thing, in APM clock cycles
+    /sys/mpsoc_perfmon/<apm>/portN/slot    which slot (port) this is watching
+    /sys/mpsoc_perfmon/<apm>/portN/{read_bytes,write_bytes,read_txns,
+                                     write_txns,read_latency}
+
+Taking a sample reads all the counters at once and then resets them, so every
+number you read back covers the interval between the last two samples. That
+way read_bytes / interval_ns is the port's bandwidth in GB/s, and
+read_latency / read_txns is the average read latency in APM clock cycles.
+
+The counters are 32 bits, so at a few GB/s they wrap in about a second.
+Sample more often than that if you care about the byte counts.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+#include <linux/kobject.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <asm/io.h>
+
+#define APM_SPAN 0x1000
+
+//APM registers
+#define APM_GCC_HI 0x0000
+#define APM_GCC_LO 0x0004
+#define APM_MSR(n) (0x0044 + 4*(n)) //Metric selectors, four counters each
+#define APM_MC(n) (0x0100 + 0x10*(n)) //Metric counters
+#define APM_CTRL 0x0300
+
+#define APM_CTRL_MC_EN 0x00000001U
+#define APM_CTRL_MC_RESET 0x00000002U
+#define APM_CTRL_GCC_EN 0x00010000U
+#define APM_CTRL_GCC_RESET 0x00020000U
+
+//Each metric selector byte is {slot[2:0], metric[4:0]}
+#define APM_MSR_SLOT_SHIFT 5
+#define APM_NUM_COUNTERS 10
+
+//Metric IDs
+#define APM_METRIC_WR_TXNS 0
+#define APM_METRIC_RD_TXNS 1
+#define APM_METRIC_WR_BYTES 2
+#define APM_METRIC_RD_BYTES 3
+#define APM_METRIC_RD_LATENCY 5
+
+struct apm_metric {
+    char const *name;
+    unsigned id;
+};
+
+static struct apm_metric const apm_metrics[] = {
+    {"read_bytes",   APM_METRIC_RD_BYTES},
+    {"write_bytes",  APM_METRIC_WR_BYTES},
+    {"read_txns",    APM_METRIC_RD_TXNS},
+    {"write_txns",   APM_METRIC_WR_TXNS},
+    {"read_latency", APM_METRIC_RD_LATENCY},
+};
+
+#define NUM_METRICS ARRAY_SIZE(apm_metrics)
+#define PORTS_PER_APM (APM_NUM_COUNTERS / NUM_METRICS)
+
+static int ddr_ports[PORTS_PER_APM] = {3, 4};
+static int num_ddr_ports;
+module_param_array(ddr_ports, int, &num_ddr_ports, 0444);
+MODULE_PARM_DESC(ddr_ports, "Which two DDR controller ports (0-5) to monitor (default 3,4)");
+
+struct apm;
+
+struct apm_counter_attr {
+    struct kobj_attribute attr;
+    struct apm *apm;
+    unsigned counter;
+};
+
+struct apm_port {
+    struct kobject *kobj;
+    int slot;
+    struct kobj_attribute attr_slot;
+    struct apm_counter_attr counters[NUM_METRICS];
+};
+
+struct apm {
+    char const *name;
+    unsigned long phys;
+    int num_slots;
+    int num_ports; //Single-slot monitors only get one port
+
+    void *virt;
+    struct kobject *kobj;
+    struct apm_port ports[PORTS_PER_APM];
+
+    //Latched by the last sample
+    u32 sample[APM_NUM_COUNTERS];
+    u64 cycles;
+    u64 interval_ns;
+    u64 last_sample_ns;
+
+    struct kobj_attribute attr_enable;
+    struct kobj_attribute attr_sample;
+    struct kobj_attribute attr_interval;
+    struct kobj_attribute attr_cycles;
+};
+
+static struct apm apms[] = {
+    {.name = "ddr",     .phys = 0xFD0B0000, .num_slots = 6},
+    {.name = "cci",     .phys = 0xFD490000, .num_slots = 1},
+    {.name = "ocm",     .phys = 0xFFA00000, .num_slots = 1},
+    {.name = "lpd_fpd", .phys = 0xFFA10000, .num_slots = 1},
+};
+
+#define NUM_APMS ARRAY_SIZE(apms)
+
+//Serialises sampling and enabling, so a sample never sees half-reset counters
+static DEFINE_MUTEX(apm_mutex);
+static struct kobject *perfmon_root;
+
+//Points the metric counters at the slots in apm->ports[]
+static void apm_program(struct apm *apm)
+{
+    u32 msr[(APM_NUM_COUNTERS + 3) / 4] = {0};
+    int i, j;
+
+    for (i = 0; i < apm->num_ports; i++) {
+        for (j = 0; j < NUM_METRICS; j++) {
+            unsigned n = i*NUM_METRICS + j;
+            u32 sel = (apm->ports[i].slot << APM_MSR_SLOT_SHIFT) | apm_metrics[j].id;
+            msr[n / 4] |= sel << (8 * (n % 4));
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(msr); i++) {
+        writel(msr[i], apm->virt + APM_MSR(i));
+    }
+}
+
+static void apm_reset(struct apm *apm)
+{
+    u32 ctrl = readl(apm->virt + APM_CTRL);
+    writel(ctrl | APM_CTRL_MC_RESET | APM_CTRL_GCC_RESET, apm->virt + APM_CTRL);
+    writel(ctrl, apm->virt + APM_CTRL);
+}
+
+static ssize_t enable_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct apm *apm = container_of(attr, struct apm, attr_enable);
+    return sprintf(buf, "%d\n", (readl(apm->virt + APM_CTRL) & APM_CTRL_MC_EN) ? 1 : 0);
+}
+
+static ssize_t enable_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    struct apm *apm = container_of(attr, struct apm, attr_enable);
+    int en;
+    u32 ctrl;
+
+    if (sscanf(buf, "%d", &en) != 1) {
+        printk(KERN_ERR "mpsoc_perfmon: enable must be 0 or 1\n");
+        return -EINVAL;
+    }
+
+    mutex_lock(&apm_mutex);
+    ctrl = readl(apm->virt + APM_CTRL);
+    if (en) {
+        //Start from zero so the first sample makes sense
+        writel(ctrl & ~(APM_CTRL_MC_EN | APM_CTRL_GCC_EN), apm->virt + APM_CTRL);
+        apm_program(apm);
+        apm_reset(apm);
+        writel(ctrl | APM_CTRL_MC_EN | APM_CTRL_GCC_EN, apm->virt + APM_CTRL);
+        apm->last_sample_ns = ktime_get_ns();
+    } else {
+        writel(ctrl & ~(APM_CTRL_MC_EN | APM_CTRL_GCC_EN), apm->virt + APM_CTRL);
+    }
+    mutex_unlock(&apm_mutex);
+
+    return count;
+}
+
+static ssize_t sample_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+    struct apm *apm = container_of(attr, struct apm, attr_sample);
+    u64 now;
+    int i;
+
+    mutex_lock(&apm_mutex);
+    //Reading all the counters only takes a handful of cycles, so they're
+    //close enough to simultaneous
+    for (i = 0; i < APM_NUM_COUNTERS; i++) {
+        apm->sample[i] = readl(apm->virt + APM_MC(i));
+    }
+    apm->cycles = ((u64) readl(apm->virt + APM_GCC_HI) << 32) | readl(apm->virt + APM_GCC_LO);
+    apm_reset(apm);
+
+    now = ktime_get_ns();
+    apm->interval_ns = now - apm->last_sample_ns;
+    apm->last_sample_ns = now;
+    mutex_unlock(&apm_mutex);
+
+    return count;
+}
+
+static ssize_t interval_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct apm *apm = container_of(attr, struct apm, attr_interval);
+    return sprintf(buf, "%llu\n", apm->interval_ns);
+}
+
+static ssize_t cycles_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct apm *apm = container_of(attr, struct apm, attr_cycles);
+    return sprintf(buf, "%llu\n", apm->cycles);
+}
+
+static ssize_t counter_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct apm_counter_attr *a = container_of(attr, struct apm_counter_attr, attr);
+    return sprintf(buf, "%u\n", a->apm->sample[a->counter]);
+}
+
+static ssize_t slot_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct apm_port *port = container_of(attr, struct apm_port, attr_slot);
+    return sprintf(buf, "%d\n", port->slot);
+}
+
+static void apm_unregister(struct apm *apm)
+{
+    int i;
+
+    for (i = 0; i < PORTS_PER_APM; i++) {
+        if (apm->ports[i].kobj) kobject_put(apm->ports[i].kobj);
+        apm->ports[i].kobj = NULL;
+    }
+    if (apm->kobj) kobject_put(apm->kobj);
+    apm->kobj = NULL;
+
+    if (apm->virt) {
+        //Leave the monitor the way we found it
+        writel(0, apm->virt + APM_CTRL);
+        iounmap(apm->virt);
+    }
+    apm->virt = NULL;
+}
+
+//Little helper to cut down on the boilerplate
+static int apm_add_attr(struct kobject *kobj, struct kobj_attribute *attr, char const *name, umode_t mode,
+    ssize_t (*show)(struct kobject *, struct kobj_attribute *, char *),
+    ssize_t (*store)(struct kobject *, struct kobj_attribute *, const char *, size_t))
+{
+    sysfs_attr_init(&attr->attr);
+    attr->attr.name = name;
+    attr->attr.mode = mode;
+    attr->show = show;
+    attr->store = store;
+    return sysfs_create_file(kobj, &attr->attr);
+}
+
+static int apm_register(struct apm *apm)
+{
+    int i, j;
+    int retval = 0;
+
+    apm->virt = ioremap_nocache(apm->phys, APM_SPAN);
+    apm->kobj = kobject_create_and_add(apm->name, perfmon_root);
+    if (!apm->virt || !apm->kobj) {
+        printk(KERN_ERR "mpsoc_perfmon: could not set up %s monitor\n", apm->name);
+        retval = -ENOMEM;
+        goto cleanup;
+    }
+
+    //Stopped until someone writes to enable
+    writel(0, apm->virt + APM_CTRL);
+
+    retval |= apm_add_attr(apm->kobj, &apm->attr_enable, "enable", 0664, enable_show, enable_store);
+    retval |= apm_add_attr(apm->kobj, &apm->attr_sample, "sample", 0220, NULL, sample_store);
+    retval |= apm_add_attr(apm->kobj, &apm->attr_interval, "interval_ns", 0444, interval_show, NULL);
+    retval |= apm_add_attr(apm->kobj, &apm->attr_cycles, "cycles", 0444, cycles_show, NULL);
+    if (retval) goto cleanup;
+
+    apm->num_ports = (apm->num_slots > 1) ? PORTS_PER_APM : 1;
+    for (i = 0; i < apm->num_ports; i++) {
+        struct apm_port *port = &apm->ports[i];
+        char name[8];
+
+        sprintf(name, "port%d", i);
+        port->kobj = kobject_create_and_add(name, apm->kobj);
+        if (!port->kobj) {
+            retval = -ENOMEM;
+            goto cleanup;
+        }
+
+        retval |= apm_add_attr(port->kobj, &port->attr_slot, "slot", 0444, slot_show, NULL);
+        for (j = 0; j < NUM_METRICS; j++) {
+            port->counters[j].apm = apm;
+            port->counters[j].counter = i*NUM_METRICS + j;
+            retval |= apm_add_attr(port->kobj, &port->counters[j].attr, apm_metrics[j].name, 0444, counter_show, NULL);
+        }
+        if (retval) goto cleanup;
+    }
+
+    apm_program(apm);
+    return 0;
+
+    cleanup:
+    printk(KERN_ERR "mpsoc_perfmon: could not register %s monitor\n", apm->name);
+    apm_unregister(apm);
+    return retval ? retval : -ENOMEM;
+}
+
+static int __init mpsoc_perfmon_init(void)
+{
+    int i;
+
+    //Only the DDR monitor has more than one slot
+    for (i = 0; i < PORTS_PER_APM; i++) {
+        if (ddr_ports[i] < 0 || ddr_ports[i] >= apms[0].num_slots) {
+            printk(KERN_ERR "mpsoc_perfmon: DDR port %d does not exist\n", ddr_ports[i]);
+            return -EINVAL;
+        }
+        apms[0].ports[i].slot = ddr_ports[i];
+    }
+
+    perfmon_root = kobject_create_and_add("mpsoc_perfmon", NULL);
+    if (!perfmon_root) return -ENOMEM;
+
+    for (i = 0; i < NUM_APMS; i++) {
+        int retval = apm_register(&apms[i]);
+        if (retval) {
+            while (--i >= 0) apm_unregister(&apms[i]);
+            kobject_put(perfmon_root);
+            return retval;
+        }
+    }
+
+    printk(KERN_INFO "mpsoc_perfmon: watching DDR ports %d and %d\n", ddr_ports[0], ddr_ports[1]);
+    return 0;
+}
+
+static void __exit mpsoc_perfmon_exit(void)
+{
+    int i;
+    for (i = 0; i < NUM_APMS; i++) apm_unregister(&apms[i]);
+    kobject_put(perfmon_root);
+}
+
+module_init(mpsoc_perfmon_init);
+module_exit(mpsoc_perfmon_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Sysfs interface to the MPSoC PS AXI performance monitors");
+MODULE_VERSION("0");
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap
+#include <unistd.h> //close
+#include "axitimer_ts.h"
+
+#define MAP_SIZE (0x1000)
+#define TCSR_ENT (1 << 7)
+#define TCSR_CASC (1 << 11)
+
+int axitimer_ts_open(struct axitimer_ts *ts, char const *uio_dev, unsigned long clk_hz) {
+    ts->fd = open(uio_dev, O_RDWR);
+    if (ts->fd == -1) {
+        perror("Could not open timer device");
+        return -1;
+    }
+
+    ts->regs = (volatile uint32_t *) mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ts->fd, 0);
+    if (ts->regs == MAP_FAILED) {
+        perror("Could not mmap timer registers");
+        close(ts->fd);
+        return -1;
+    }
+
+    if ((ts->regs[0] & (TCSR_ENT | TCSR_CASC)) != (TCSR_ENT | TCSR_CASC)) {
+        fprintf(stderr, "Timer is not free-running; load mpsoc_axitimer with free_running=1\n");
+        axitimer_ts_close(ts);
+        return -1;
+    }
+
+    ts->clk_hz = clk_hz;
+    return 0;
+}
+
+void axitimer_ts_close(struct axitimer_ts *ts) {
+    if (ts->regs != MAP_FAILED) munmap((void *) ts->regs, MAP_SIZE);
+    if (ts->fd != -1) close(ts->fd);
+    ts->regs = MAP_FAILED;
+    ts->fd = -1;
+}
+
+uint64_t axitimer_ts_to_ns(struct axitimer_ts const *ts, uint64_t cycles) {
+    //Split it up so cycles * 1e9 can't overflow
+    uint64_t secs = cycles / ts->clk_hz;
+    uint64_t rem = cycles % ts->clk_hz;
+    return secs * 1000000000ULL + rem * 1000000000ULL / ts->clk_hz;
+}
@@ -0,0 +1,49 @@
+#ifndef AXITIMER_TS_H
+#define AXITIMER_TS_H 1
+
+#include <stdint.h>
+
+//Syscall-free timestamps from an AXI timer running as a free-running 64-bit
+//counter (insmod mpsoc_axitimer.ko free_running=1). The counter runs off the
+//timer's AXI clock, so timestamps are in the same clock domain as your PL.
+//
+//Usage:
+//    struct axitimer_ts ts;
+//    if (axitimer_ts_open(&ts, "/dev/uio0", 100000000) < 0) ...
+//    uint64_t t0 = axitimer_ts_read(&ts);
+//    ...
+//    uint64_t t1 = axitimer_ts_read(&ts);
+//    printf("Took %llu ns\n", (unsigned long long) axitimer_ts_to_ns(&ts, t1 - t0));
+//    axitimer_ts_close(&ts);
+
+struct axitimer_ts {
+    int fd;
+    volatile uint32_t *regs;
+    unsigned long clk_hz;
+};
+
+//Opens and mmaps the timer's UIO device. clk_hz is the frequency of the clock
+//driving the timer. Returns 0 on success, or -1 (with a message printed) if
+//the file can't be opened or the timer isn't in free-running mode
+int axitimer_ts_open(struct axitimer_ts *ts, char const *uio_dev, unsigned long clk_hz);
+
+void axitimer_ts_close(struct axitimer_ts *ts);
+
+//Converts a number of timer cycles to nanoseconds
+uint64_t axitimer_ts_to_ns(struct axitimer_ts const *ts, uint64_t cycles);
+
+//Returns the current 64-bit count. The two halves live in different
+//registers, so read high, low, high: if the high word changed, the low word
+//wrapped in between and we read it again.
+static inline uint64_t axitimer_ts_read(struct axitimer_ts const *ts) {
+    uint32_t hi = ts->regs[6]; //TCR1
+    uint32_t lo = ts->regs[2]; //TCR0
+    uint32_t hi2 = ts->regs[6];
+    if (hi != hi2) {
+        lo = ts->regs[2];
+        hi = hi2;
+    }
+    return ((uint64_t) hi << 32) | lo;
+}
+
+#endif
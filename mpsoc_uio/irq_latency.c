@@ -0,0 +1,171 @@
+//Measures how long it takes from an AXI timer interrupt firing to a userspace
+//read() on the UIO file returning. The timer is set up to interrupt
+//periodically, and after each read() we look at how far the timer has counted
+//since it reloaded, which gives the wake-up latency in PL clock cycles with no
+//extra timestamping. We then write() to the UIO file, so the driver's own
+//histogram (/sys/devices/axitimer/irq_latency) gets a sample too, and print
+//both.
+//
+//    ./irq_latency /dev/uio0 [num_irqs] [period_cycles] [clk_hz]
+//
+//Don't load mpsoc_axitimer with free_running=1 for this.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap
+#include <unistd.h> //close
+
+#define MAP_SIZE (0x1000)
+#define HIST_PATH "/sys/devices/axitimer/irq_latency"
+
+//Register indices (in 32-bit words) and TCSR bits
+#define TCSR0 0
+#define TLR0 1
+#define TCR0 2
+#define TCSR_UDT (1 << 1)
+#define TCSR_ARHT (1 << 4)
+#define TCSR_LOAD (1 << 5)
+#define TCSR_ENIT (1 << 6)
+#define TCSR_ENT (1 << 7)
+#define TCSR_TINT (1 << 8)
+
+static int cmp_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static void print_percentiles(char const *what, uint64_t *samples, unsigned n) {
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    printf("%s: p50 %llu ns, p99 %llu ns, p999 %llu ns, max %llu ns\n", what,
+        (unsigned long long) samples[n / 2],
+        (unsigned long long) samples[(n * 99ULL) / 100],
+        (unsigned long long) samples[(n * 999ULL) / 1000],
+        (unsigned long long) samples[n - 1]
+    );
+}
+
+//Reads the driver's log2 histogram and prints the bucket each percentile
+//falls into
+static void print_driver_hist(void) {
+    unsigned long long bound[64];
+    unsigned long long count[64];
+    unsigned long long total = 0;
+    unsigned nbuckets = 0;
+    double pcts[] = {0.5, 0.99, 0.999};
+    char const *names[] = {"p50", "p99", "p999"};
+
+    FILE *fp = fopen(HIST_PATH, "r");
+    if (!fp) {
+        perror("Could not open " HIST_PATH);
+        return;
+    }
+    while (nbuckets < 64 && fscanf(fp, "%llu %llu", &bound[nbuckets], &count[nbuckets]) == 2) {
+        total += count[nbuckets];
+        nbuckets++;
+    }
+    fclose(fp);
+
+    if (total == 0) {
+        puts("Driver histogram is empty (did the write() calls fail?)");
+        return;
+    }
+
+    printf("Driver histogram (%llu samples):", total);
+    for (unsigned p = 0; p < 3; p++) {
+        unsigned long long seen = 0;
+        for (unsigned i = 0; i < nbuckets; i++) {
+            seen += count[i];
+            if (seen >= pcts[p] * total) {
+                printf(" %s < %llu ns%s", names[p], bound[i], (p < 2) ? "," : "\n");
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int ret = 0;
+    int fd = -1;
+    volatile uint32_t *base = MAP_FAILED;
+    uint64_t *samples = NULL;
+
+    if (argc < 2) {
+        puts("Usage: irq_latency /dev/uioN [num_irqs] [period_cycles] [clk_hz]");
+        return 0;
+    }
+    unsigned num_irqs = (argc > 2) ? strtoul(argv[2], NULL, 0) : 10000;
+    uint32_t period = (argc > 3) ? strtoul(argv[3], NULL, 0) : 100000; //1 ms at 100 MHz
+    unsigned long clk_hz = (argc > 4) ? strtoul(argv[4], NULL, 0) : 100000000;
+
+    samples = malloc(num_irqs * sizeof(uint64_t));
+    if (!samples || num_irqs == 0) {
+        puts("Could not allocate samples");
+        ret = -1;
+        goto cleanup;
+    }
+
+    fd = open(argv[1], O_RDWR);
+    if (fd == -1) {
+        perror("Could not open UIO device");
+        ret = -1;
+        goto cleanup;
+    }
+
+    base = (volatile uint32_t *) mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Could not mmap device memory");
+        ret = -1;
+        goto cleanup;
+    }
+
+    //Clear the driver's histogram
+    FILE *fp = fopen(HIST_PATH, "w");
+    if (fp) {
+        fputs("0\n", fp);
+        fclose(fp);
+    }
+
+    //Count down from period, reload and interrupt when it hits zero
+    base[TCSR0] = TCSR_TINT;
+    base[TLR0] = period;
+    base[TCSR0] = TCSR_LOAD;
+    base[TCSR0] = TCSR_UDT | TCSR_ARHT | TCSR_ENIT | TCSR_ENT;
+
+    unsigned missed = 0;
+    unsigned last_count = 0;
+    int32_t one = 1;
+    for (unsigned i = 0; i < num_irqs; i++) {
+        unsigned count;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            perror("Could not read from UIO device");
+            ret = -1;
+            break;
+        }
+        uint32_t elapsed = period - base[TCR0];
+        if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("Could not write to UIO device");
+        }
+
+        //If we slept through an interrupt, elapsed is ambiguous
+        if (i > 0 && count != last_count + 1) missed++;
+        last_count = count;
+
+        samples[i] = (uint64_t) elapsed * 1000000000ULL / clk_hz;
+    }
+
+    base[TCSR0] = TCSR_TINT;
+
+    if (ret == 0) {
+        print_percentiles("Timer-measured IRQ to read() return", samples, num_irqs);
+        if (missed) printf("Warning: missed %u interrupts; increase the period\n", missed);
+        print_driver_hist();
+    }
+
+    cleanup:
+    if (base != MAP_FAILED) munmap((void *) base, MAP_SIZE);
+    if (fd != -1) close(fd);
+    if (samples) free(samples);
+    return ret;
+}
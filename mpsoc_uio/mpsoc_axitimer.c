@@ -8,22 +8,45 @@
 #include <linux/irqdomain.h> //For irq_find_host
 #include <linux/of.h> //For device tree struct types
 #include <linux/irq.h> //For irq_desc struct and irq_to_desc
+#include "irq_latency_hist.h"
 
 #define T0INT_SHIFT (8)
 #define T0INT_MASK (1 << T0INT_SHIFT)
 #define AXITIMER_BASE (0xA0000000)
+//Both timers' registers, up to and including TCR1 at 0x18
+#define AXITIMER_SPAN (0x20)
+
+//Register indices (in 32-bit words) and TCSR bits, for free-running mode
+#define TCSR0 0
+#define TLR0 1
+#define TCSR1 4
+#define TLR1 5
+#define TCSR_ARHT (1 << 4)
+#define TCSR_LOAD (1 << 5)
+#define TCSR_ENT (1 << 7)
+#define TCSR_CASC (1 << 11)
+
+//If set, the two counters are cascaded into one 64-bit up-counter that runs
+//forever at the timer's clock, instead of being used for interrupts. Use
+//axitimer_ts.h to read it from userspace
+static bool free_running = 0;
+module_param(free_running, bool, 0444);
+MODULE_PARM_DESC(free_running, "Run the timer as a free-running 64-bit counter (no interrupts)");
 
 //Hang onto kernel virtual address for AXI timer regs
 static volatile uint32_t *virt;
 
+//Interrupt-to-userspace latency, see irq_latency_hist.h
+static struct irq_lat_hist lat_hist;
+
 static irqreturn_t axitimer_irq(int irq, struct uio_info *dev) {
     //Check if this interrupt was for us
     uint32_t status = *virt;
     
-    printk(KERN_INFO "axitimer_irq called\n");
-    
+    //No printks in here; they cost more than everything else combined and
+    //throw off the latency measurements
     if (status & T0INT_MASK) {
-        printk(KERN_INFO "axitimer interrupt handled\n");
+        irq_lat_hist_irq(&lat_hist);
         //This interrupt was for us. Clear the T0INT bit
         virt[0] |= T0INT_MASK;
         return IRQ_HANDLED; //Signal to kernel that interrupt was handled
@@ -32,24 +55,40 @@ static irqreturn_t axitimer_irq(int irq, struct uio_info *dev) {
     return IRQ_NONE; //Interrupt wasn't for us; tell Linux to try other handlers
 }
 
+//Called when userspace writes to the UIO file. The interrupt never gets
+//disabled (we clear it at the source) so there's nothing to re-enable; we
+//just use this to find out when userspace has woken up
+static int axitimer_irqcontrol(struct uio_info *info, s32 irq_on) {
+    irq_lat_hist_ack(&lat_hist);
+    return 0;
+}
+
+//Cascade mode, following the sequence in PG079: stop both counters, load
+//both with 0, then turn on CASC and the enable bit in TCSR0 only. Counting up
+//with auto-reload means it wraps back to 0 after 2^64 cycles (i.e. never)
+static void axitimer_start_free_running(void) {
+    virt[TCSR0] = 0;
+    virt[TCSR1] = 0;
+    virt[TLR0] = 0;
+    virt[TLR1] = 0;
+    virt[TCSR0] = TCSR_LOAD;
+    virt[TCSR1] = TCSR_LOAD;
+    virt[TCSR1] = 0;
+    virt[TCSR0] = TCSR_CASC | TCSR_ARHT | TCSR_ENT;
+}
+
 static struct uio_info axi_timer = {
     .name = "mpsoc_axitimer",
     .version = "1.0",
     //.irq = 89, //See "smarter" irq number finding code in init function
     .irq_flags = IRQF_SHARED,
     .handler = axitimer_irq,
+    .irqcontrol = axitimer_irqcontrol,
     .mem = {
-        {.name = "axi_timer_regs", .memtype = UIO_MEM_PHYS, .addr = AXITIMER_BASE, .size = 16}
+        {.name = "axi_timer_regs", .memtype = UIO_MEM_PHYS, .addr = AXITIMER_BASE, .size = AXITIMER_SPAN}
     }
 };
 
-static struct uio_mem axi_timer_regs = {
-    .name = "axi_timer_regs",
-    .memtype = UIO_MEM_PHYS,
-    .addr = AXITIMER_BASE,
-    .size = 0x1000
-};
-
 static void dummy_release(struct device *dev) {
     printk(KERN_INFO "There, it's released, OK???\n");
     return;
@@ -62,6 +101,19 @@ static struct device axitimer_dev = {
     .release = dummy_release
 };
 
+//Reading /sys/devices/axitimer/irq_latency gives the histogram; writing
+//anything to it clears it
+static ssize_t irq_latency_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    return irq_lat_hist_show(&lat_hist, buf);
+}
+
+static ssize_t irq_latency_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    irq_lat_hist_reset(&lat_hist);
+    return count;
+}
+
+static DEVICE_ATTR(irq_latency, 0664, irq_latency_show, irq_latency_store);
+
 static int __init our_init(void) {     
     int rc = 0;
     struct device_node *dn;
@@ -73,14 +125,18 @@ static int __init our_init(void) {
     };
     
     //Perform IO remapping
-    virt = ioremap_nocache(AXITIMER_BASE, 4);
+    virt = ioremap_nocache(AXITIMER_BASE, AXITIMER_SPAN);
     if (virt == NULL) {
         printk(KERN_ERR "Could not remap device memory\n");
         rc = -ENOMEM;
         goto axitimer_err_remap;
     }
     
-    *virt = 0; //Disable the timer
+    if (free_running) {
+        axitimer_start_free_running();
+    } else {
+        *virt = 0; //Disable the timer
+    }
     
     //Create the struct device for the axi timer
     rc = device_register(&axitimer_dev);
@@ -89,6 +145,13 @@ static int __init our_init(void) {
         goto axitimer_err_device_register;
     }    
     
+    rc = device_create_file(&axitimer_dev, &dev_attr_irq_latency);
+    if (rc < 0) {
+        printk(KERN_ERR "Could not create irq_latency sysfs file\n");
+        device_unregister(&axitimer_dev);
+        goto axitimer_err_device_register;
+    }
+    
     //Find the Linux irq number
     dn = of_find_node_by_name(NULL, "interrupt-controller");
     if (!dn) {
@@ -117,7 +180,6 @@ static int __init our_init(void) {
     
     //Finish setting up uio_info struct
     axi_timer.irq = virq;
-    axi_timer.mem[0] = axi_timer_regs;
     //Register with UIO
     rc = uio_register_device(&axitimer_dev, &axi_timer);
     if (rc < 0) {
@@ -141,9 +203,11 @@ static void our_exit(void) {
     uio_unregister_device(&axi_timer);
     
     //Unregister device
+    device_remove_file(&axitimer_dev, &dev_attr_irq_latency);
     device_unregister(&axitimer_dev);
     
-    //Unmap IO memory
+    //Unmap IO memory (stopping the counter first if we started it)
+    if (free_running) virt[TCSR0] = 0;
     iounmap(virt);
     
 	printk(KERN_INFO "AXI timer driver removed!\n"); 
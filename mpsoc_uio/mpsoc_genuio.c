@@ -0,0 +1,353 @@
+//Generic UIO driver for simple PL peripherals. Instead of copying
+//mpsoc_axitimer.c for every new IP, describe the IP and this driver does the
+//rest: it exposes the register space as a UIO map and acknowledges interrupts
+//in the hard IRQ handler, using a recipe of (status register offset, mask,
+//write-1-to-clear) pairs.
+//
+//There are three ways to make an instance:
+//
+//  1. Device tree (or an overlay):
+//        my_ip@a0000000 {
+//            compatible = "uoft,mpsoc-genuio";
+//            reg = <0x0 0xa0000000 0x0 0x10000>;
+//            interrupt-parent = <&gic>;
+//            interrupts = <0 89 4>;
+//            uoft,ack-offset = <0x0>;      //One entry per status register
+//            uoft,ack-mask = <0x100>;
+//            uoft,ack-w1c;                 //Optional, applies to all of them
+//        };
+//
+//  2. Module parameters, for one instance without touching the device tree:
+//        insmod mpsoc_genuio.ko phys=0xA0000000 size=0x10000 irq_spi=89 \
+//            ack_offset=0x0 ack_mask=0x100 ack_w1c=1
+//
+//  3. From another kernel module, by registering a platform device named
+//     MPSOC_GENUIO_NAME with a struct mpsoc_genuio_pdata (see mpsoc_genuio.h)
+//
+//If you don't give an ack recipe, the handler masks the interrupt line
+//instead, and userspace unmasks it by writing 1 to the UIO file after
+//clearing the interrupt itself.
+
+#include <linux/kernel.h> //print functions
+#include <linux/init.h> //for __init, see code
+#include <linux/module.h> //for module init and exit macros
+#include <linux/interrupt.h> //IRQF_SHARED
+#include <linux/uio_driver.h> //UIO stuff
+#include <linux/platform_device.h> //For platform drivers
+#include <linux/slab.h> //devm_kzalloc
+#include <linux/spinlock.h>
+#include <asm/io.h> //For ioremap
+#include <linux/irqdomain.h> //For irq_find_host
+#include <linux/of.h> //For device tree struct types
+#include <linux/irq.h> //For irq_desc struct and irq_to_desc
+#include "mpsoc_genuio.h"
+
+//Module parameters for making a single instance without a device tree node
+static unsigned long phys = 0;
+module_param(phys, ulong, 0444);
+MODULE_PARM_DESC(phys, "Base address of the register space (0 = don't make an instance from module params)");
+
+static unsigned long size = 0x1000;
+module_param(size, ulong, 0444);
+MODULE_PARM_DESC(size, "Size of the register space in bytes (default 0x1000)");
+
+static int irq_spi = -1;
+module_param(irq_spi, int, 0444);
+MODULE_PARM_DESC(irq_spi, "GIC SPI number of the interrupt (e.g. 89 for pl_ps_irq0[0]), or -1 for none");
+
+static unsigned ack_offset[MPSOC_GENUIO_MAX_ACKS];
+static int num_ack_offsets;
+module_param_array(ack_offset, uint, &num_ack_offsets, 0444);
+MODULE_PARM_DESC(ack_offset, "Offsets of the interrupt status registers");
+
+static unsigned ack_mask[MPSOC_GENUIO_MAX_ACKS];
+static int num_ack_masks;
+module_param_array(ack_mask, uint, &num_ack_masks, 0444);
+MODULE_PARM_DESC(ack_mask, "Interrupt bits in each status register");
+
+static bool ack_w1c = 1;
+module_param(ack_w1c, bool, 0444);
+MODULE_PARM_DESC(ack_w1c, "Status bits are write-1-to-clear (default 1)");
+
+struct mpsoc_genuio {
+    struct uio_info info;
+    void __iomem *virt;
+    struct mpsoc_genuio_pdata pdata;
+
+    //Only used when there's no ack recipe
+    spinlock_t lock;
+    int irq_masked;
+};
+
+static irqreturn_t mpsoc_genuio_irq(int irq, struct uio_info *info) {
+    struct mpsoc_genuio *g = info->priv;
+    irqreturn_t ret = IRQ_NONE;
+    unsigned i;
+
+    if (g->pdata.num_acks == 0) {
+        //Can't tell if it was ours, and can't clear it. Mask the line and let
+        //userspace sort it out
+        spin_lock(&g->lock);
+        if (!g->irq_masked) {
+            disable_irq_nosync(irq);
+            g->irq_masked = 1;
+        }
+        spin_unlock(&g->lock);
+        return IRQ_HANDLED;
+    }
+
+    for (i = 0; i < g->pdata.num_acks; i++) {
+        struct mpsoc_genuio_ack *a = &g->pdata.acks[i];
+        u32 status = readl(g->virt + a->offset);
+
+        if (status & a->mask) {
+            if (a->w1c) {
+                writel(status & a->mask, g->virt + a->offset);
+            } else {
+                writel(status & ~a->mask, g->virt + a->offset);
+            }
+            ret = IRQ_HANDLED;
+        }
+    }
+
+    return ret;
+}
+
+//Userspace writes to the UIO file to re-enable the interrupt. Only matters if
+//the handler had to mask it
+static int mpsoc_genuio_irqcontrol(struct uio_info *info, s32 irq_on) {
+    struct mpsoc_genuio *g = info->priv;
+    unsigned long flags;
+
+    if (g->pdata.num_acks) return 0;
+
+    spin_lock_irqsave(&g->lock, flags);
+    if (irq_on && g->irq_masked) {
+        enable_irq(info->irq);
+        g->irq_masked = 0;
+    } else if (!irq_on && !g->irq_masked) {
+        disable_irq_nosync(info->irq);
+        g->irq_masked = 1;
+    }
+    spin_unlock_irqrestore(&g->lock, flags);
+
+    return 0;
+}
+
+//Fills in the ack recipe in g->pdata from the device tree node. Returns 0 on
+//success (including when there's no recipe), negative on a malformed one
+static int mpsoc_genuio_parse_dt(struct device *dev, struct mpsoc_genuio *g) {
+    struct device_node *np = dev->of_node;
+    int n = of_property_count_u32_elems(np, "uoft,ack-offset");
+    int w1c = of_property_read_bool(np, "uoft,ack-w1c");
+    int i;
+
+    if (n <= 0) return 0;
+
+    if (n > MPSOC_GENUIO_MAX_ACKS || of_property_count_u32_elems(np, "uoft,ack-mask") != n) {
+        dev_err(dev, "uoft,ack-offset and uoft,ack-mask must have the same length (at most %d)\n", MPSOC_GENUIO_MAX_ACKS);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < n; i++) {
+        of_property_read_u32_index(np, "uoft,ack-offset", i, &g->pdata.acks[i].offset);
+        of_property_read_u32_index(np, "uoft,ack-mask", i, &g->pdata.acks[i].mask);
+        g->pdata.acks[i].w1c = w1c;
+    }
+    g->pdata.num_acks = n;
+
+    return 0;
+}
+
+static int mpsoc_genuio_probe(struct platform_device *pdev) {
+    struct device *dev = &pdev->dev;
+    struct mpsoc_genuio_pdata *pdata = dev_get_platdata(dev);
+    struct mpsoc_genuio *g;
+    struct resource *res;
+    int irq;
+    unsigned i;
+    int rc;
+
+    g = devm_kzalloc(dev, sizeof(*g), GFP_KERNEL);
+    if (!g) return -ENOMEM;
+    spin_lock_init(&g->lock);
+
+    res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+    if (!res) {
+        dev_err(dev, "No register space given\n");
+        return -EINVAL;
+    }
+    //Not devm_ioremap_resource: we don't want to claim the region, since
+    //the same registers can be shared by several instances (e.g. one per
+    //AXI DMA channel interrupt)
+    g->virt = devm_ioremap(dev, res->start, resource_size(res));
+    if (!g->virt) return -ENOMEM;
+
+    if (pdata) {
+        g->pdata = *pdata;
+    } else if (dev->of_node) {
+        rc = mpsoc_genuio_parse_dt(dev, g);
+        if (rc) return rc;
+    }
+
+    for (i = 0; i < g->pdata.num_acks; i++) {
+        if (g->pdata.acks[i].offset + 4 > resource_size(res)) {
+            dev_err(dev, "Ack offset 0x%x is outside the register space\n", g->pdata.acks[i].offset);
+            return -EINVAL;
+        }
+    }
+
+    //No interrupt is fine; userspace can still use the registers
+    irq = platform_get_irq(pdev, 0);
+    if (irq == -EPROBE_DEFER) return irq;
+
+    if (dev->of_node) {
+        g->info.name = dev->of_node->name;
+    } else if (g->pdata.name[0]) {
+        g->info.name = g->pdata.name;
+    } else {
+        g->info.name = MPSOC_GENUIO_NAME;
+    }
+    g->info.version = "1.0";
+    g->info.irq = (irq > 0) ? irq : UIO_IRQ_NONE;
+    //Masking the line only works if nobody else is on it
+    g->info.irq_flags = g->pdata.num_acks ? IRQF_SHARED : 0;
+    g->info.handler = mpsoc_genuio_irq;
+    g->info.irqcontrol = mpsoc_genuio_irqcontrol;
+    g->info.priv = g;
+    g->info.mem[0].name = "regs";
+    g->info.mem[0].memtype = UIO_MEM_PHYS;
+    g->info.mem[0].addr = res->start;
+    g->info.mem[0].size = resource_size(res);
+
+    rc = uio_register_device(dev, &g->info);
+    if (rc < 0) {
+        dev_err(dev, "Could not register with UIO\n");
+        return rc;
+    }
+
+    platform_set_drvdata(pdev, g);
+    dev_info(dev, "0x%llx (%u ack registers, irq %d)\n", (unsigned long long) res->start, g->pdata.num_acks, irq);
+    return 0;
+}
+
+static int mpsoc_genuio_remove(struct platform_device *pdev) {
+    struct mpsoc_genuio *g = platform_get_drvdata(pdev);
+    uio_unregister_device(&g->info);
+    return 0;
+}
+
+static const struct of_device_id mpsoc_genuio_of_match[] = {
+    {.compatible = "uoft,mpsoc-genuio"},
+    {}
+};
+MODULE_DEVICE_TABLE(of, mpsoc_genuio_of_match);
+
+static struct platform_driver mpsoc_genuio_driver = {
+    .probe = mpsoc_genuio_probe,
+    .remove = mpsoc_genuio_remove,
+    .driver = {
+        .name = MPSOC_GENUIO_NAME,
+        .of_match_table = mpsoc_genuio_of_match,
+    },
+};
+
+//The instance made from module parameters, if any
+static struct platform_device *param_pdev = NULL;
+static int param_virq = 0; //Its Linux irq number, which we have to give back
+
+//Same trick as in interrupt_numbers.txt
+static int mpsoc_genuio_map_spi(int spi) {
+    struct device_node *dn;
+    struct irq_domain *dom;
+    struct irq_fwspec fwspec = {
+        .param_count = 3,
+        .param = {0, spi, 4}
+    };
+
+    dn = of_find_node_by_name(NULL, "interrupt-controller");
+    if (!dn) {
+        printk(KERN_ERR "mpsoc_genuio: could not find device node for \"interrupt-controller\"\n");
+        return -ENODEV;
+    }
+    dom = irq_find_host(dn);
+    of_node_put(dn);
+    if (!dom) {
+        printk(KERN_ERR "mpsoc_genuio: could not find irq domain\n");
+        return -ENODEV;
+    }
+
+    fwspec.fwnode = dom->fwnode;
+    return irq_create_fwspec_mapping(&fwspec);
+}
+
+static int mpsoc_genuio_make_param_instance(void) {
+    struct resource res[2] = {
+        DEFINE_RES_MEM(phys, size)
+    };
+    int num_res = 1;
+    struct mpsoc_genuio_pdata pdata = {0};
+    int i;
+
+    if (num_ack_offsets != num_ack_masks) {
+        printk(KERN_ERR "mpsoc_genuio: ack_offset and ack_mask must have the same length\n");
+        return -EINVAL;
+    }
+    for (i = 0; i < num_ack_offsets; i++) {
+        pdata.acks[i].offset = ack_offset[i];
+        pdata.acks[i].mask = ack_mask[i];
+        pdata.acks[i].w1c = ack_w1c;
+    }
+    pdata.num_acks = num_ack_offsets;
+
+    if (irq_spi >= 0) {
+        int virq = mpsoc_genuio_map_spi(irq_spi);
+        if (virq <= 0) {
+            printk(KERN_ERR "mpsoc_genuio: could not map SPI %d\n", irq_spi);
+            return virq ? virq : -ECANCELED;
+        }
+        res[1] = (struct resource) DEFINE_RES_IRQ(virq);
+        num_res = 2;
+        param_virq = virq;
+    }
+
+    param_pdev = platform_device_register_resndata(NULL, MPSOC_GENUIO_NAME, PLATFORM_DEVID_AUTO,
+        res, num_res, &pdata, sizeof(pdata));
+    if (IS_ERR(param_pdev)) {
+        int rc = PTR_ERR(param_pdev);
+        param_pdev = NULL;
+        if (param_virq) irq_dispose_mapping(param_virq);
+        param_virq = 0;
+        return rc;
+    }
+
+    return 0;
+}
+
+static int __init mpsoc_genuio_init(void) {
+    int rc = platform_driver_register(&mpsoc_genuio_driver);
+    if (rc) return rc;
+
+    if (phys) {
+        rc = mpsoc_genuio_make_param_instance();
+        if (rc) {
+            printk(KERN_ERR "mpsoc_genuio: could not make instance from module parameters\n");
+            platform_driver_unregister(&mpsoc_genuio_driver);
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+static void __exit mpsoc_genuio_exit(void) {
+    if (param_pdev) platform_device_unregister(param_pdev);
+    //Only once the device (and so its request_irq) is gone
+    if (param_virq) irq_dispose_mapping(param_virq);
+    platform_driver_unregister(&mpsoc_genuio_driver);
+}
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+module_init(mpsoc_genuio_init);
+module_exit(mpsoc_genuio_exit);
@@ -0,0 +1,105 @@
+//Compares the cost of handing a CPU-written buffer over to a device for
+//regular pinnings (which need a PINNER_FLUSH every time) and coherent ones
+//(PINNER_PIN_COHERENT, where the flush is a no-op). Each iteration writes the
+//whole buffer and then flushes it, which is what a producer feeding a DMA
+//engine does. Prints CSV.
+//
+//Only meaningful if the coherent path is really coherent on your board: see
+///sys/mpsoc/coherency/hpc_snoop in mpsoc_PSRegs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pinner.h"
+
+#define MIN_SIZE (4 << 10)
+#define MAX_SIZE (PINNER_MAX_PAGES << 12)
+#define BYTES_PER_MEASUREMENT (256 << 20)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Returns MB/s, or a negative number on error
+static double run(int fd, unsigned pin_cmd, char *buf, unsigned sz) {
+    struct pinner_handle handle;
+    static struct pinner_physlist plist; //Too big for the stack
+
+    struct pinner_cmd pin = {
+        .cmd = pin_cmd,
+        .usr_buf = buf,
+        .usr_buf_sz = sz,
+        .handle = &handle,
+        .physlist = &plist
+    };
+    if (write(fd, &pin, sizeof(pin)) < 0) {
+        perror("Could not pin buffer");
+        return -1;
+    }
+
+    struct pinner_cmd flush = {
+        .cmd = PINNER_FLUSH,
+        .usr_buf_sz = 0, //Sync in both directions, like flush_buf_cache does
+        .handle = &handle
+    };
+
+    unsigned reps = BYTES_PER_MEASUREMENT / sz;
+    double start = now();
+    for (unsigned i = 0; i < reps; i++) {
+        memset(buf, i, sz);
+        if (write(fd, &flush, sizeof(flush)) < 0) {
+            perror("Could not flush buffer");
+            break;
+        }
+    }
+    double mbps = (double) sz * reps / (now() - start) / 1e6;
+
+    struct pinner_cmd unpin = {
+        .cmd = PINNER_UNPIN,
+        .handle = &handle
+    };
+    if (write(fd, &unpin, sizeof(unpin)) < 0) {
+        perror("Could not unpin buffer");
+    }
+
+    return mbps;
+}
+
+int main() {
+    int ret = 0;
+    char *buf = NULL;
+
+    int fd = open("/dev/pinner", O_RDWR);
+    if (fd == -1) {
+        perror("Could not open /dev/pinner");
+        return -1;
+    }
+
+    if (posix_memalign((void **) &buf, 4096, MAX_SIZE)) {
+        perror("Could not allocate buffer");
+        ret = -1;
+        goto cleanup;
+    }
+
+    puts("size,noncoherent_MBps,coherent_MBps");
+    for (unsigned sz = MIN_SIZE; sz <= MAX_SIZE; sz <<= 1) {
+        double nc = run(fd, PINNER_PIN, buf, sz);
+        double c = run(fd, PINNER_PIN_COHERENT, buf, sz);
+        if (nc < 0 || c < 0) {
+            ret = -1;
+            break;
+        }
+        printf("%u,%.1f,%.1f\n", sz, nc, c);
+        fflush(stdout);
+    }
+
+    cleanup:
+    if (buf) free(buf);
+    close(fd);
+    return ret;
+}
@@ -8,6 +8,8 @@
 #include <linux/mm.h> //For find_vma
 #include <linux/random.h> //For get_random_bytes
 #include <linux/list.h> //For linked lists
+#include <linux/hashtable.h> //For the per-file pinning table
+#include <linux/rwsem.h> //For rw_semaphore
 #include <linux/slab.h> //For kzalloc, kfree
 #include <linux/stddef.h> //For offsetof
 #include <linux/scatterlist.h> //For scatterlist struct
@@ -45,10 +47,13 @@ static void pinner_put_sglist_pages(struct scatterlist *sglist, int num_entries)
     }
 }
 
+//The pinning must not be in a proc_info's table anymore (or never have been
+//added to one)
 static void pinner_free_pinning(struct pinning *p) {
     //Unmap the scatterlist
     //TODO: allow user to set direction
-    dma_unmap_sg(pinner_miscdev.this_device, p->sglist, p->num_sg_ents, DMA_BIDIRECTIONAL);
+    dma_unmap_sg_attrs(pinner_miscdev.this_device, p->sglist, p->num_sg_ents, DMA_BIDIRECTIONAL,
+        p->coherent ? DMA_ATTR_SKIP_CPU_SYNC : 0);
     
     //Put pages
     pinner_put_sglist_pages(p->sglist, p->num_sg_ents);
@@ -56,23 +61,67 @@ static void pinner_free_pinning(struct pinning *p) {
     //Free scatterlist
     kfree(p->sglist);
     
-    //Remove pinning from list
-    list_del(&(p->list));
-    
     //Free pinning struct
     kfree(p);
 }
 
 static void pinner_free_pinnings(struct proc_info *info) {
     //printk(KERN_ALERT "Entered pinner_free_pinnings\n");
-    //Iterate through the list of pinnings inside this proc_info struct
-    //and free them all
-    while (!list_empty(&(info->pinning_list))) {
-        struct pinning *p = list_entry(info->pinning_list.next, struct pinning, list);
+    struct pinning *p;
+    struct hlist_node *tmp;
+    int bkt;
+    
+    //Iterate through the pinnings inside this proc_info struct and free them 
+    //all. Only called when the file is closed, so nobody else can be using it
+    hash_for_each_safe(info->pinnings, bkt, tmp, p, node) {
+        hash_del(&(p->node));
         pinner_free_pinning(p);
     }
 }
 
+//Finds the pinning with the given magic. Call with info->pin_lock held
+static struct pinning *pinner_find_pinning(struct proc_info *info, unsigned magic) {
+    struct pinning *p;
+    hash_for_each_possible(info->pinnings, p, node, magic) {
+        if (p->magic == magic) return p;
+    }
+    return NULL;
+}
+
+//Gives p a magic number that no other pinning in info is using, and adds it
+//to the table. Handles are only useful if they pick out exactly one pinning
+static void pinner_add_pinning(struct proc_info *info, struct pinning *p) {
+    down_write(&(info->pin_lock));
+    do {
+        get_random_bytes(&(p->magic), sizeof(p->magic));
+    } while (pinner_find_pinning(info, p->magic));
+    hash_add(info->pinnings, &(p->node), p->magic);
+    up_write(&(info->pin_lock));
+}
+
+//Gets a handle from userspace and makes sure it belongs to this file. 
+//Returns 0 on success
+static int pinner_get_handle(struct pinner_cmd *cmd, struct proc_info *info, struct pinner_handle *usr_handle) {
+    int n;
+    
+    //Copy handle from userspace
+    n = copy_from_user(usr_handle, cmd->handle, sizeof(struct pinner_handle));
+    if (n != 0) {
+        printk(KERN_ALERT "pinner: could not copy handle from userspace\n");
+        return -EAGAIN;
+    }
+    
+    //Ensure that the user's handle matches the correct user_magic. We want to
+    //make it very difficult for buggy (or malicious) user code to accidentally
+    //unpin someone else's pinnings
+    if (usr_handle->user_magic != info->magic) {
+        printk(KERN_ALERT "pinner: incorrect user handle\n");
+        return -EINVAL;
+    }
+    
+    return 0;
+}
+
 static void pinner_free_proc_info(struct proc_info *info) {
     //printk(KERN_ALERT "Entered pinner_free_proc_info\n");
     //Free all the pinnings stored in this proc_info struct
@@ -179,7 +228,7 @@ static int pinner_alloc_and_fill_sglist(struct page **page_arr, int num_pages,
     return 0;
 }
 
-static int pinner_do_pin(struct pinner_cmd *cmd, struct proc_info *info) {
+static int pinner_do_pin(struct pinner_cmd *cmd, struct proc_info *info, int coherent) {
     int ret = 0;
     
     struct pinning *pin = NULL;
@@ -233,20 +282,22 @@ static int pinner_do_pin(struct pinner_cmd *cmd, struct proc_info *info) {
         goto do_pin_error;
     }
     pin->num_sg_ents = num_pages;
+    pin->coherent = coherent;
     ret = pinner_alloc_and_fill_sglist(p, num_pages, pin, first_pg_offset, cmd->usr_buf_sz);
     if (ret < 0) {
         goto do_pin_error;
     }
     //Note to self: look out for double-frees, since now these pages are managed by the pinning struct
     p = NULL; //For extra safety against double-freeing
-    get_random_bytes(&(pin->magic), sizeof(pin->magic));
-    list_add(&(pin->list), &(info->pinning_list)); //CAREFUL: list_add adds the first argument to the second
     
     //Perform the DMA mapping (whatever that means)
     //Well, I know it eventually defers to some architecture-specific assmebly
     //code, so I'm guess it turns off the cache (which is what I want)
     //TODO: allow user to set direction
-    ret = dma_map_sg(pinner_miscdev.this_device, pin->sglist, pin->num_sg_ents, DMA_BIDIRECTIONAL);
+    //For coherent pinnings, skip the cache maintenance that normally comes
+    //with mapping
+    ret = dma_map_sg_attrs(pinner_miscdev.this_device, pin->sglist, pin->num_sg_ents, DMA_BIDIRECTIONAL,
+        coherent ? DMA_ATTR_SKIP_CPU_SYNC : 0);
     if (ret < 0) {
         printk(KERN_ALERT "pinner: Could not perform dma_map_sg\n");
         goto do_pin_error;
@@ -258,12 +309,20 @@ static int pinner_do_pin(struct pinner_cmd *cmd, struct proc_info *info) {
         goto do_pin_error;
     }
     
+    //Everything up to here only touched our own pinning, so other threads 
+    //using this file didn't have to wait for us. Now make it visible
+    pinner_add_pinning(info, pin);
+    
     //Give the userspace program a handle that allows them to undo this pinning
     usr_handle.user_magic = info->magic;
     usr_handle.pin_magic = pin->magic;
     n = copy_to_user(cmd->handle, &usr_handle, sizeof(struct pinner_handle));
     if (n != 0) {
         printk(KERN_ALERT "pinner: could not copy handle to userspace\n");
+        //Nobody got the handle, so nobody else should be using this pinning
+        down_write(&(info->pin_lock));
+        hash_del(&(pin->node));
+        up_write(&(info->pin_lock));
         ret = -EAGAIN;
         goto do_pin_error;
     }
@@ -285,86 +344,55 @@ static int pinner_do_pin(struct pinner_cmd *cmd, struct proc_info *info) {
 
 
 static int pinner_do_flush(struct pinner_cmd *cmd, struct proc_info *info) {
-    struct list_head *cur; //For iterating
     struct pinner_handle usr_handle;
-    int n;
-    struct pinning *found = NULL;
+    struct pinning *found;
+    int ret;
     
-    //Copy handle from userspace
-    n = copy_from_user(&usr_handle, cmd->handle, sizeof(struct pinner_handle));
-    if (n != 0) {
-        printk(KERN_ALERT "pinner: flush: could not copy handle from userspace\n");
-        return -EAGAIN;
-    }
+    ret = pinner_get_handle(cmd, info, &usr_handle);
+    if (ret < 0) return ret;
     
-    //Ensure that the user's handle matches the correct user_magic. We want to
-    //make it very difficult for buggy (or malicious) user code to accidentally
-    //unpin someone else's pinnings
-    if (usr_handle.user_magic != info->magic) {
-        printk(KERN_ALERT "pinner: incorrect user handle. No unpinning was performed\n");
+    //Hold the read lock the whole time, so nobody can unpin this while we're
+    //flushing it. Flushes (and lookups for other pins) can still go ahead in
+    //parallel
+    down_read(&(info->pin_lock));
+    found = pinner_find_pinning(info, usr_handle.pin_magic);
+    if (!found) {
+        up_read(&(info->pin_lock));
+        printk(KERN_ALERT "pinner: incorrect pin handle. No flush was performed\n");
         return -EINVAL;
     }
     
-    //Search linearly through pinning structs for correct pin_magic
-    //Note: who cares if this is inefficient? It's not like this function is
-    //getting called millions of times per second
-    for (cur = info->pinning_list.next; cur != &(info->pinning_list); cur = cur->next) {
-        struct pinning *p = list_entry(cur, struct pinning, list);
-        if (usr_handle.pin_magic == p->magic) {
-            found = p;
-            break;
+    //The device snoops the CPU caches for coherent pinnings, so there's
+    //nothing to do for those
+    if (!found->coherent) {
+        //Perform the cache flushing (I hope this works!)
+        //TODO: allow user to set direction
+        if ((cmd->usr_buf_sz & 1) == 0) {
+            dma_sync_sg_for_cpu(pinner_miscdev.this_device, found->sglist, found->num_sg_ents, DMA_BIDIRECTIONAL);
+        }
+        if ((cmd->usr_buf_sz & 0b10) == 0) {
+            dma_sync_sg_for_device(pinner_miscdev.this_device, found->sglist, found->num_sg_ents, DMA_BIDIRECTIONAL);
         }
     }
+    up_read(&(info->pin_lock));
     
-    if (!found) {
-        printk(KERN_ALERT "pinner: incorrect pin handle. No unpinning was performed\n");
-        return -EINVAL;
-    }
-    
-    //Perform the cache flushing (I hope this works!)
-    //TODO: allow user to set direction
-    if ((cmd->usr_buf_sz & 1) == 0) {
-        printk(KERN_INFO "pinner: performing dma_sync_sg_for_cpu");
-        dma_sync_sg_for_cpu(pinner_miscdev.this_device, found->sglist, found->num_sg_ents, DMA_BIDIRECTIONAL);
-    }
-    if ((cmd->usr_buf_sz & 0b10) == 0) {
-        printk(KERN_INFO "pinner: performing dma_sync_sg_for_device");
-        dma_sync_sg_for_device(pinner_miscdev.this_device, found->sglist, found->num_sg_ents, DMA_BIDIRECTIONAL);
-    }
     return 0;
 }
 
 static int pinner_do_unpin(struct pinner_cmd *cmd, struct proc_info *info) {
-    struct list_head *cur; //For iterating
     struct pinner_handle usr_handle;
-    int n;
-    struct pinning *found = NULL;
+    struct pinning *found;
+    int ret;
     
-    //Copy handle from userspace
-    n = copy_from_user(&usr_handle, cmd->handle, sizeof(struct pinner_handle));
-    if (n != 0) {
-        printk(KERN_ALERT "pinner: could not copy handle from userspace\n");
-        return -EAGAIN;
-    }
-    
-    //Ensure that the user's handle matches the correct user_magic. We want to
-    //make it very difficult for buggy (or malicious) user code to accidentally
-    //unpin someone else's pinnings
-    if (usr_handle.user_magic != info->magic) {
-        printk(KERN_ALERT "pinner: incorrect user handle. No unpinning was performed\n");
-        return -EINVAL;
-    }
+    ret = pinner_get_handle(cmd, info, &usr_handle);
+    if (ret < 0) return ret;
     
-    //Search linearly through pinning structs for correct pin_magic
-    //Note: who cares if this is inefficient? It's not like this function is
-    //getting called millions of times per second
-    for (cur = info->pinning_list.next; cur != &(info->pinning_list); cur = cur->next) {
-        struct pinning *p = list_entry(cur, struct pinning, list);
-        if (usr_handle.pin_magic == p->magic) {
-            found = p;
-            break;
-        }
-    }
+    //Only unlinking the pinning needs the write lock. Once it's out of the
+    //table nobody else can find it, so the slow part happens unlocked
+    down_write(&(info->pin_lock));
+    found = pinner_find_pinning(info, usr_handle.pin_magic);
+    if (found) hash_del(&(found->node));
+    up_write(&(info->pin_lock));
     
     if (!found) {
         printk(KERN_ALERT "pinner: incorrect pin handle. No unpinning was performed\n");
@@ -387,8 +415,9 @@ static int pinner_open (struct inode *inode, struct file *filp) {
         return -ENOMEM;
     }
     
-    //Initialize list of pinnings
-    INIT_LIST_HEAD(&(info->pinning_list));
+    //Initialize table of pinnings
+    init_rwsem(&(info->pin_lock));
+    hash_init(info->pinnings);
     
     //Initialize the magic
     get_random_bytes(&(info->magic), sizeof(info->magic));
@@ -434,7 +463,10 @@ static ssize_t pinner_write (struct file *filp, char const __user *buf, size_t s
     
     switch(cmd.cmd) {
         case PINNER_PIN:
-            return pinner_do_pin(&cmd, info);
+            return pinner_do_pin(&cmd, info, 0);
+            break;
+        case PINNER_PIN_COHERENT:
+            return pinner_do_pin(&cmd, info, 1);
             break;
         case PINNER_UNPIN:
             return pinner_do_unpin(&cmd, info);
@@ -0,0 +1,181 @@
+//Measures how well pinner scales when many threads share one /dev/pinner file
+//descriptor. For each buffer size and thread count, every thread hammers the
+//driver with its own buffer, first with pin+unpin pairs and then with flushes
+//of an already-pinned buffer. Prints CSV with the total rate over all
+//threads.
+//
+//    ./pinner_bench [max threads] [seconds per measurement]
+//
+//Defaults are 8 threads and 1 second. Build with something like
+//    aarch64-linux-gnu-gcc -O2 -o pinner_bench pinner_bench.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "pinner.h"
+
+static unsigned const sizes[] = {4 << 10, 64 << 10, 1 << 20, PINNER_MAX_PAGES << 12};
+
+typedef struct {
+    pthread_t thread;
+    int fd;
+    char *buf;
+    unsigned sz;
+    int do_flush; //Otherwise pin and unpin
+    unsigned long ops;
+    int err;
+    struct pinner_physlist plist; //Too big for the stack
+} worker;
+
+static volatile int go;
+static volatile int stop;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int do_cmd(int fd, unsigned cmd, worker *w, struct pinner_handle *h) {
+    struct pinner_cmd c = {
+        .cmd = cmd,
+        .usr_buf = w->buf,
+        .usr_buf_sz = (cmd == PINNER_FLUSH) ? 0 : w->sz, //Flush in both directions
+        .handle = h,
+        .physlist = &w->plist
+    };
+    return write(fd, &c, sizeof(c)) < 0 ? -1 : 0;
+}
+
+static void *work(void *arg) {
+    worker *w = (worker *) arg;
+    struct pinner_handle h;
+
+    if (w->do_flush && do_cmd(w->fd, PINNER_PIN, w, &h) < 0) {
+        perror("Could not pin buffer");
+        w->err = 1;
+        return NULL;
+    }
+
+    while (!go) ;
+    while (!stop) {
+        if (w->do_flush) {
+            if (do_cmd(w->fd, PINNER_FLUSH, w, &h) < 0) {
+                perror("Could not flush buffer");
+                w->err = 1;
+                break;
+            }
+        } else {
+            if (do_cmd(w->fd, PINNER_PIN, w, &h) < 0 || do_cmd(w->fd, PINNER_UNPIN, w, &h) < 0) {
+                perror("Could not pin/unpin buffer");
+                w->err = 1;
+                break;
+            }
+        }
+        w->ops++;
+    }
+
+    if (w->do_flush) do_cmd(w->fd, PINNER_UNPIN, w, &h);
+    return NULL;
+}
+
+//Returns operations per second over all threads, or a negative number on error
+static double run(int fd, worker *workers, unsigned nthreads, unsigned sz, int do_flush, double secs) {
+    unsigned started = 0;
+    unsigned long total = 0;
+    int err = 0;
+
+    go = 0;
+    stop = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        worker *w = &workers[i];
+        w->fd = fd;
+        w->sz = sz;
+        w->do_flush = do_flush;
+        w->ops = 0;
+        w->err = 0;
+        if (pthread_create(&w->thread, NULL, work, w)) {
+            perror("Could not start thread");
+            err = 1;
+            break;
+        }
+        started++;
+    }
+
+    //Let the flush threads pin their buffers before starting the clock
+    usleep(100000);
+    double start = now();
+    go = 1;
+    usleep(secs * 1e6);
+    stop = 1;
+    double elapsed = now() - start;
+
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].ops;
+        err |= workers[i].err;
+    }
+
+    return err ? -1 : total / elapsed;
+}
+
+int main(int argc, char **argv) {
+    unsigned max_threads = (argc > 1) ? strtoul(argv[1], NULL, 0) : 8;
+    double secs = (argc > 2) ? atof(argv[2]) : 1.0;
+    worker *workers = NULL;
+    int ret = 0;
+
+    if (max_threads == 0 || secs <= 0) {
+        puts("Usage: pinner_bench [max threads] [seconds per measurement]");
+        return 0;
+    }
+
+    //Everything goes through one file descriptor, on purpose
+    int fd = open("/dev/pinner", O_RDWR);
+    if (fd == -1) {
+        perror("Could not open /dev/pinner");
+        return -1;
+    }
+
+    workers = calloc(max_threads, sizeof(worker));
+    if (!workers) {
+        perror("Could not allocate workers");
+        ret = -1;
+        goto cleanup;
+    }
+    for (unsigned i = 0; i < max_threads; i++) {
+        workers[i].buf = aligned_alloc(4096, PINNER_MAX_PAGES << 12);
+        if (!workers[i].buf) {
+            perror("Could not allocate buffer");
+            ret = -1;
+            goto cleanup;
+        }
+        memset(workers[i].buf, 0, PINNER_MAX_PAGES << 12);
+    }
+
+    puts("threads,buf_bytes,pin_unpin_per_s,flush_per_s");
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        for (unsigned t = 1; t <= max_threads; t *= 2) {
+            double pins = run(fd, workers, t, sizes[s], 0, secs);
+            double flushes = run(fd, workers, t, sizes[s], 1, secs);
+            if (pins < 0 || flushes < 0) {
+                ret = -1;
+                goto cleanup;
+            }
+            printf("%u,%u,%.0f,%.0f\n", t, sizes[s], pins, flushes);
+            fflush(stdout);
+        }
+    }
+
+    cleanup:
+    if (workers) {
+        for (unsigned i = 0; i < max_threads; i++) free(workers[i].buf);
+        free(workers);
+    }
+    close(fd);
+    return ret;
+}
@@ -2,11 +2,17 @@
 #define PINNER_PRIVATE_H 1
 
 #include <linux/scatterlist.h> //For scatterlist struct
+#include <linux/hashtable.h> //For DECLARE_HASHTABLE
+#include <linux/rwsem.h> //For rw_semaphore
+
+//Each open file keeps its pinnings in a hash table, keyed by the pin magic
+#define PINNER_HASH_BITS 6
 
 struct pinning {
-    struct list_head list;
+    struct hlist_node node; //In proc_info's pinnings table
     int num_sg_ents;
     struct scatterlist *sglist;
+    int coherent; //If set, we never do cache maintenance on this pinning
     unsigned magic; //Helps prevent problems where the user accidentally (or
     //on purpose) fiddled around with the handle we gave them. Should be generated
     //with get_random_bytes.
@@ -14,7 +20,11 @@ struct pinning {
 
 struct proc_info {
     struct list_head list;
-    struct list_head pinning_list;
+    //Several threads can share one file descriptor. Flushes hold the read
+    //lock while they work; pin and unpin only take the write lock for long
+    //enough to add or remove a pinning from the table
+    struct rw_semaphore pin_lock;
+    DECLARE_HASHTABLE(pinnings, PINNER_HASH_BITS);
     unsigned magic; //Helps prevent problems where the user accidentally (or
     //on purpose) fiddled around with the handle we gave them. Should be generated
     //with get_random_bytes.
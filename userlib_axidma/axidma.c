@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdint.h>
 #include "axidma.h"
+#include "axidma_private.h"
 #include "pinner.h"
 
 //This cleans up the code slightly. I didn't use a typedef because I was worried
@@ -13,30 +14,9 @@
 #define handle  struct pinner_handle
 #define physlist struct pinner_physlist
 
-#define AXI_DMA_REG_SPAN 0x1000
-
 #define DBG_PRINT
 //#define DBG_PRINT(format, val) fprintf(stderr, #val " = " format "\n", val)
 
-//Format of the AXI DMA's registers
-typedef struct {
-    uint32_t    MM2S_DMACR;
-    uint32_t    MM2S_DMASR;
-    uint32_t    MM2S_curdesc_lsb;
-    uint32_t    MM2S_curdesc_msb;
-    uint32_t    MM2S_taildesc_lsb;
-    uint32_t    MM2S_taildesc_msb;
-    
-    uint32_t    unused[6];
-    
-    uint32_t    S2MM_DMACR;
-    uint32_t    S2MM_DMASR;
-    uint32_t    S2MM_curdesc_lsb;
-    uint32_t    S2MM_curdesc_msb;
-    uint32_t    S2MM_taildesc_lsb;
-    uint32_t    S2MM_taildesc_msb;
-} axidma_regs;
-
 //Functions to open and close an AXI DMA context.
 axidma_ctx* axidma_open(char const* path) {
     int fd = -1;
@@ -77,6 +57,27 @@ void axidma_close(axidma_ctx *ctx) {
     free(ctx);
 }
 
+//How long to wait for axidma_reset, in 10 us polls
+#define RESET_POLLS 10000
+
+int axidma_reset(axidma_ctx *ctx) {
+    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
+    
+    //Either channel's reset bit resets the whole core, but write both in
+    //case someone (e.g. the model) treats them separately
+    regs->MM2S_DMACR = DMACR_RESET;
+    regs->S2MM_DMACR = DMACR_RESET;
+    
+    //The bits clear themselves once the core is done
+    for (int i = 0; i < RESET_POLLS; i++) {
+        if (!((regs->MM2S_DMACR | regs->S2MM_DMACR) & DMACR_RESET)) return 0;
+        usleep(10);
+    }
+    
+    fprintf(stderr, "axidma_reset: DMA did not come out of reset\n");
+    return -1;
+}
+
 //Some helper functions for the linked list
 
 static inline void sg_entry_init(sg_entry *node) {
@@ -128,21 +129,47 @@ sg_list *axidma_list_new(void *sg_buf, physlist const *sg_plist,
     lst->data_plist = data_plist;
     lst->data_offset = 0;
     
+    lst->is_s2mm = 1;
+    
+    //Assume the worst. Cache maintenance on a coherent buffer is just slow,
+    //but skipping it on a non-coherent one corrupts data
+    lst->sg_coherent = 0;
+    lst->data_coherent = 0;
+    
     return lst;
 }
 
+void axidma_list_set_coherent(sg_list *lst, int sg_coherent, int data_coherent) {
+    lst->sg_coherent = sg_coherent;
+    lst->data_coherent = data_coherent;
+}
+
 
 /*
  * Clears all the entries in an sg_list, except the sentinel 
 */
 void axidma_free_list(sg_entry *sentinel) {    
-    //Step through linked list and free all the entries
+    //Step through linked list and free all the entries. (Careful: the list
+    //might be empty, and the sentinel itself isn't ours to free)
     sg_entry *e = sentinel->next;
-    do {
+    while (e != sentinel) {
         sg_entry *tmp = e->next;
         free(e);
         e = tmp;
-    } while (e != sentinel);
+    }
+    sg_entry_init(sentinel);
+}
+
+/*
+ * Clears all the entries in an sg_list, and starts allocating from the
+ * beginning of the SG and data buffers again
+*/
+void axidma_clear_list(sg_list *lst) {
+    if (!lst) return;
+    axidma_free_list(&(lst->sentinel));
+    lst->to_vist = NULL;
+    lst->sg_offset = 0;
+    lst->data_offset = 0;
 }
 
 //Free an sg_list object
@@ -188,6 +215,30 @@ uint64_t virt_to_phys(physlist const *plist, unsigned offset) {
     return (uint64_t) NULL;
 }
 
+//Copies part of a physlist. See axidma_private.h
+unsigned axidma_slice_physlist(physlist const *src, unsigned start, unsigned len, physlist *out) {
+    unsigned done = 0;
+    out->num_entries = 0;
+
+    for (unsigned i = 0; i < src->num_entries && done < len; i++) {
+        unsigned elen = src->entries[i].len;
+        if (start >= elen) {
+            start -= elen;
+            continue;
+        }
+
+        unsigned n = elen - start;
+        if (n > len - done) n = len - done;
+        out->entries[out->num_entries].addr = src->entries[i].addr + start;
+        out->entries[out->num_entries].len = n;
+        out->num_entries++;
+        done += n;
+        start = 0;
+    }
+
+    return done;
+}
+
 //Scatter-gather entries must be in contiguous memory. This function walks 
 //through a physlist to find the next chunk of size sz after offset, and returns
 //the offset. Returns AXIDMA_NOT_FOUND if nothing could be found
@@ -232,7 +283,7 @@ static unsigned find_contiguous_after(physlist const *plist, unsigned offset, un
 */
 add_entry_code axidma_add_entry(sg_list *lst, unsigned sz) {
     //Before we go down this road, check that the function arugments make sense
-    if (!lst || !sz) {
+    if (!lst || !sz || !lst->data_plist) {
         fprintf(stderr, "axidma_add_entry: Invalid function argument\n");
         return ADD_ENTRY_ERROR;
     }
@@ -284,6 +335,7 @@ add_entry_code axidma_add_entry(sg_list *lst, unsigned sz) {
         e->sg_offset = sg_offset;
         e->data_offset = data_offset; //If a buffer spans several entries, 
                                       //only use the data_offset from the first
+        e->data_virt = lst->data_buf + data_offset;
         e->buf_phys = virt_to_phys(lst->data_plist, data_offset);
         sg_entry_add_before(&sentinel, e);
         e->is_EOF = 0; //These get set later
@@ -330,8 +382,143 @@ add_entry_code axidma_add_entry(sg_list *lst, unsigned sz) {
     return ret;
 }
 
-//Actually writes an entry into RAM
-static void s2mm_write_sg_entry(void *sg_buf, physlist const *sg_plist, sg_entry *e) {
+/*
+ * Returns the user virtual address of the buffer from the last successful
+ * call to axidma_add_entry, or NULL if the list is empty
+*/
+void *axidma_last_buf(sg_list *lst) {
+    sg_entry *e = lst->sentinel.prev;
+    if (e == &(lst->sentinel)) return NULL;
+    
+    //A buffer can span several entries; its address is in the first one
+    while (!e->is_SOF) e = e->prev;
+    return e->data_virt;
+}
+
+/*
+ * Appends the entries for a buffer from an axidma_arena. The physical 
+ * segments are already worked out, so this is a lot simpler than 
+ * axidma_add_entry
+*/
+add_entry_code axidma_add_arena_buf(sg_list *lst, axidma_arena_buf const *b, unsigned len) {
+    if (!lst || !b || !len || len > b->size) {
+        fprintf(stderr, "axidma_add_arena_buf: Invalid function argument\n");
+        return ADD_ENTRY_ERROR;
+    }
+    
+    //Same idea as axidma_add_entry: build the entries off to the side, and
+    //only touch lst once we know everything worked
+    int ret = 0;
+    sg_entry sentinel;
+    sg_entry_init(&sentinel);
+    unsigned sg_offset = lst->sg_offset;
+    unsigned done = 0;
+    
+    for (unsigned i = 0; i < b->num_segs && done < len; i++) {
+        sg_offset = find_contiguous_after(lst->sg_plist, sg_offset, sizeof(sg_descriptor));
+        if (sg_offset == AXIDMA_NOT_FOUND) {
+            ret = ADD_ENTRY_SG_OOM;
+            goto axidma_add_arena_buf_error;
+        }
+        
+        sg_entry *e = malloc(sizeof(sg_entry));
+        if (!e) {
+            perror("Could not allocate sg_entry");
+            ret = ADD_ENTRY_ERROR;
+            goto axidma_add_arena_buf_error;
+        }
+        e->sg_offset = sg_offset;
+        e->data_offset = 0; //Meaningless for arena buffers
+        e->data_virt = b->base + done;
+        e->buf_phys = b->segs[i].addr;
+        e->len = (len - done < b->segs[i].len) ? len - done : b->segs[i].len;
+        e->is_SOF = 0;
+        e->is_EOF = 0;
+        sg_entry_add_before(&sentinel, e);
+        
+        sg_offset += sizeof(sg_descriptor);
+        done += e->len;
+    }
+    
+    sentinel.next->is_SOF = 1;
+    sentinel.prev->is_EOF = 1;
+    
+    sg_entry_add_list_before(&(lst->sentinel), &sentinel);
+    lst->sg_offset = sg_offset;
+    
+    return ADD_ENTRY_SUCCESS;
+    
+    axidma_add_arena_buf_error:
+    
+    axidma_free_list(&sentinel);
+    return ret;
+}
+
+#if defined(__aarch64__)
+//Linux lets userspace read CTR_EL0 and use dc cvac/civac, so none of the
+//cache maintenance needs a system call
+static uintptr_t dcache_line_size(void) {
+    static uintptr_t line;
+    if (!line) {
+        uint64_t ctr;
+        asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+        line = 4UL << ((ctr >> 16) & 0xF);
+    }
+    return line;
+}
+#endif
+
+//These start cache maintenance on a range without waiting for it to finish,
+//so we can queue up a whole list's worth and then wait once with dc_sync
+static void dc_clean(void const volatile *p, unsigned long n) {
+#if defined(__aarch64__)
+    uintptr_t line = dcache_line_size();
+    uintptr_t addr = ((uintptr_t) p) & ~(line - 1);
+    uintptr_t end = (uintptr_t) p + n;
+    for (; addr < end; addr += line) {
+        asm volatile("dc cvac, %0" :: "r"(addr) : "memory");
+    }
+#else
+    (void) p;
+    (void) n;
+#endif
+}
+
+static void dc_inval(void const volatile *p, unsigned long n) {
+#if defined(__aarch64__)
+    //dc ivac isn't allowed at EL0, so clean+invalidate instead
+    uintptr_t line = dcache_line_size();
+    uintptr_t addr = ((uintptr_t) p) & ~(line - 1);
+    uintptr_t end = (uintptr_t) p + n;
+    for (; addr < end; addr += line) {
+        asm volatile("dc civac, %0" :: "r"(addr) : "memory");
+    }
+#else
+    (void) p;
+    (void) n;
+#endif
+}
+
+static void dc_sync(void) {
+#if defined(__aarch64__)
+    asm volatile("dsb sy" ::: "memory");
+#endif
+}
+
+void axidma_clean_range(void const volatile *p, unsigned long n) {
+    dc_clean(p, n);
+    dc_sync();
+}
+
+void axidma_inval_range(void const volatile *p, unsigned long n) {
+    dc_inval(p, n);
+    dc_sync();
+}
+
+//Actually writes an entry into RAM. The descriptor format is the same for
+//both channels. If e is the last entry, it points at wrap_phys (or back at
+//the first entry, if wrap_phys is 0)
+static void write_sg_entry(sg_list *lst, sg_entry *e, uint64_t wrap_phys) {
     DBG_PRINT("%d", e->sg_offset);
     DBG_PRINT("%d", e->data_offset);
     DBG_PRINT("%d", e->len);
@@ -340,7 +527,7 @@ static void s2mm_write_sg_entry(void *sg_buf, physlist const *sg_plist, sg_entry
     DBG_PRINT("%lx", e->buf_phys);
     DBG_PRINT("%c", '\n');
     
-    volatile sg_descriptor *desc = (volatile sg_descriptor *) (sg_buf + e->sg_offset);
+    volatile sg_descriptor *desc = (volatile sg_descriptor *) (lst->sg_buf + e->sg_offset);
     //Is endianness gonna bite me for this?
     desc->control.sof = e->is_SOF;
     desc->control.eof = e->is_EOF;
@@ -348,68 +535,211 @@ static void s2mm_write_sg_entry(void *sg_buf, physlist const *sg_plist, sg_entry
     desc->buffer_lsb = (uint32_t) (e->buf_phys & 0xFFFFFFFF);
     desc->buffer_msb = (uint32_t) ((e->buf_phys>>32) & 0xFFFFFFFF);
     
-    if (!e->is_EOF) {
-        uint64_t nextdesc_phys = virt_to_phys(sg_plist, e->next->sg_offset);
-        desc->next_desc_lsb = (uint32_t) (nextdesc_phys & 0xFFFFFFFF);
-        desc->next_desc_msb = (uint32_t) ((nextdesc_phys>>32) & 0xFFFFFFFF);
+    //Every descriptor has to point at the next one, not just the ones in the
+    //middle of a packet. By default the last one points back to the first, 
+    //so that the DMA's idea of "the next descriptor" stays sane if the list
+    //is reused
+    sg_entry *next = e->next;
+    uint64_t nextdesc_phys;
+    if (next == &(lst->sentinel) && wrap_phys) {
+        nextdesc_phys = wrap_phys;
+    } else {
+        if (next == &(lst->sentinel)) next = next->next;
+        nextdesc_phys = virt_to_phys(lst->sg_plist, next->sg_offset);
     }
+    desc->next_desc_lsb = (uint32_t) (nextdesc_phys & 0xFFFFFFFF);
+    desc->next_desc_msb = (uint32_t) ((nextdesc_phys>>32) & 0xFFFFFFFF);
+    
+    //The DMA complains (SGIntErr) if it fetches a descriptor that's already
+    //marked complete, so clear out whatever the last transfer left here. Do
+    //this last, so a descriptor never looks ready before it's filled in
+    memset((void *) &desc->status, 0, sizeof(desc->status));
 }
 
-/*
- * Writes the scatter-gather list entries to memory, then starts the transfer.
- * Set wait_irq to 0 if you don't want to wait for the interrupt
- * TODO: find clean way to return information about transfer status
-*/
-void axidma_s2mm_transfer(axidma_ctx *ctx, sg_list *lst, int wait_irq) {
+//Registers for one channel of the AXI DMA. Both channels have the same layout
+typedef struct {
+    uint32_t    DMACR;
+    uint32_t    DMASR;
+    uint32_t    curdesc_lsb;
+    uint32_t    curdesc_msb;
+    uint32_t    taildesc_lsb;
+    uint32_t    taildesc_msb;
+} axidma_chan_regs;
+
+static inline volatile axidma_chan_regs *get_chan_regs(axidma_ctx *ctx, int is_s2mm) {
+    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
+    if (is_s2mm) return (volatile axidma_chan_regs *) &(regs->S2MM_DMACR);
+    else return (volatile axidma_chan_regs *) &(regs->MM2S_DMACR);
+}
+
+//Writes every descriptor in lst to RAM, and resets the list for 
+//axidma_dequeue_s2mm_buf. See axidma_private.h
+void axidma_write_list(sg_list *lst, int is_s2mm, uint64_t wrap_phys) {
+    lst->to_vist = lst->sentinel.next;
+    lst->is_s2mm = is_s2mm;
+    
+    for (sg_entry *e = lst->sentinel.next; e != &(lst->sentinel); e = e->next) {
+        write_sg_entry(lst, e, wrap_phys);
+        
+        if (!lst->sg_coherent) dc_clean(lst->sg_buf + e->sg_offset, sizeof(sg_descriptor));
+        if (!lst->data_coherent) {
+            //MM2S data has to reach RAM. For S2MM, throw away our copy now,
+            //so a dirty line can't get evicted on top of what the DMA writes
+            if (is_s2mm) dc_inval(e->data_virt, e->len);
+            else dc_clean(e->data_virt, e->len);
+        }
+    }
+    
+    //Wait for all of it once, instead of after every descriptor
+    if (!lst->sg_coherent || !lst->data_coherent) dc_sync();
+}
+
+//Checks one descriptor's status. See axidma_private.h
+int axidma_entry_done(sg_list const *lst, sg_entry const *e) {
+    volatile sg_descriptor *desc = (volatile sg_descriptor *) (lst->sg_buf + e->sg_offset);
+    if (!lst->sg_coherent) axidma_inval_range(desc, sizeof(sg_descriptor));
+    return desc->status.complete;
+}
+
+uint64_t axidma_list_head_phys(sg_list const *lst) {
+    return virt_to_phys(lst->sg_plist, lst->sentinel.next->sg_offset);
+}
+
+uint64_t axidma_list_tail_phys(sg_list const *lst) {
+    return virt_to_phys(lst->sg_plist, lst->sentinel.prev->sg_offset);
+}
+
+//Orders normal memory writes before the device register writes that follow
+static inline void write_barrier(void) {
+#if defined(__aarch64__)
+    asm volatile("dmb oshst" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
+//Hands descriptors up to taildesc_phys to the DMA. See axidma_private.h
+void axidma_kick(axidma_ctx *ctx, int is_s2mm, uint64_t curdesc_phys, uint64_t taildesc_phys) {
+    //This follows the programming sequence in the product guide. First, we 
+    //write the pointer to the first descriptor. The DMA ignores this once the
+    //channel is running, so don't bother (and don't risk the DMA picking it
+    //up late, if it hasn't noticed RS yet)
+    volatile axidma_chan_regs *regs = get_chan_regs(ctx, is_s2mm);
+    
+    //The descriptors have to reach memory before the DMA goes looking for
+    //them. Uncached descriptor memory (see axidma_onchip.h) is written
+    //through a write buffer that doesn't have to drain before our register
+    //writes do, so wait for it
+    write_barrier();
+    
+    if (!(regs->DMACR & DMACR_RS)) {
+        regs->curdesc_lsb = (uint32_t) (curdesc_phys & 0xFFFFFFFF);
+        regs->curdesc_msb = (uint32_t) ((curdesc_phys>>32) & 0xFFFFFFFF);
+        
+        //Enable IOC and error interrupts, and set run/stop to 1. Leave the
+        //interrupt threshold alone, in case someone set it
+        regs->DMACR = (regs->DMACR & DMACR_IRQ_THRESH_MASK) | DMACR_IOC_IRQ_EN | DMACR_ERR_IRQ_EN | DMACR_RS;
+    }
+    
+    //Now write the pointer to the last descriptor. This starts the transfer
+    regs->taildesc_lsb = (uint32_t) (taildesc_phys & 0xFFFFFFFF);
+    regs->taildesc_msb = (uint32_t) ((taildesc_phys>>32) & 0xFFFFFFFF);
+}
+
+//Sets how many packets the channel finishes per IOC interrupt. See
+//axidma_private.h
+void axidma_set_irq_threshold(axidma_ctx *ctx, int is_s2mm, unsigned pkts) {
+    volatile axidma_chan_regs *regs = get_chan_regs(ctx, is_s2mm);
+    
+    if (pkts < 1) pkts = 1;
+    if (pkts > 255) pkts = 255;
+    
+    uint32_t cr = regs->DMACR & ~DMACR_IRQ_THRESH_MASK;
+    regs->DMACR = cr | (pkts << DMACR_IRQ_THRESH_SHIFT);
+}
+
+//Sleeps until the next interrupt. Writing back afterwards is the usual UIO
+//handshake; the axidma module uses it to time how long we took to wake up
+//(see /sys/axidma/irq_latency). Returns -1 on error
+static int wait_for_irq(axidma_ctx *ctx) {
+    unsigned pending, one = 1;
+    if (read(ctx->fd, &pending, sizeof(pending)) != sizeof(pending)) {
+        perror("Could not wait for AXI DMA interrupt");
+        return -1;
+    }
+    if (write(ctx->fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Could not acknowledge AXI DMA interrupt");
+        return -1;
+    }
+    return 0;
+}
+
+//Common code for axidma_s2mm_transfer and axidma_mm2s_transfer
+static void start_transfer(axidma_ctx *ctx, sg_list *lst, int is_s2mm, int wait_irq, char const *fn) {
     //Validate inputs, just in case
     if (!ctx) {
-        fprintf(stderr, "axidma_s2mm_transfer: invalid NULL context\n");
+        fprintf(stderr, "%s: invalid NULL context\n", fn);
         return;
     }
     if (!lst) {
-        fprintf(stderr, "axidma_s2mm_transfer: invalid NULL list\n");
+        fprintf(stderr, "%s: invalid NULL list\n", fn);
         return;
     }
     if (lst->sentinel.next == &(lst->sentinel)) {
-        fprintf(stderr, "axidma_s2mm_transfer: invalid list with no SG entries\n");
+        fprintf(stderr, "%s: invalid list with no SG entries\n", fn);
         return;
     }
     
-    //Set the to_visit field
-    lst->to_vist = lst->sentinel.next;
-    
     //Step through linked list of SG entries and write each one to RAM
-    for (sg_entry *e = lst->sentinel.next; e != &(lst->sentinel); e = e->next) {
-        s2mm_write_sg_entry(lst->sg_buf, lst->sg_plist, e);
-    }
+    axidma_write_list(lst, is_s2mm, 0);
     
     //Now we actually send the commands to the AXI DMA's registers
-    //This follows the programming sequence in the product guide. First, we 
-    //write the pointer to the first descriptor
-    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
-    
-    uint64_t curdesc_phys = virt_to_phys(lst->sg_plist, lst->sentinel.next->sg_offset);
-    regs->S2MM_curdesc_lsb = (uint32_t) (curdesc_phys & 0xFFFFFFFF);
-    regs->S2MM_curdesc_msb = (uint32_t) ((curdesc_phys>>32) & 0xFFFFFFFF);
-    
-    //Enable IOC interrupts, and set run/stop to 1
-    regs->S2MM_DMACR = 0b1000000000001; 
-    
-    //Now write the pointer to the last descriptor. This starts the transfer
-    uint64_t taildesc_phys = virt_to_phys(lst->sg_plist, lst->sentinel.prev->sg_offset);
-    regs->S2MM_taildesc_lsb = (uint32_t) (taildesc_phys & 0xFFFFFFFF);
-    regs->S2MM_taildesc_msb = (uint32_t) ((taildesc_phys>>32) & 0xFFFFFFFF);
+    axidma_kick(ctx, is_s2mm, axidma_list_head_phys(lst), axidma_list_tail_phys(lst));
     
     if (wait_irq) {
         //At this point, transfer has started. Wait for the interrupt!
-        puts("Waiting for DMA to finish!");
-        fflush(stdout);
+        wait_for_irq(ctx);
+    }
+}
+
+/*
+ * Writes the scatter-gather list entries to memory, then starts the transfer.
+ * Set wait_irq to 0 if you don't want to wait for the interrupt
+ * TODO: find clean way to return information about transfer status
+*/
+void axidma_s2mm_transfer(axidma_ctx *ctx, sg_list *lst, int wait_irq) {
+    start_transfer(ctx, lst, 1, wait_irq, "axidma_s2mm_transfer");
+}
+
+/*
+ * Same as axidma_s2mm_transfer, but sends the buffers out on the MM2S channel
+*/
+void axidma_mm2s_transfer(axidma_ctx *ctx, sg_list *lst, int wait_irq) {
+    start_transfer(ctx, lst, 0, wait_irq, "axidma_mm2s_transfer");
+}
+
+/*
+ * Waits until the DMA has finished every descriptor in a list. Returns 0 once
+ * the list is done, or -1 if the channel stopped with an error
+*/
+int axidma_wait_list(axidma_ctx *ctx, sg_list *lst, int use_irq) {
+    if (!ctx || !lst || lst->sentinel.prev == &(lst->sentinel)) {
+        fprintf(stderr, "axidma_wait_list: Invalid function argument\n");
+        return -1;
+    }
+    
+    //The DMA finishes descriptors in order, so the last one is the only one
+    //we need to look at. Don't go by the interrupt alone: with several
+    //packets in the list, the first IOC comes long before we're done
+    volatile axidma_chan_regs *regs = get_chan_regs(ctx, lst->is_s2mm);
+    
+    while (!axidma_entry_done(lst, lst->sentinel.prev)) {
+        if (regs->DMASR & DMASR_ERR_MASK) return -1;
         
-        unsigned pending;
-        read(ctx->fd, &pending, sizeof(pending));
+        if (use_irq && wait_for_irq(ctx) < 0) return -1;
     }
     
-    return;
+    return 0;
 }
 
 /*
@@ -432,7 +762,7 @@ s2mm_buf axidma_dequeue_s2mm_buf(sg_list *lst) {
     }
     
     s2mm_buf ret = {
-        .base = lst->data_buf + e->data_offset,
+        .base = e->data_virt,
         .len = 0,
         .code = TRANSFER_SUCCESS
     };
@@ -447,11 +777,17 @@ s2mm_buf axidma_dequeue_s2mm_buf(sg_list *lst) {
         
         ret.len += e->len;
         
-        if (!desc->status.complete || desc->status.decode_err || desc->status.int_err || desc->status.slave_err) {
+        if (!axidma_entry_done(lst, e) || desc->status.decode_err || desc->status.int_err || desc->status.slave_err) {
             ret.code = TRANSFER_FAILED;
+        } else if (lst->is_s2mm && !lst->data_coherent) {
+            //Only the bytes that actually came in. Anything the CPU
+            //speculatively pulled in while the DMA was running goes too
+            dc_inval(e->data_virt, desc->status.len);
         }
     } while (!e->is_EOF);
     
+    if (lst->is_s2mm && !lst->data_coherent) dc_sync();
+    
     //Update to_visit
     lst->to_vist = e->next;
     
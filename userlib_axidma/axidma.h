@@ -9,9 +9,11 @@
 //Started adding these version tags, cause I'm starting to lose track of what's
 //going on. This code needs to be maintained in several places
 #define AXIDMA_USERLIB_VERSION_MAJOR 1
-#define AXIDMA_USERLIB_VERSION_MINOR 1
+#define AXIDMA_USERLIB_VERSION_MINOR 4
 
+#include <stdint.h>
 #include "pinner.h"
+#include "axidma_arena.h"
 
 
 #define AXIDMA_NOT_FOUND 0xFFFFFFFF
@@ -51,6 +53,13 @@ typedef struct {
     unsigned app2           :32;
     unsigned app3           :32;
     unsigned app4           :32;
+    
+    //The AXI DMA ignores the bottom 6 bits of descriptor addresses, so they
+    //have to be 64-byte aligned. Pad them out so they stay that way when
+    //packed one after the other
+    unsigned                :32;
+    unsigned                :32;
+    unsigned                :32;
 } sg_descriptor;
 
 /*
@@ -72,6 +81,8 @@ typedef struct _sg_entry {
     //Offset into virtual memory. 
     unsigned sg_offset; //Used when writing the SG list to memory.
     unsigned data_offset; //Used when returning data to user
+    void *data_virt; //Where the buffer starts. Same as data_buf + data_offset,
+                     //except for buffers from an arena
     
     //Fields in the ADI DMA SG entry
     //unsigned long nextdesc_phys; //Can (and should) compute this on the fly
@@ -96,6 +107,13 @@ typedef struct {
     void *data_buf; //User virtual address to start of data memory
     unsigned data_offset; //Offset into data_buf where next buffer will be allocated
     physlist const *data_plist; //Physical address information for data buffer
+    
+    int is_s2mm; //Which channel this list was last sent to
+    
+    //Whether the DMA sees the CPU's caches for each buffer. See
+    //axidma_list_set_coherent
+    int sg_coherent;
+    int data_coherent;
 } sg_list;
 
 typedef enum {
@@ -117,11 +135,36 @@ typedef struct {
 axidma_ctx* axidma_open(char const* path);
 void axidma_close(axidma_ctx *ctx);
 
+/*
+ * Resets the whole AXI DMA (the reset bit always resets both channels) and
+ * waits for the reset to finish, which leaves both channels halted. Anything
+ * in flight is dropped. Returns 0 on success, or -1 if the reset didn't
+ * finish in time
+*/
+int axidma_reset(axidma_ctx *ctx);
+
 //Functions to create and delete an sg_list objext
 sg_list *axidma_list_new(void *sg_buf, physlist const *sg_plist,
                          void *data_buf, physlist const *data_plist);
 void axidma_list_del(sg_list *lst);
 
+/*
+ * By default, the transfer functions assume the DMA doesn't snoop the CPU's
+ * caches. They clean each descriptor (and each MM2S buffer) before starting
+ * the DMA, and invalidate each descriptor (and the bytes that actually came
+ * in on S2MM) before handing them back. That only touches the bytes involved,
+ * so there's no need for flush_buf_cache around every transfer anymore.
+ * 
+ * Set sg_coherent if the SG buffer doesn't need any of that (it was pinned
+ * with pin_buf_coherent, or it's uncached, like axidma_onchip.h), and 
+ * data_coherent if the same goes for the data buffers (including arena
+ * buffers added to this list).
+ * 
+ * Without coherency, keep S2MM buffers from sharing cache lines with anything
+ * the CPU writes while the DMA is running (arena buffers are always fine)
+*/
+void axidma_list_set_coherent(sg_list *lst, int sg_coherent, int data_coherent);
+
 //Functions for modifying an sg_list
 
 
@@ -142,19 +185,59 @@ typedef enum {
 add_entry_code axidma_add_entry(sg_list *lst, unsigned sz);
 
 /*
- * Clears all the entries in an sg_list 
+ * Appends the entries for a buffer from an axidma_arena, instead of carving
+ * one out of the list's data buffer. len can be less than the buffer's size
+ * (e.g. for MM2S packets shorter than the buffer). Returns the same codes as
+ * axidma_add_entry. The list doesn't own the buffer: free it yourself once
+ * the DMA is done with it. You can pass NULL for data_buf and data_plist to
+ * axidma_list_new if you only ever use arena buffers
+*/
+add_entry_code axidma_add_arena_buf(sg_list *lst, axidma_arena_buf const *b, unsigned len);
+
+/*
+ * Clears all the entries in an sg_list, and starts allocating from the
+ * beginning of the SG and data buffers again
 */
 void axidma_clear_list(sg_list *lst);
 
+/*
+ * Returns the user virtual address of the buffer from the last successful
+ * call to axidma_add_entry, or NULL if the list is empty. Handy for filling
+ * in MM2S data
+*/
+void *axidma_last_buf(sg_list *lst);
+
 /*
  * Writes the scatter-gather list entries to memory, then starts the transfer.
  * Set wait_irq to 0 if you don't want to wait for the interrupt
+ * 
+ * The DMA only reads where a list starts while the channel is halted. Once
+ * it's running (i.e. after the first transfer), it carries on from the
+ * next_desc of the last descriptor it finished, so a new list must be
+ * reachable from there. Reusing the same list, or another list over the same
+ * SG memory, is fine: the last descriptor always points back to the start of
+ * the SG buffer. To switch to different SG memory, call axidma_reset first
  * TODO: find clean way to return information about transfer status
 */
 void axidma_s2mm_transfer(axidma_ctx *ctx, sg_list *lst, int wait_irq);
 
 /*
- * Used for traversing buffers returned from an S2MM trasnfer
+ * Same as axidma_s2mm_transfer, but sends the buffers out on the MM2S channel.
+ * Fill them in (see axidma_last_buf) before calling this
+*/
+void axidma_mm2s_transfer(axidma_ctx *ctx, sg_list *lst, int wait_irq);
+
+/*
+ * Waits until the DMA has finished every descriptor in a list that was 
+ * started with one of the transfer functions. With use_irq, sleeps on the 
+ * interrupt; otherwise, spins on the last descriptor's status. Returns 0 
+ * once the list is done, or -1 if the channel stopped with an error
+*/
+int axidma_wait_list(axidma_ctx *ctx, sg_list *lst, int use_irq);
+
+/*
+ * Used for traversing buffers returned from an S2MM trasnfer. Also works for
+ * checking the status of MM2S buffers
 */
 s2mm_buf axidma_dequeue_s2mm_buf(sg_list *lst);
 
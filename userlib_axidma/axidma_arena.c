@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "axidma_arena.h"
+#include "pinner.h"
+
+#define NUM_ORDERS (AXIDMA_ARENA_MAX_ORDER - AXIDMA_ARENA_MIN_ORDER + 1)
+#define NIL 0xFFFFFFFF
+
+//What we know about each minimum-sized block in a region. Only the first
+//block of a free or allocated buffer has anything interesting in it
+#define BLOCK_FREE 0x80
+#define BLOCK_USED 0x40
+
+//Number of minimum-sized blocks in a buffer of the given order
+#define BLOCKS(order) (1U << ((order) - AXIDMA_ARENA_MIN_ORDER))
+
+typedef struct {
+    char *buf; //What the user gave us
+    char *base; //First 64-byte aligned address in buf
+    unsigned nblocks;
+
+    //Bookkeeping lives out here rather than in the free blocks themselves,
+    //so we never write to memory the DMA might be looking at
+    uint8_t *state;
+    uint32_t *next;
+    uint32_t *prev;
+    uint32_t free_head[NUM_ORDERS];
+
+    //Copy of the physlist. entry_start is where each entry begins, as an
+    //offset from buf
+    unsigned num_entries;
+    uint64_t *entry_phys;
+    size_t *entry_start;
+    unsigned *entry_len;
+} region;
+
+struct axidma_arena {
+    pthread_mutex_t lock;
+    region *regions;
+    unsigned num_regions;
+    size_t total_bytes;
+    size_t free_bytes;
+};
+
+static void free_list_push(region *r, uint32_t blk, unsigned order) {
+    uint32_t *head = &r->free_head[order - AXIDMA_ARENA_MIN_ORDER];
+    r->state[blk] = BLOCK_FREE | order;
+    r->prev[blk] = NIL;
+    r->next[blk] = *head;
+    if (*head != NIL) r->prev[*head] = blk;
+    *head = blk;
+}
+
+static void free_list_remove(region *r, uint32_t blk, unsigned order) {
+    uint32_t *head = &r->free_head[order - AXIDMA_ARENA_MIN_ORDER];
+    if (r->prev[blk] != NIL) r->next[r->prev[blk]] = r->next[blk];
+    else *head = r->next[blk];
+    if (r->next[blk] != NIL) r->prev[r->next[blk]] = r->prev[blk];
+    r->state[blk] = 0;
+}
+
+static void region_free(region *r) {
+    free(r->state);
+    free(r->next);
+    free(r->prev);
+    free(r->entry_phys);
+    free(r->entry_start);
+    free(r->entry_len);
+}
+
+axidma_arena *axidma_arena_new(void) {
+    axidma_arena *a = calloc(1, sizeof(axidma_arena));
+    if (!a) {
+        perror("Could not allocate arena");
+        return NULL;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    return a;
+}
+
+void axidma_arena_del(axidma_arena *a) {
+    if (!a) return;
+    for (unsigned i = 0; i < a->num_regions; i++) region_free(&a->regions[i]);
+    free(a->regions);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+int axidma_arena_add_region(axidma_arena *a, void *buf, size_t len, struct pinner_physlist const *plist) {
+    region r;
+    memset(&r, 0, sizeof(r));
+
+    //Check that the physlist really describes this buffer
+    size_t plist_len = 0;
+    for (unsigned i = 0; i < plist->num_entries; i++) plist_len += plist->entries[i].len;
+    if (plist->num_entries == 0 || plist_len < len) {
+        fprintf(stderr, "axidma_arena_add_region: physlist doesn't cover the buffer\n");
+        return -1;
+    }
+
+    uintptr_t start = ((uintptr_t) buf + AXIDMA_ARENA_MIN_SIZE - 1) & ~((uintptr_t) AXIDMA_ARENA_MIN_SIZE - 1);
+    uintptr_t end = ((uintptr_t) buf + len) & ~((uintptr_t) AXIDMA_ARENA_MIN_SIZE - 1);
+    if (end <= start) {
+        fprintf(stderr, "axidma_arena_add_region: region is too small\n");
+        return -1;
+    }
+    r.buf = buf;
+    r.base = (char *) start;
+    r.nblocks = (end - start) / AXIDMA_ARENA_MIN_SIZE;
+
+    r.state = calloc(r.nblocks, sizeof(uint8_t));
+    r.next = malloc(r.nblocks * sizeof(uint32_t));
+    r.prev = malloc(r.nblocks * sizeof(uint32_t));
+    r.num_entries = plist->num_entries;
+    r.entry_phys = malloc(r.num_entries * sizeof(uint64_t));
+    r.entry_start = malloc(r.num_entries * sizeof(size_t));
+    r.entry_len = malloc(r.num_entries * sizeof(unsigned));
+    if (!r.state || !r.next || !r.prev || !r.entry_phys || !r.entry_start || !r.entry_len) {
+        perror("Could not allocate arena region");
+        region_free(&r);
+        return -1;
+    }
+
+    size_t off = 0;
+    for (unsigned i = 0; i < r.num_entries; i++) {
+        r.entry_phys[i] = plist->entries[i].addr;
+        r.entry_start[i] = off;
+        r.entry_len[i] = plist->entries[i].len;
+        off += plist->entries[i].len;
+    }
+
+    //Carve the region into the biggest naturally-aligned blocks that fit
+    for (unsigned i = 0; i < NUM_ORDERS; i++) r.free_head[i] = NIL;
+    uint32_t blk = 0;
+    while (blk < r.nblocks) {
+        unsigned order = AXIDMA_ARENA_MAX_ORDER;
+        while (order > AXIDMA_ARENA_MIN_ORDER && ((blk & (BLOCKS(order) - 1)) || blk + BLOCKS(order) > r.nblocks)) {
+            order--;
+        }
+        free_list_push(&r, blk, order);
+        blk += BLOCKS(order);
+    }
+
+    pthread_mutex_lock(&a->lock);
+    region *tmp = realloc(a->regions, (a->num_regions + 1) * sizeof(region));
+    if (!tmp) {
+        pthread_mutex_unlock(&a->lock);
+        perror("Could not grow arena");
+        region_free(&r);
+        return -1;
+    }
+    a->regions = tmp;
+    a->regions[a->num_regions++] = r;
+    a->total_bytes += (size_t) r.nblocks * AXIDMA_ARENA_MIN_SIZE;
+    a->free_bytes += (size_t) r.nblocks * AXIDMA_ARENA_MIN_SIZE;
+    pthread_mutex_unlock(&a->lock);
+
+    return 0;
+}
+
+//Works out the physical segments for a buffer. Returns -1 if the physlist
+//is too chopped up to fit in AXIDMA_ARENA_MAX_SEGS
+static int fill_segs(region const *r, axidma_arena_buf *b) {
+    size_t off = (char *) b->base - r->buf;
+    unsigned left = b->size;
+
+    //Binary search for the entry holding the first byte
+    unsigned lo = 0, hi = r->num_entries - 1;
+    while (lo < hi) {
+        unsigned mid = (lo + hi + 1) / 2;
+        if (r->entry_start[mid] <= off) lo = mid;
+        else hi = mid - 1;
+    }
+
+    b->num_segs = 0;
+    for (unsigned i = lo; left > 0; i++) {
+        size_t in_entry = off - r->entry_start[i];
+        unsigned n = r->entry_len[i] - in_entry;
+        if (n > left) n = left;
+        uint64_t addr = r->entry_phys[i] + in_entry;
+
+        //Glue together entries that happen to be physically contiguous
+        axidma_arena_seg *last = b->num_segs ? &b->segs[b->num_segs - 1] : NULL;
+        if (last && last->addr + last->len == addr) {
+            last->len += n;
+        } else if (b->num_segs == AXIDMA_ARENA_MAX_SEGS) {
+            return -1;
+        } else {
+            b->segs[b->num_segs].addr = addr;
+            b->segs[b->num_segs].len = n;
+            b->num_segs++;
+        }
+
+        off += n;
+        left -= n;
+    }
+
+    return 0;
+}
+
+//Puts a block back on the free lists, merging it with its buddies. Call with
+//the lock held
+static void release_block(axidma_arena *a, region *r, uint32_t blk, unsigned order) {
+    a->free_bytes += 1U << order;
+    r->state[blk] = 0;
+
+    while (order < AXIDMA_ARENA_MAX_ORDER) {
+        uint32_t buddy = blk ^ BLOCKS(order);
+        //The merged block might run off the end of the region
+        if ((blk & ~(BLOCKS(order + 1) - 1)) + BLOCKS(order + 1) > r->nblocks) break;
+        if (r->state[buddy] != (BLOCK_FREE | order)) break;
+
+        free_list_remove(r, buddy, order);
+        if (buddy < blk) blk = buddy;
+        order++;
+    }
+
+    free_list_push(r, blk, order);
+}
+
+int axidma_arena_alloc(axidma_arena *a, unsigned sz, axidma_arena_buf *out) {
+    if (sz > AXIDMA_ARENA_MAX_SIZE) {
+        fprintf(stderr, "axidma_arena_alloc: %u bytes is bigger than the largest buffer size\n", sz);
+        return -1;
+    }
+
+    unsigned want = AXIDMA_ARENA_MIN_ORDER;
+    while ((1U << want) < sz) want++;
+
+    pthread_mutex_lock(&a->lock);
+    for (unsigned ri = 0; ri < a->num_regions; ri++) {
+        region *r = &a->regions[ri];
+
+        //Smallest free block that's big enough
+        unsigned order;
+        for (order = want; order <= AXIDMA_ARENA_MAX_ORDER; order++) {
+            if (r->free_head[order - AXIDMA_ARENA_MIN_ORDER] != NIL) break;
+        }
+        if (order > AXIDMA_ARENA_MAX_ORDER) continue;
+
+        uint32_t blk = r->free_head[order - AXIDMA_ARENA_MIN_ORDER];
+        free_list_remove(r, blk, order);
+
+        //Split off the top halves until it's the right size
+        while (order > want) {
+            order--;
+            free_list_push(r, blk + BLOCKS(order), order);
+        }
+        r->state[blk] = BLOCK_USED | want;
+        a->free_bytes -= 1U << want;
+
+        out->base = r->base + (size_t) blk * AXIDMA_ARENA_MIN_SIZE;
+        out->size = 1U << want;
+        out->region = ri;
+        out->block = blk;
+        if (fill_segs(r, out) < 0) {
+            release_block(a, r, blk, want);
+            pthread_mutex_unlock(&a->lock);
+            fprintf(stderr, "axidma_arena_alloc: physlist is too fragmented\n");
+            return -1;
+        }
+
+        pthread_mutex_unlock(&a->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    return -1; //Out of space. Not worth a print; the caller can try again later
+}
+
+void axidma_arena_free(axidma_arena *a, axidma_arena_buf const *b) {
+    if (!b) return;
+
+    pthread_mutex_lock(&a->lock);
+    region *r = (b->region < a->num_regions) ? &a->regions[b->region] : NULL;
+    unsigned order = 0;
+    while (order < 32 && (1U << order) < b->size) order++;
+
+    //Catch double frees and made-up buffers before they wreck the free lists
+    if (!r || b->block >= r->nblocks || r->state[b->block] != (BLOCK_USED | order)) {
+        pthread_mutex_unlock(&a->lock);
+        fprintf(stderr, "axidma_arena_free: invalid buffer (double free?)\n");
+        return;
+    }
+
+    release_block(a, r, b->block, order);
+    pthread_mutex_unlock(&a->lock);
+}
+
+axidma_arena_stats axidma_arena_get_stats(axidma_arena *a) {
+    axidma_arena_stats ret = {0, 0, 0};
+
+    pthread_mutex_lock(&a->lock);
+    ret.total_bytes = a->total_bytes;
+    ret.free_bytes = a->free_bytes;
+    for (unsigned ri = 0; ri < a->num_regions; ri++) {
+        for (int i = NUM_ORDERS - 1; i >= 0; i--) {
+            if (a->regions[ri].free_head[i] == NIL) continue;
+            unsigned sz = 1U << (i + AXIDMA_ARENA_MIN_ORDER);
+            if (sz > ret.largest_free) ret.largest_free = sz;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    return ret;
+}
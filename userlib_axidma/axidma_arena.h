@@ -0,0 +1,94 @@
+#ifndef AXIDMA_ARENA_H
+#define AXIDMA_ARENA_H 1
+
+//A buddy allocator that hands out DMA-ready buffers from one or more big
+//pinned regions. Pin (or model) a few large regions once at startup, give
+//them to an arena, and then allocate and free packet buffers as often as you
+//like without going back to the kernel.
+//
+//Every buffer comes back with its physical segments already worked out, so
+//it can go straight into an sg_list with axidma_add_arena_buf (see axidma.h).
+//
+//Buffers are rounded up to a power of two between AXIDMA_ARENA_MIN_SIZE and
+//AXIDMA_ARENA_MAX_SIZE, and are always 64-byte aligned. Freed buffers are
+//merged with their buddies, so the arena doesn't fragment over time.
+//
+//All functions are thread-safe.
+//
+//Usage:
+//    axidma_arena *a = axidma_arena_new();
+//    pin_buf(fd, big_buf, big_sz, &h, &plist);
+//    axidma_arena_add_region(a, big_buf, big_sz, &plist);
+//
+//    axidma_arena_buf b;
+//    if (axidma_arena_alloc(a, 1500, &b) == 0) {
+//        ... use b.base, or axidma_add_arena_buf(lst, &b, 1500) ...
+//        axidma_arena_free(a, &b);
+//    }
+//
+//    axidma_arena_del(a); //Then unpin big_buf
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pinner.h"
+
+#define AXIDMA_ARENA_MIN_ORDER 6
+#define AXIDMA_ARENA_MAX_ORDER 16
+#define AXIDMA_ARENA_MIN_SIZE (1U << AXIDMA_ARENA_MIN_ORDER)
+#define AXIDMA_ARENA_MAX_SIZE (1U << AXIDMA_ARENA_MAX_ORDER)
+
+//Worst case: a maximum-size buffer that starts partway through a page
+#define AXIDMA_ARENA_MAX_SEGS (AXIDMA_ARENA_MAX_SIZE / 4096 + 1)
+
+typedef struct axidma_arena axidma_arena;
+
+typedef struct {
+    uint64_t addr;
+    unsigned len;
+} axidma_arena_seg;
+
+//Describes one allocated buffer. It's just data, so copy it around as you
+//please, but only free it once
+typedef struct {
+    void *base; //User virtual address
+    unsigned size; //Actual size, which is at least what you asked for
+
+    //Physically contiguous pieces of the buffer, in order
+    unsigned num_segs;
+    axidma_arena_seg segs[AXIDMA_ARENA_MAX_SEGS];
+
+    //Used by the arena to find its way back when you free this
+    unsigned region;
+    unsigned block;
+} axidma_arena_buf;
+
+//Makes a new, empty arena. Returns NULL on error
+axidma_arena *axidma_arena_new(void);
+
+//Frees the arena's bookkeeping. Doesn't touch the regions themselves, so
+//unpin them afterwards. Any buffers still allocated become invalid
+void axidma_arena_del(axidma_arena *a);
+
+//Adds a pinned region to the arena. plist is what pin_buf (or
+//axidma_model_add_region) gave you for buf; it is only read during this
+//call. Returns 0 on success, -1 on error
+int axidma_arena_add_region(axidma_arena *a, void *buf, size_t len, struct pinner_physlist const *plist);
+
+//Allocates a buffer of at least sz bytes and fills in *out. Returns 0 on
+//success, or -1 if sz is too big or the arena is out of space
+int axidma_arena_alloc(axidma_arena *a, unsigned sz, axidma_arena_buf *out);
+
+//Gives a buffer back to the arena
+void axidma_arena_free(axidma_arena *a, axidma_arena_buf const *b);
+
+//Bytes currently free in the arena, and the biggest single buffer you could
+//allocate right now
+typedef struct {
+    size_t total_bytes;
+    size_t free_bytes;
+    unsigned largest_free;
+} axidma_arena_stats;
+
+axidma_arena_stats axidma_arena_get_stats(axidma_arena *a);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_private.h"
+#include "axidma_batch.h"
+
+//One half of the staging area
+typedef struct {
+    sg_list *lst;
+    struct pinner_physlist sg_plist; //Just this half's piece of the user's physlists
+    struct pinner_physlist data_plist;
+    uint64_t head_phys; //Where this half's first descriptor always goes
+    unsigned data_cap;
+
+    unsigned records;
+    unsigned bytes;
+    unsigned eofs; //Packets that end in this half
+    int ends_on_eof; //Whether the last record had EOF
+    uint64_t first_ns; //When the first record went in
+    int in_flight;
+} half;
+
+struct axidma_batch {
+    axidma_ctx *ctx;
+    unsigned max_bytes;
+    unsigned max_records;
+    uint64_t max_delay_ns;
+    int use_irq;
+
+    half halves[2];
+    unsigned cur; //The half we're filling
+
+    axidma_batch_stats stats;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned physlist_len(struct pinner_physlist const *plist) {
+    unsigned len = 0;
+    for (unsigned i = 0; i < plist->num_entries; i++) len += plist->entries[i].len;
+    return len;
+}
+
+static void reset_half(half *h) {
+    axidma_clear_list(h->lst);
+    h->records = 0;
+    h->bytes = 0;
+    h->eofs = 0;
+    h->ends_on_eof = 0;
+    h->in_flight = 0;
+}
+
+axidma_batch *axidma_batch_new(axidma_ctx *ctx,
+                               void *sg_buf, struct pinner_physlist const *sg_plist,
+                               void *data_buf, struct pinner_physlist const *data_plist,
+                               axidma_batch_cfg const *cfg)
+{
+    if (!ctx || !sg_buf || !sg_plist || !data_buf || !data_plist || !cfg) {
+        fprintf(stderr, "axidma_batch_new: Invalid function argument\n");
+        return NULL;
+    }
+
+    //The first batch tells the DMA where to start, and it only listens while
+    //the channel is stopped
+    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
+    if (!(regs->MM2S_DMASR & DMASR_HALTED)) {
+        fprintf(stderr, "axidma_batch_new: MM2S channel is already running. Reset the DMA first\n");
+        return NULL;
+    }
+
+    axidma_batch *b = calloc(1, sizeof(axidma_batch));
+    if (!b) {
+        perror("Could not allocate batch");
+        return NULL;
+    }
+    b->ctx = ctx;
+    b->max_bytes = cfg->max_bytes;
+    b->max_records = cfg->max_records;
+    if (b->max_records == 0 || b->max_records > AXIDMA_BATCH_MAX_RECORDS) {
+        b->max_records = AXIDMA_BATCH_MAX_RECORDS;
+    }
+    b->max_delay_ns = (uint64_t) cfg->max_delay_us * 1000;
+    b->use_irq = cfg->use_irq;
+
+    //Descriptors have to stay 64-byte aligned, so split on a 64-byte boundary
+    unsigned sg_half = (physlist_len(sg_plist) / 2) & ~63U;
+    unsigned data_half = physlist_len(data_plist) / 2;
+    if (sg_half < sizeof(sg_descriptor) || data_half == 0) {
+        fprintf(stderr, "axidma_batch_new: staging buffers are too small\n");
+        goto axidma_batch_new_error;
+    }
+
+    for (unsigned i = 0; i < 2; i++) {
+        half *h = &b->halves[i];
+        axidma_slice_physlist(sg_plist, i * sg_half, sg_half, &h->sg_plist);
+        h->data_cap = axidma_slice_physlist(data_plist, i * data_half, data_half, &h->data_plist);
+        h->lst = axidma_list_new((char *) sg_buf + i * sg_half, &h->sg_plist,
+                                 (char *) data_buf + i * data_half, &h->data_plist);
+        if (!h->lst) goto axidma_batch_new_error;
+        h->lst->is_s2mm = 0;
+        axidma_list_set_coherent(h->lst, cfg->sg_coherent, cfg->data_coherent);
+        h->head_phys = virt_to_phys(&h->sg_plist, 0);
+    }
+
+    return b;
+
+    axidma_batch_new_error:
+    axidma_batch_del(b);
+    return NULL;
+}
+
+void axidma_batch_del(axidma_batch *b) {
+    if (!b) return;
+    axidma_list_del(b->halves[0].lst);
+    axidma_list_del(b->halves[1].lst);
+    free(b);
+}
+
+//Waits for the DMA to finish with a half that was sent
+static int wait_half(axidma_batch *b, half *h) {
+    if (!h->in_flight) return 0;
+
+    if (!axidma_entry_done(h->lst, h->lst->sentinel.prev)) {
+        b->stats.waits++;
+        //The interrupt comes at the last EOF, so if the batch ended partway
+        //through a packet, we have to spin for the rest
+        if (axidma_wait_list(b->ctx, h->lst, b->use_irq && h->ends_on_eof) < 0) return -1;
+    }
+
+    h->in_flight = 0;
+    return 0;
+}
+
+//Sends the half we're filling, and starts filling the other one
+static int send_half(axidma_batch *b, uint64_t *reason) {
+    half *h = &b->halves[b->cur];
+    half *other = &b->halves[b->cur ^ 1];
+
+    if (h->records == 0) return 0;
+
+    //Only one half is ever out with the DMA, so the channel is idle once this
+    //returns. That's what lets us change the interrupt threshold safely
+    if (wait_half(b, other) < 0) return -1;
+
+    //The last descriptor leads into the other half, which is how the DMA
+    //finds its way there after the next taildesc write
+    axidma_write_list(h->lst, 0, other->head_phys);
+    if (h->eofs) axidma_set_irq_threshold(b->ctx, 0, h->eofs);
+    axidma_kick(b->ctx, 0, axidma_list_head_phys(h->lst), axidma_list_tail_phys(h->lst));
+    h->in_flight = 1;
+
+    b->stats.batches++;
+    if (reason) (*reason)++;
+
+    reset_half(other);
+    b->cur ^= 1;
+    return 0;
+}
+
+static int deadline_passed(axidma_batch *b) {
+    half *h = &b->halves[b->cur];
+    return b->max_delay_ns && h->records && now_ns() - h->first_ns >= b->max_delay_ns;
+}
+
+int axidma_batch_send(axidma_batch *b, void const *data, unsigned len, int flags) {
+    if (!b || !data || !len) {
+        fprintf(stderr, "axidma_batch_send: Invalid function argument\n");
+        return -1;
+    }
+    if (len > b->halves[b->cur].data_cap) {
+        fprintf(stderr, "axidma_batch_send: %u byte record won't fit in the staging area\n", len);
+        return -1;
+    }
+
+    if (deadline_passed(b) && send_half(b, &b->stats.by_deadline) < 0) return -1;
+
+    half *h = &b->halves[b->cur];
+    sg_entry *before = h->lst->sentinel.prev;
+    add_entry_code rc = axidma_add_entry(h->lst, len);
+    if (rc == ADD_ENTRY_SG_OOM || rc == ADD_ENTRY_BUF_OOM) {
+        //No room left in this half. Send it and try again in the other one
+        if (send_half(b, &b->stats.by_size) < 0) return -1;
+        h = &b->halves[b->cur];
+        before = h->lst->sentinel.prev;
+        rc = axidma_add_entry(h->lst, len);
+    }
+    if (rc != ADD_ENTRY_SUCCESS) {
+        fprintf(stderr, "axidma_batch_send: could not add record to the staging area\n");
+        return -1;
+    }
+
+    //The record might have been split over a few descriptors
+    sg_entry *first = before->next;
+    sg_entry *last = h->lst->sentinel.prev;
+    memcpy(first->data_virt, data, len);
+    first->is_SOF = (flags & AXIDMA_BATCH_SOF) != 0;
+    last->is_EOF = (flags & AXIDMA_BATCH_EOF) != 0;
+
+    if (h->records == 0) h->first_ns = now_ns();
+    h->records++;
+    h->bytes += len;
+    h->ends_on_eof = last->is_EOF;
+    if (last->is_EOF) h->eofs++;
+    b->stats.records++;
+    b->stats.bytes += len;
+
+    if (h->records >= b->max_records || (b->max_bytes && h->bytes >= b->max_bytes)) {
+        return send_half(b, &b->stats.by_size);
+    }
+    return 0;
+}
+
+int axidma_batch_poll(axidma_batch *b) {
+    if (deadline_passed(b)) return send_half(b, &b->stats.by_deadline);
+    return 0;
+}
+
+int axidma_batch_flush(axidma_batch *b) {
+    return send_half(b, NULL);
+}
+
+int axidma_batch_drain(axidma_batch *b) {
+    if (send_half(b, NULL) < 0) return -1;
+    if (wait_half(b, &b->halves[0]) < 0) return -1;
+    return wait_half(b, &b->halves[1]);
+}
+
+axidma_batch_stats axidma_batch_get_stats(axidma_batch *b) {
+    return b->stats;
+}
@@ -0,0 +1,100 @@
+#ifndef AXIDMA_BATCH_H
+#define AXIDMA_BATCH_H 1
+
+//Batches lots of small MM2S sends into a few big descriptor chains.
+//
+//Sending a small record on its own costs a doorbell and an interrupt, which
+//can easily take longer than moving the data. Instead, axidma_batch_send
+//copies each record into a pinned staging area, and the whole lot goes out as
+//one chain (one taildesc write, one interrupt) once enough has piled up, or
+//once the oldest record has waited long enough.
+//
+//The staging area is split in two halves: one is being sent while you fill
+//the other.
+//
+//    axidma_batch_cfg cfg = {
+//        .max_bytes = 64 << 10, .max_records = 128, .max_delay_us = 50
+//    };
+//    axidma_batch *b = axidma_batch_new(ctx, sg_buf, &sg_plist, data_buf, &data_plist, &cfg);
+//    for (...) {
+//        axidma_batch_send(b, rec, rec_len, AXIDMA_BATCH_PACKET);
+//        axidma_batch_poll(b); //Somewhere in your loop, for the deadline
+//    }
+//    axidma_batch_drain(b);
+//    axidma_batch_del(b);
+//
+//There's no timer thread: the deadline is only checked in axidma_batch_send
+//and axidma_batch_poll, so call one of them regularly if you use it.
+//
+//The batch owns the MM2S channel while it exists. Not thread-safe.
+
+#include <stdint.h>
+#include "axidma.h"
+
+//What a record is, in AXI stream terms. Most people want AXIDMA_BATCH_PACKET
+//(every record is its own packet). To build one packet out of several
+//records, pass AXIDMA_BATCH_SOF on the first, 0 on the middle ones and
+//AXIDMA_BATCH_EOF on the last
+#define AXIDMA_BATCH_SOF 1
+#define AXIDMA_BATCH_EOF 2
+#define AXIDMA_BATCH_PACKET (AXIDMA_BATCH_SOF | AXIDMA_BATCH_EOF)
+
+//The AXI DMA can only count up to 255 packets per interrupt
+#define AXIDMA_BATCH_MAX_RECORDS 255
+
+typedef struct {
+    unsigned max_bytes; //Send once this many bytes are queued. 0 means as much as fits
+    unsigned max_records; //Send once this many records are queued. 0 means
+                          //AXIDMA_BATCH_MAX_RECORDS, which is also the most allowed
+    unsigned max_delay_us; //Send once the oldest record has waited this long. 0
+                           //means no deadline
+    int use_irq; //Sleep on the interrupt (instead of spinning) when waiting for
+                 //the DMA to finish with a half
+    int sg_coherent; //Skip cache maintenance on the staging buffers. See
+    int data_coherent; //axidma_list_set_coherent
+} axidma_batch_cfg;
+
+typedef struct axidma_batch axidma_batch;
+
+//Makes a batcher. The SG and data buffers (pinned, as for axidma_list_new)
+//are each split in half between the two staging halves. The MM2S channel
+//must be halted. Returns NULL on error
+axidma_batch *axidma_batch_new(axidma_ctx *ctx,
+                               void *sg_buf, struct pinner_physlist const *sg_plist,
+                               void *data_buf, struct pinner_physlist const *data_plist,
+                               axidma_batch_cfg const *cfg);
+
+//Frees the batcher. Anything not yet sent is dropped, so call
+//axidma_batch_drain first
+void axidma_batch_del(axidma_batch *b);
+
+//Copies a record into the staging area, and sends the batch if it's now
+//full or too old. flags is some combination of AXIDMA_BATCH_SOF and
+//AXIDMA_BATCH_EOF. Returns 0 on success, or -1 on error (the DMA failed, or
+//the record is too big for half the staging area)
+int axidma_batch_send(axidma_batch *b, void const *data, unsigned len, int flags);
+
+//Sends the batch if its deadline has passed. Returns 0 on success, -1 if the
+//DMA failed
+int axidma_batch_poll(axidma_batch *b);
+
+//Sends whatever is queued right now. Returns 0 on success, -1 if the DMA
+//failed
+int axidma_batch_flush(axidma_batch *b);
+
+//Sends whatever is queued and waits for the DMA to finish all of it.
+//Returns 0 on success, -1 if the DMA failed
+int axidma_batch_drain(axidma_batch *b);
+
+typedef struct {
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t batches; //Chains sent, i.e. taildesc writes
+    uint64_t by_size; //Batches sent because they hit max_bytes, max_records or ran out of room
+    uint64_t by_deadline; //Batches sent because of max_delay_us
+    uint64_t waits; //Times we had to wait for the DMA to give a half back
+} axidma_batch_stats;
+
+axidma_batch_stats axidma_batch_get_stats(axidma_batch *b);
+
+#endif
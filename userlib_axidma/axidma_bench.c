@@ -0,0 +1,496 @@
+//Loopback benchmark for userlib_axidma. Sends chains of packets out on MM2S,
+//receives them on S2MM, and reports throughput, descriptors per second and
+//per-chain latency percentiles over a sweep of packet sizes, chain lengths
+//and completion modes (sleep on the interrupt, or spin on the descriptors).
+//
+//By default it runs against the software model in axidma_model.h, which makes
+//the numbers comparable from one commit to the next on any machine. With
+//--uio, it runs on a real AXI DMA whose MM2S stream is looped back to S2MM in
+//the PL (needs the axidma and pinner modules).
+//
+//The model runs in a thread of its own, so give it a spare core. With only one
+//CPU, poll mode just measures how long the scheduler lets the spinning thread
+//hog it.
+//
+//    ./axidma_bench [options]
+//        --model           Use the software model (default)
+//        --uio PATH        Use the AXI DMA at PATH, e.g. /dev/uio0
+//        --coherent        With --uio, pin the buffers coherently and skip the
+//                          library's cache maintenance. Only use this if the
+//                          DMA is on a coherent port (S_AXI_HPC with snooping)
+//        --flush           With --uio, also flush the whole buffers through the
+//                          pinner around every chain, which is how this used
+//                          to be done. The library already cleans and
+//                          invalidates what each transfer needs, so this is
+//                          only here to compare the two
+//        --sg-window W:OFF:LEN
+//                          With --uio, also run everything with the
+//                          descriptors in on-chip memory: LEN bytes at OFF in
+//                          mpsoc_axiregs window W (see axidma_onchip.h), split
+//                          between the two channels. The sg_mem column says
+//                          which run is which. Small packets and long chains
+//                          show the difference best, e.g.
+//                          --sizes 64,256 --chains 1,8,64
+//        --sizes LIST      Packet sizes in bytes (default 64,256,1024,4096,16384,65536)
+//        --chains LIST     Packets per chain (default 1,8,64)
+//        --modes LIST      irq and/or poll (default irq,poll)
+//        --iters N         Chains per measurement (default 200)
+//        --json            Print JSON instead of CSV
+//        -o FILE           Write results to FILE instead of stdout
+//
+//With --uio, the axidma module's own interrupt latency histogram is cleared
+//at the start and printed to stderr at the end, so you can check it against
+//the latencies here. It lives in /sys/axidma/irq_latency.
+//
+//LISTs are comma-separated. Build with something like
+//    gcc -O2 -o axidma_bench axidma_bench.c axidma.c axidma_model.c axidma_onchip.c pinner_fns.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_model.h"
+#include "axidma_onchip.h"
+#include "pinner.h"
+#include "pinner_fns.h"
+
+#define SG_BYTES (1 << 20)
+#define DATA_BYTES (PINNER_MAX_PAGES << 12)
+#define WARMUP_ITERS 10
+#define MODEL_FIFO_BYTES (256 << 10)
+#define MAX_LIST 32
+#define IRQ_HIST_PATH "/sys/axidma/irq_latency"
+
+typedef struct {
+    unsigned vals[MAX_LIST];
+    unsigned n;
+} uint_list;
+
+//Everything the benchmark needs for one direction
+typedef struct {
+    char *sg;
+    char *data;
+    struct pinner_physlist sg_plist;
+    struct pinner_physlist data_plist;
+    struct pinner_handle sg_handle;
+    struct pinner_handle data_handle;
+    sg_list *lst; //One of the two below
+    sg_list *ddr_lst;
+
+    //Only with --sg-window
+    char *onchip_sg;
+    struct pinner_physlist onchip_plist;
+    sg_list *onchip_lst;
+} side;
+
+static side tx, rx; //physlists are too big for the stack
+static int sg_onchip; //Whether tx.lst and rx.lst are the on-chip ones
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_list(char const *s, uint_list *l) {
+    l->n = 0;
+    while (*s) {
+        char *end;
+        unsigned long v = strtoul(s, &end, 0);
+        if (end == s || l->n == MAX_LIST) return -1;
+        l->vals[l->n++] = v;
+        s = end;
+        if (*s == ',') s++;
+    }
+    return l->n ? 0 : -1;
+}
+
+static int cmp_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t const *sorted, unsigned n, double p) {
+    unsigned i = (unsigned) (p * (n - 1) + 0.5);
+    return sorted[i] / 1e3;
+}
+
+static unsigned count_descs(sg_list *lst) {
+    unsigned n = 0;
+    for (sg_entry *e = lst->sentinel.next; e != &(lst->sentinel); e = e->next) n++;
+    return n;
+}
+
+//Builds chains of chain_len packets of pkt_sz bytes in both lists. Returns 0
+//on success, -1 if they don't fit
+static int build_lists(unsigned pkt_sz, unsigned chain_len) {
+    axidma_clear_list(tx.lst);
+    axidma_clear_list(rx.lst);
+
+    for (unsigned i = 0; i < chain_len; i++) {
+        if (axidma_add_entry(tx.lst, pkt_sz) != ADD_ENTRY_SUCCESS) return -1;
+        if (axidma_add_entry(rx.lst, pkt_sz) != ADD_ENTRY_SUCCESS) return -1;
+
+        unsigned char *buf = axidma_last_buf(tx.lst);
+        for (unsigned j = 0; j < pkt_sz; j++) buf[j] = i * 7 + j;
+        memset(axidma_last_buf(rx.lst), 0, pkt_sz);
+    }
+    return 0;
+}
+
+//Sends one chain and waits for it to come back. Returns -1 on error
+static int run_chain(axidma_ctx *ctx, int pinner_fd, int use_irq) {
+    //On-chip descriptors are mapped uncached, so they never need flushing
+    if (pinner_fd != -1) {
+        if (!sg_onchip) flush_buf_cache(pinner_fd, &tx.sg_handle);
+        flush_buf_cache(pinner_fd, &tx.data_handle);
+        if (!sg_onchip) flush_buf_cache(pinner_fd, &rx.sg_handle);
+    }
+
+    //Get S2MM going first so MM2S never has to wait for it
+    axidma_s2mm_transfer(ctx, rx.lst, 0);
+    axidma_mm2s_transfer(ctx, tx.lst, 0);
+
+    if (axidma_wait_list(ctx, rx.lst, use_irq) < 0) return -1;
+    if (axidma_wait_list(ctx, tx.lst, 0) < 0) return -1;
+
+    if (pinner_fd != -1) {
+        if (!sg_onchip) flush_buf_cache(pinner_fd, &rx.sg_handle);
+        flush_buf_cache(pinner_fd, &rx.data_handle);
+    }
+    return 0;
+}
+
+//Checks that every packet came back whole and unchanged
+static int verify(void) {
+    s2mm_buf t, r;
+    unsigned n = 0;
+    for (;;) {
+        t = axidma_dequeue_s2mm_buf(tx.lst);
+        r = axidma_dequeue_s2mm_buf(rx.lst);
+        if (t.code == END_OF_LIST || r.code == END_OF_LIST) break;
+        if (t.code != TRANSFER_SUCCESS || r.code != TRANSFER_SUCCESS) {
+            fprintf(stderr, "Packet %u: transfer failed\n", n);
+            return -1;
+        }
+        if (t.len != r.len || memcmp(t.base, r.base, t.len)) {
+            fprintf(stderr, "Packet %u: received data doesn't match\n", n);
+            return -1;
+        }
+        n++;
+    }
+    if (t.code != r.code) {
+        fprintf(stderr, "Sent and received different numbers of packets\n");
+        return -1;
+    }
+    return 0;
+}
+
+//Writing anything clears the driver's histogram
+static void clear_irq_hist(void) {
+    FILE *fp = fopen(IRQ_HIST_PATH, "w");
+    if (!fp) {
+        perror("Could not open " IRQ_HIST_PATH);
+        return;
+    }
+    fputs("0\n", fp);
+    fclose(fp);
+}
+
+static void print_irq_hist(void) {
+    char line[128];
+    FILE *fp = fopen(IRQ_HIST_PATH, "r");
+    if (!fp) {
+        perror("Could not open " IRQ_HIST_PATH);
+        return;
+    }
+    fprintf(stderr, "Driver IRQ-to-userspace latency (bucket upper bound in ns, count):\n");
+    while (fgets(line, sizeof(line), fp)) fprintf(stderr, "    %s", line);
+    fclose(fp);
+}
+
+static int setup_side(side *s, axidma_model *m, int pinner_fd, int coherent) {
+    s->sg = aligned_alloc(4096, SG_BYTES);
+    s->data = aligned_alloc(4096, DATA_BYTES);
+    if (!s->sg || !s->data) {
+        perror("Could not allocate buffers");
+        return -1;
+    }
+    //Touch everything so page faults don't end up in the measurements
+    memset(s->sg, 0, SG_BYTES);
+    memset(s->data, 0, DATA_BYTES);
+
+    if (m) {
+        if (axidma_model_add_region(m, s->sg, SG_BYTES, &s->sg_plist) < 0) return -1;
+        if (axidma_model_add_region(m, s->data, DATA_BYTES, &s->data_plist) < 0) return -1;
+    } else {
+        int (*pin)(int, void *, unsigned, struct pinner_handle *, struct pinner_physlist *);
+        pin = coherent ? pin_buf_coherent : pin_buf;
+        if (pin(pinner_fd, s->sg, SG_BYTES, &s->sg_handle, &s->sg_plist) < 0) return -1;
+        if (pin(pinner_fd, s->data, DATA_BYTES, &s->data_handle, &s->data_plist) < 0) return -1;
+    }
+
+    s->ddr_lst = axidma_list_new(s->sg, &s->sg_plist, s->data, &s->data_plist);
+    s->lst = s->ddr_lst;
+    if (!s->lst) return -1;
+    axidma_list_set_coherent(s->lst, coherent, coherent);
+    return 0;
+}
+
+//Gives a side its own piece of the on-chip window. Both lists share the
+//same data buffer
+static int setup_onchip(side *s, unsigned win, unsigned long off, unsigned long len, int coherent) {
+    s->onchip_sg = axidma_onchip_map(win, off, len, &s->onchip_plist);
+    if (!s->onchip_sg) return -1;
+    s->onchip_lst = axidma_list_new(s->onchip_sg, &s->onchip_plist, s->data, &s->data_plist);
+    if (!s->onchip_lst) return -1;
+    //The on-chip memory is mapped uncached
+    axidma_list_set_coherent(s->onchip_lst, 1, coherent);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char const *uio_path = NULL;
+    char const *out_path = NULL;
+    int do_flush = 0;
+    int coherent = 0;
+    int json = 0;
+    int use_onchip = 0;
+    unsigned onchip_win = 0;
+    long onchip_off = 0, onchip_len = 0;
+    long onchip_half = 0;
+    unsigned iters = 200;
+    uint_list sizes, chains, modes;
+    int ret = 0;
+
+    parse_list("64,256,1024,4096,16384,65536", &sizes);
+    parse_list("1,8,64", &chains);
+    modes.n = 2;
+    modes.vals[0] = 1; //irq
+    modes.vals[1] = 0; //poll
+
+    for (int i = 1; i < argc; i++) {
+        char const *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "--model")) {
+            uio_path = NULL;
+        } else if (!strcmp(argv[i], "--uio") && next) {
+            uio_path = argv[++i];
+        } else if (!strcmp(argv[i], "--flush")) {
+            do_flush = 1;
+        } else if (!strcmp(argv[i], "--coherent")) {
+            coherent = 1;
+        } else if (!strcmp(argv[i], "--sg-window") && next &&
+                   sscanf(next, "%u:%li:%li", &onchip_win, &onchip_off, &onchip_len) == 3)
+        {
+            use_onchip = 1;
+            i++;
+        } else if (!strcmp(argv[i], "--sizes") && next && !parse_list(next, &sizes)) {
+            i++;
+        } else if (!strcmp(argv[i], "--chains") && next && !parse_list(next, &chains)) {
+            i++;
+        } else if (!strcmp(argv[i], "--modes") && next) {
+            modes.n = 0;
+            if (strstr(next, "irq")) modes.vals[modes.n++] = 1;
+            if (strstr(next, "poll")) modes.vals[modes.n++] = 0;
+            i++;
+        } else if (!strcmp(argv[i], "--iters") && next) {
+            iters = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else if (!strcmp(argv[i], "-o") && next) {
+            out_path = argv[++i];
+        } else {
+            fprintf(stderr, "Unrecognized option %s. See the top of axidma_bench.c for usage\n", argv[i]);
+            return -1;
+        }
+    }
+    if (iters == 0 || modes.n == 0) {
+        fprintf(stderr, "Need at least one iteration and one mode\n");
+        return -1;
+    }
+    if (use_onchip) {
+        //Each channel gets half, and it has to stay page-aligned
+        onchip_half = (onchip_len / 2) & ~0xFFFL;
+        if (!uio_path || onchip_off < 0 || onchip_half <= 0) {
+            fprintf(stderr, "--sg-window needs --uio, and at least two pages\n");
+            return -1;
+        }
+    }
+
+    axidma_model *m = NULL;
+    axidma_ctx *ctx = NULL;
+    int pinner_fd = -1;
+    FILE *out = stdout;
+    uint64_t *lat = NULL;
+    int first = 1;
+
+    //pin_buf prints the physlists, so keep results separate if asked to
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror("Could not open output file");
+            return -1;
+        }
+    }
+
+    if (uio_path) {
+        pinner_fd = pinner_open();
+        if (pinner_fd == -1) {
+            ret = -1;
+            goto cleanup;
+        }
+        ctx = axidma_open(uio_path);
+    } else {
+        m = axidma_model_new();
+        if (!m || axidma_model_set_loopback(m, MODEL_FIFO_BYTES) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    //The model is always coherent
+    if (!uio_path) coherent = 1;
+    if (setup_side(&tx, m, pinner_fd, coherent) < 0 || setup_side(&rx, m, pinner_fd, coherent) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    if (use_onchip && (setup_onchip(&tx, onchip_win, onchip_off, onchip_half, coherent) < 0 ||
+                       setup_onchip(&rx, onchip_win, onchip_off + onchip_half, onchip_half, coherent) < 0))
+    {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (m) ctx = axidma_model_ctx(m);
+    if (!ctx) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    lat = malloc(iters * sizeof(uint64_t));
+    if (!lat) {
+        perror("Could not allocate latency array");
+        ret = -1;
+        goto cleanup;
+    }
+
+    char const *backend = uio_path ? "uio" : "model";
+    if (uio_path) clear_irq_hist();
+    if (json) {
+        fprintf(out, "[\n");
+    } else {
+        fprintf(out, "backend,sg_mem,mode,pkt_bytes,chain_len,descs_per_chain,iters,GBps,descs_per_s,lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us\n");
+    }
+
+    for (unsigned si = 0; si < sizes.n; si++) {
+        for (unsigned ci = 0; ci < chains.n; ci++) {
+            for (sg_onchip = 0; sg_onchip <= use_onchip; sg_onchip++) {
+                unsigned pkt_sz = sizes.vals[si];
+                unsigned chain_len = chains.vals[ci];
+                char const *sg_mem = sg_onchip ? "onchip" : "ddr";
+                sg_list *tx_lst = sg_onchip ? tx.onchip_lst : tx.ddr_lst;
+                sg_list *rx_lst = sg_onchip ? rx.onchip_lst : rx.ddr_lst;
+
+                //A running channel ignores curdesc and would carry on from
+                //the old lists' last next_desc, so stop it before moving the
+                //descriptors somewhere else
+                if (tx_lst != tx.lst || rx_lst != rx.lst) {
+                    if (axidma_reset(ctx) < 0) {
+                        ret = -1;
+                        goto cleanup;
+                    }
+                    tx.lst = tx_lst;
+                    rx.lst = rx_lst;
+                }
+
+                if (pkt_sz == 0 || build_lists(pkt_sz, chain_len) < 0) {
+                    fprintf(stderr, "Skipping %u x %u bytes (%s descriptors): doesn't fit in the buffers\n",
+                        chain_len, pkt_sz, sg_mem);
+                    continue;
+                }
+                unsigned descs = count_descs(tx.lst) + count_descs(rx.lst);
+
+                for (unsigned mi = 0; mi < modes.n; mi++) {
+                    int use_irq = modes.vals[mi];
+                    int flush_fd = do_flush ? pinner_fd : -1;
+
+                    //Warm up, and make sure the data actually makes it through
+                    for (unsigned i = 0; i < WARMUP_ITERS; i++) {
+                        if (run_chain(ctx, flush_fd, use_irq) < 0) {
+                            fprintf(stderr, "DMA error during warmup\n");
+                            ret = -1;
+                            goto cleanup;
+                        }
+                    }
+                    if (verify() < 0) {
+                        ret = -1;
+                        goto cleanup;
+                    }
+
+                    uint64_t start = now_ns();
+                    for (unsigned i = 0; i < iters; i++) {
+                        uint64_t t0 = now_ns();
+                        if (run_chain(ctx, flush_fd, use_irq) < 0) {
+                            fprintf(stderr, "DMA error\n");
+                            ret = -1;
+                            goto cleanup;
+                        }
+                        lat[i] = now_ns() - t0;
+                    }
+                    double secs = (now_ns() - start) / 1e9;
+                    qsort(lat, iters, sizeof(uint64_t), cmp_u64);
+
+                    double gbps = (double) pkt_sz * chain_len * iters / secs / 1e9;
+                    double dps = (double) descs * iters / secs;
+                    char const *mode = use_irq ? "irq" : "poll";
+                    if (json) {
+                        fprintf(out, "%s  {\"backend\": \"%s\", \"sg_mem\": \"%s\", \"mode\": \"%s\", \"pkt_bytes\": %u, "
+                            "\"chain_len\": %u, \"descs_per_chain\": %u, \"iters\": %u, \"GBps\": %.4f, \"descs_per_s\": %.0f, "
+                            "\"lat_p50_us\": %.2f, \"lat_p90_us\": %.2f, \"lat_p99_us\": %.2f, \"lat_max_us\": %.2f}",
+                            first ? "" : ",\n", backend, sg_mem, mode, pkt_sz, chain_len, descs, iters, gbps, dps,
+                            percentile_us(lat, iters, 0.5), percentile_us(lat, iters, 0.9),
+                            percentile_us(lat, iters, 0.99), lat[iters - 1] / 1e3
+                        );
+                    } else {
+                        fprintf(out, "%s,%s,%s,%u,%u,%u,%u,%.4f,%.0f,%.2f,%.2f,%.2f,%.2f\n",
+                            backend, sg_mem, mode, pkt_sz, chain_len, descs, iters, gbps, dps,
+                            percentile_us(lat, iters, 0.5), percentile_us(lat, iters, 0.9),
+                            percentile_us(lat, iters, 0.99), lat[iters - 1] / 1e3
+                        );
+                    }
+                    first = 0;
+                    fflush(out);
+                }
+            }
+        }
+    }
+    if (json) fprintf(out, "\n]\n");
+    if (uio_path) print_irq_hist();
+
+    cleanup:
+    free(lat);
+    if (ctx) axidma_close(ctx);
+    axidma_list_del(tx.ddr_lst);
+    axidma_list_del(rx.ddr_lst);
+    axidma_list_del(tx.onchip_lst);
+    axidma_list_del(rx.onchip_lst);
+    axidma_onchip_unmap(tx.onchip_sg, onchip_half);
+    axidma_onchip_unmap(rx.onchip_sg, onchip_half);
+    if (pinner_fd != -1) {
+        if (tx.sg) unpin_buf(pinner_fd, &tx.sg_handle);
+        if (tx.data) unpin_buf(pinner_fd, &tx.data_handle);
+        if (rx.sg) unpin_buf(pinner_fd, &rx.sg_handle);
+        if (rx.data) unpin_buf(pinner_fd, &rx.data_handle);
+        pinner_close(pinner_fd);
+    }
+    axidma_model_del(m);
+    free(tx.sg);
+    free(tx.data);
+    free(rx.sg);
+    free(rx.data);
+    if (out != stdout) fclose(out);
+    return ret;
+}
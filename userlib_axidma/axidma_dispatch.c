@@ -0,0 +1,225 @@
+#define _GNU_SOURCE //pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include "axidma.h"
+#include "axidma_pipeline.h"
+#include "axidma_dispatch.h"
+#include "spsc_ring.h"
+
+//A worker's two rings. Each spsc_ring is already padded out to whole cache
+//lines, so neighbouring workers don't step on each other
+typedef struct {
+    spsc_ring to_worker; //We push, the worker pops
+    spsc_ring from_worker; //The worker pushes, we pop
+} worker_rings;
+
+struct axidma_dispatch {
+    axidma_pipeline *p;
+    unsigned num_slots;
+    unsigned bufs_per_slot;
+
+    unsigned num_workers;
+    worker_rings *rings;
+    axidma_dispatch_fn choose;
+    void *arg;
+    unsigned rr; //Next worker, when dealing round-robin
+
+    axidma_dispatch_buf *bufs; //bufs_per_slot of them for each slot
+    unsigned *nbufs; //How many buffers each slot actually had
+    unsigned *outstanding; //Buffers from each slot not back from the workers yet
+
+    //The slot we're in the middle of handing out (-1 if none), and the next
+    //buffer in it. We stop partway through if a worker's ring fills up
+    int cur_slot;
+    unsigned cur_next;
+
+    axidma_dispatch_stats stats;
+};
+
+axidma_dispatch *axidma_dispatch_new(axidma_pipeline *p, unsigned num_workers, unsigned ring_sz,
+                                     axidma_dispatch_fn choose, void *arg)
+{
+    if (!p || num_workers == 0 || ring_sz == 0) {
+        fprintf(stderr, "axidma_dispatch_new: Invalid function argument\n");
+        return NULL;
+    }
+    if (!axidma_pipeline_is_s2mm(p)) {
+        fprintf(stderr, "axidma_dispatch_new: only S2MM pipelines can be dispatched\n");
+        return NULL;
+    }
+
+    axidma_dispatch *d = calloc(1, sizeof(axidma_dispatch));
+    if (!d) {
+        perror("Could not allocate dispatcher");
+        return NULL;
+    }
+    d->p = p;
+    d->num_slots = axidma_pipeline_num_slots(p);
+    d->bufs_per_slot = axidma_pipeline_bufs_per_slot(p);
+    d->num_workers = num_workers;
+    d->choose = choose;
+    d->arg = arg;
+    d->cur_slot = -1;
+
+    unsigned total = d->num_slots * d->bufs_per_slot;
+    d->bufs = calloc(total, sizeof(axidma_dispatch_buf));
+    d->nbufs = calloc(d->num_slots, sizeof(unsigned));
+    d->outstanding = calloc(d->num_slots, sizeof(unsigned));
+    d->rings = aligned_alloc(SPSC_CACHE_LINE, num_workers * sizeof(worker_rings));
+    if (!d->bufs || !d->nbufs || !d->outstanding || !d->rings) {
+        perror("Could not allocate dispatcher");
+        goto axidma_dispatch_new_error;
+    }
+    memset(d->rings, 0, num_workers * sizeof(worker_rings));
+
+    for (unsigned i = 0; i < num_workers; i++) {
+        //The return ring can hold every buffer there is, so putting a buffer
+        //back never has to wait
+        if (spsc_ring_init(&d->rings[i].to_worker, ring_sz) < 0 ||
+            spsc_ring_init(&d->rings[i].from_worker, total) < 0)
+        {
+            perror("Could not allocate worker rings");
+            goto axidma_dispatch_new_error;
+        }
+    }
+
+    return d;
+
+    axidma_dispatch_new_error:
+    axidma_dispatch_del(d);
+    return NULL;
+}
+
+void axidma_dispatch_del(axidma_dispatch *d) {
+    if (!d) return;
+    if (d->rings) {
+        for (unsigned i = 0; i < d->num_workers; i++) {
+            spsc_ring_destroy(&d->rings[i].to_worker);
+            spsc_ring_destroy(&d->rings[i].from_worker);
+        }
+    }
+    free(d->rings);
+    free(d->bufs);
+    free(d->nbufs);
+    free(d->outstanding);
+    free(d);
+}
+
+//Gives slots back to the DMA once the workers are done with all their buffers
+static void reclaim(axidma_dispatch *d) {
+    for (unsigned i = 0; i < d->num_workers; i++) {
+        axidma_dispatch_buf *b;
+        while ((b = spsc_ring_pop(&d->rings[i].from_worker)) != NULL) {
+            d->stats.returned++;
+            if (--d->outstanding[b->slot] == 0) {
+                axidma_pipeline_release(d->p, b->slot);
+                d->stats.slots_released++;
+            }
+        }
+    }
+}
+
+//Reads the buffers out of a freshly filled slot and decides who gets them
+static void take_slot(axidma_dispatch *d, unsigned slot) {
+    sg_list *lst = axidma_pipeline_slot(d->p, slot);
+    axidma_dispatch_buf *bufs = &d->bufs[slot * d->bufs_per_slot];
+    unsigned n = 0;
+
+    while (n < d->bufs_per_slot) {
+        s2mm_buf buf = axidma_dequeue_s2mm_buf(lst);
+        if (buf.code == END_OF_LIST) break;
+
+        bufs[n].buf = buf;
+        bufs[n].slot = slot;
+        if (d->choose) {
+            bufs[n].worker = d->choose(&bufs[n].buf, d->arg) % d->num_workers;
+        } else {
+            bufs[n].worker = d->rr;
+            d->rr = (d->rr + 1) % d->num_workers;
+        }
+        n++;
+    }
+
+    d->nbufs[slot] = n;
+    d->outstanding[slot] = n;
+    d->cur_slot = slot;
+    d->cur_next = 0;
+
+    if (n == 0) {
+        //Shouldn't happen, but don't lose the slot if it does
+        axidma_pipeline_release(d->p, slot);
+        d->stats.slots_released++;
+        d->cur_slot = -1;
+    }
+}
+
+//Pushes as much of the current slot as will fit into the workers' rings
+static int hand_out(axidma_dispatch *d) {
+    unsigned slot = d->cur_slot;
+    axidma_dispatch_buf *bufs = &d->bufs[slot * d->bufs_per_slot];
+    int n = 0;
+
+    while (d->cur_next < d->nbufs[slot]) {
+        axidma_dispatch_buf *b = &bufs[d->cur_next];
+        if (spsc_ring_push(&d->rings[b->worker].to_worker, b) < 0) {
+            d->stats.ring_full++;
+            return n;
+        }
+        d->cur_next++;
+        d->stats.handed_out++;
+        n++;
+    }
+
+    d->cur_slot = -1;
+    return n;
+}
+
+int axidma_dispatch_poll(axidma_dispatch *d, int wait) {
+    reclaim(d);
+
+    if (d->cur_slot < 0) {
+        int slot = axidma_pipeline_try_next(d->p);
+        //Only sleep if the DMA is working on the next slot. Otherwise we're
+        //still waiting for the workers to give something back
+        if (slot < 0 && wait && axidma_pipeline_dma_has_next(d->p)) {
+            slot = axidma_pipeline_next(d->p, 1);
+            if (slot < 0) return -1;
+        }
+        if (slot < 0) return 0;
+        take_slot(d, slot);
+        if (d->cur_slot < 0) return 0;
+    }
+
+    return hand_out(d);
+}
+
+axidma_dispatch_buf *axidma_dispatch_get(axidma_dispatch *d, unsigned w) {
+    return spsc_ring_pop(&d->rings[w].to_worker);
+}
+
+void axidma_dispatch_put(axidma_dispatch *d, axidma_dispatch_buf *b) {
+    //Can't fail: the ring has room for every buffer
+    spsc_ring_push(&d->rings[b->worker].from_worker, b);
+}
+
+axidma_dispatch_stats axidma_dispatch_get_stats(axidma_dispatch *d) {
+    return d->stats;
+}
+
+int axidma_pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc) {
+        errno = rc;
+        perror("Could not pin thread");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef AXIDMA_DISPATCH_H
+#define AXIDMA_DISPATCH_H 1
+
+//Fans the buffers coming out of an S2MM axidma_pipeline out to worker
+//threads, without copying them and without locks.
+//
+//One thread (the "DMA thread") owns the pipeline and calls
+//axidma_dispatch_poll in a loop. Every buffer the DMA fills is handed, by
+//pointer, to one of the workers through a single-producer/single-consumer
+//ring (see spsc_ring.h). When a worker is done with a buffer it hands it back
+//through another ring, and once every buffer in a slot is back, the DMA
+//thread gives the slot back to the DMA.
+//
+//    //DMA thread
+//    axidma_pipeline *p = axidma_pipeline_new(ctx, 1, 8, 16, 2048, ...);
+//    axidma_dispatch *d = axidma_dispatch_new(p, 4, 256, NULL, NULL);
+//    axidma_pin_to_cpu(0);
+//    while (running) axidma_dispatch_poll(d, 0);
+//
+//    //Worker thread w
+//    axidma_pin_to_cpu(w + 1);
+//    while (running) {
+//        axidma_dispatch_buf *b = axidma_dispatch_get(d, w);
+//        if (!b) continue; //Or back off a bit
+//        ... process b->buf.base, b->buf.len ...
+//        axidma_dispatch_put(d, b);
+//    }
+//
+//Workers own their buffers until they put them back, and a slot can't go
+//back to the DMA until all of its buffers do, so don't sit on them. If the
+//workers fall behind, the DMA runs out of slots and (for S2MM) pushes back
+//on the stream.
+//
+//axidma_dispatch_get and axidma_dispatch_put for worker w must only ever be
+//called from one thread at a time. Everything else belongs to the DMA thread.
+
+#include <stdint.h>
+#include "axidma.h"
+#include "axidma_pipeline.h"
+
+typedef struct axidma_dispatch axidma_dispatch;
+
+//One received buffer on its way to (or back from) a worker
+typedef struct {
+    s2mm_buf buf; //What the DMA wrote
+
+    //Used by the dispatcher. Hands off
+    unsigned slot;
+    unsigned worker;
+} axidma_dispatch_buf;
+
+//Picks the worker (0 to num_workers - 1) for a buffer, e.g. by hashing a flow
+//ID in the packet. Runs on the DMA thread
+typedef unsigned (*axidma_dispatch_fn)(s2mm_buf const *b, void *arg);
+
+//Makes a dispatcher for an S2MM pipeline. Each worker gets a ring with room
+//for ring_sz buffers. If choose is NULL, buffers are dealt out round-robin.
+//The dispatcher doesn't own the pipeline; delete the dispatcher first.
+//Returns NULL on error
+axidma_dispatch *axidma_dispatch_new(axidma_pipeline *p, unsigned num_workers, unsigned ring_sz,
+                                     axidma_dispatch_fn choose, void *arg);
+
+//Frees the dispatcher. Make sure the workers have stopped first
+void axidma_dispatch_del(axidma_dispatch *d);
+
+//Does one round of work on the DMA thread: gives back slots whose buffers
+//have all been returned, then hands out buffers from the next filled slot.
+//If wait is nonzero and there is nothing to do, sleeps on the DMA's
+//interrupt until a slot fills up. Returns the number of buffers handed out,
+//or -1 if the DMA stopped with an error (which is only noticed while
+//waiting)
+int axidma_dispatch_poll(axidma_dispatch *d, int wait);
+
+//Worker side. Returns the next buffer for worker w, or NULL if there isn't
+//one right now
+axidma_dispatch_buf *axidma_dispatch_get(axidma_dispatch *d, unsigned w);
+
+//Worker side. Gives a buffer back, from the same worker that got it. Never
+//blocks
+void axidma_dispatch_put(axidma_dispatch *d, axidma_dispatch_buf *b);
+
+typedef struct {
+    uint64_t handed_out; //Buffers given to workers
+    uint64_t returned; //Buffers given back by workers
+    uint64_t slots_released; //Slots given back to the DMA
+    uint64_t ring_full; //Times a worker's ring was full and we had to wait
+} axidma_dispatch_stats;
+
+//Only meaningful on the DMA thread
+axidma_dispatch_stats axidma_dispatch_get_stats(axidma_dispatch *d);
+
+//Pins the calling thread to one CPU. Returns 0 on success, -1 on error
+int axidma_pin_to_cpu(int cpu);
+
+#endif
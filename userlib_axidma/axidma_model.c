@@ -0,0 +1,584 @@
+#define _GNU_SOURCE //For mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h> //SIOCOUTQ
+#include "axidma.h"
+#include "axidma_private.h"
+#include "axidma_model.h"
+
+#define MODEL_PAGE_SIZE 4096ULL
+
+//Process at most this many descriptors per channel before giving the other
+//channel a turn. Keeps MM2S from running miles ahead of S2MM in loopback
+#define DESCS_PER_TURN 16
+
+//After this many passes with nothing to do, start sleeping instead of
+//spinning
+#define IDLE_SPINS 10000
+#define IDLE_SLEEP_US 20
+
+//One contiguous piece of fake physical memory
+typedef struct {
+    uint64_t phys;
+    char *virt;
+    size_t len;
+} chunk;
+
+typedef struct {
+    volatile uint32_t *cr;
+    volatile uint32_t *sr;
+    volatile uint32_t *cur_lsb, *cur_msb;
+    volatile uint32_t *tail_lsb, *tail_msb;
+    int is_s2mm;
+
+    int running;
+    uint64_t cur; //Next descriptor to process
+    uint32_t sr_val; //What DMASR should read as
+    unsigned pkts_since_irq;
+    int in_packet; //S2MM: already wrote the SOF for the current packet
+    unsigned progress; //Loopback: bytes of the current descriptor done so far
+} channel;
+
+//Loopback FIFO between MM2S and S2MM. Both channels are run by the model
+//thread, so this doesn't need any locking. Positions count bytes since the
+//start and only ever go up
+typedef struct {
+    unsigned char *buf;
+    size_t size; //Power of 2
+    uint64_t head; //Bytes pushed by MM2S
+    uint64_t tail; //Bytes popped by S2MM
+    
+    //Where each packet (TLAST) ends, in the same units as head and tail
+    uint64_t *ends;
+    unsigned max_ends; //Power of 2
+    unsigned ends_head, ends_tail;
+} lb_fifo;
+
+struct axidma_model {
+    pthread_t thread;
+    volatile int stop;
+
+    axidma_regs *regs;
+    int sock[2]; //sock[0] is the "UIO file", the model writes to sock[1]
+    unsigned irq_count;
+
+    //Fake physical memory map, sorted by phys
+    pthread_rwlock_t map_lock;
+    chunk *chunks;
+    unsigned num_chunks;
+    unsigned max_chunks;
+    uint64_t next_phys;
+
+    channel mm2s;
+    channel s2mm;
+
+    axidma_model_source_fn source;
+    void *source_arg;
+    axidma_model_sink_fn sink;
+    void *sink_arg;
+
+    lb_fifo *lb; //NULL if not in loopback mode
+
+    axidma_model_stats stats;
+};
+
+//Returns the host address of [phys, phys+len), or NULL if that range isn't
+//entirely inside one registered chunk
+static void *translate(axidma_model *m, uint64_t phys, size_t len) {
+    void *ret = NULL;
+    pthread_rwlock_rdlock(&m->map_lock);
+    unsigned lo = 0, hi = m->num_chunks;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        chunk *c = &m->chunks[mid];
+        if (phys < c->phys) {
+            hi = mid;
+        } else if (phys >= c->phys + c->len) {
+            lo = mid + 1;
+        } else {
+            if (phys + len <= c->phys + c->len) ret = c->virt + (phys - c->phys);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&m->map_lock);
+    return ret;
+}
+
+int axidma_model_add_region(axidma_model *m, void *buf, size_t len, struct pinner_physlist *plist) {
+    uintptr_t start = (uintptr_t) buf;
+    uintptr_t end = start + len;
+    unsigned n = 0;
+
+    //Same shape as a pinner physlist: one entry per page touched
+    for (uintptr_t p = start; p < end; p = (p & ~(MODEL_PAGE_SIZE - 1)) + MODEL_PAGE_SIZE) n++;
+    if (n == 0 || n > PINNER_MAX_PAGES) {
+        fprintf(stderr, "axidma_model_add_region: buffer must be between 1 byte and %d pages\n", PINNER_MAX_PAGES);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&m->map_lock);
+    if (m->num_chunks + n > m->max_chunks) {
+        unsigned new_max = (m->num_chunks + n) * 2;
+        chunk *tmp = realloc(m->chunks, new_max * sizeof(chunk));
+        if (!tmp) {
+            pthread_rwlock_unlock(&m->map_lock);
+            perror("Could not grow model memory map");
+            return -1;
+        }
+        m->chunks = tmp;
+        m->max_chunks = new_max;
+    }
+
+    plist->num_entries = n;
+    unsigned i = 0;
+    for (uintptr_t p = start; p < end; i++) {
+        uintptr_t next = (p & ~(MODEL_PAGE_SIZE - 1)) + MODEL_PAGE_SIZE;
+        if (next > end) next = end;
+
+        chunk *c = &m->chunks[m->num_chunks++];
+        c->phys = m->next_phys + (p & (MODEL_PAGE_SIZE - 1));
+        c->virt = (char *) p;
+        c->len = next - p;
+        plist->entries[i].addr = c->phys;
+        plist->entries[i].len = c->len;
+
+        //Leave a hole after every page so nothing is accidentally contiguous
+        m->next_phys += 2 * MODEL_PAGE_SIZE;
+        p = next;
+    }
+    pthread_rwlock_unlock(&m->map_lock);
+
+    return 0;
+}
+
+//DMASR is partly status, partly write-1-to-clear. Since software writes
+//straight into memory, we find out about its writes by noticing that DMASR
+//doesn't hold what we last put there. Then we publish our new value with a
+//compare-and-swap so we can't miss a write that happens in between.
+static void sr_update(channel *ch, uint32_t set, uint32_t clear) {
+    for (;;) {
+        uint32_t seen = __atomic_load_n(ch->sr, __ATOMIC_ACQUIRE);
+        if (seen != ch->sr_val) {
+            ch->sr_val &= ~(seen & DMASR_IRQ_MASK);
+        }
+        uint32_t val = (ch->sr_val & ~clear) | set;
+        if (__atomic_compare_exchange_n(ch->sr, &seen, val, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ch->sr_val = val;
+            return;
+        }
+    }
+}
+
+//Same as the UIO read(): wakes up the reader with the interrupt count. If
+//the reader hasn't picked up the last one yet, don't pile up another (the
+//real thing only wakes you once, too)
+static void raise_irq(axidma_model *m) {
+    int outq = 0;
+    m->irq_count++;
+    __atomic_fetch_add(&m->stats.irqs, 1, __ATOMIC_RELAXED);
+
+    //The axidma kernel module acks everything in its handler
+    sr_update(&m->mm2s, 0, DMASR_IRQ_MASK);
+    sr_update(&m->s2mm, 0, DMASR_IRQ_MASK);
+
+    //Throw away whatever the reader wrote back since last time (UIO users
+    //write() after every read(), see axidma.c)
+    char junk[64];
+    while (recv(m->sock[1], junk, sizeof(junk), MSG_DONTWAIT) > 0) ;
+
+    if (ioctl(m->sock[1], SIOCOUTQ, &outq) == 0 && outq > 0) return;
+    send(m->sock[1], &m->irq_count, sizeof(m->irq_count), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+static void channel_error(axidma_model *m, channel *ch, uint32_t err) {
+    sr_update(ch, err | DMASR_ERR_IRQ | DMASR_HALTED, DMASR_IDLE);
+    __atomic_fetch_and(ch->cr, ~DMACR_RS, __ATOMIC_ACQ_REL);
+    ch->running = 0;
+    if (*ch->cr & DMACR_ERR_IRQ_EN) raise_irq(m);
+}
+
+static inline uint64_t read64(volatile uint32_t *lsb, volatile uint32_t *msb) {
+    return ((uint64_t) *msb << 32) | *lsb;
+}
+
+//MM2S side of the loopback FIFO. Pushes as much of buf as fits. Returns 1
+//once the whole descriptor is in, 0 if we need to come back later
+static int lb_push(lb_fifo *f, channel *ch, unsigned char const *buf, unsigned len, int eof) {
+    //Need somewhere to put the end of the packet before we can finish
+    if (eof && f->ends_head - f->ends_tail == f->max_ends) return 0;
+
+    while (ch->progress < len) {
+        size_t space = f->size - (f->head - f->tail);
+        if (space == 0) return 0;
+
+        size_t pos = f->head & (f->size - 1);
+        size_t n = len - ch->progress;
+        if (n > space) n = space;
+        if (n > f->size - pos) n = f->size - pos; //Don't run off the end
+        memcpy(f->buf + pos, buf + ch->progress, n);
+        f->head += n;
+        ch->progress += n;
+    }
+
+    if (eof) f->ends[f->ends_head++ & (f->max_ends - 1)] = f->head;
+    ch->progress = 0;
+    return 1;
+}
+
+//S2MM side of the loopback FIFO. Fills buf up to the end of the current
+//packet. Returns the number of bytes in buf once the descriptor is done (and
+//sets *eof if the packet ended), or 0 if we need to come back later
+static unsigned lb_pop(lb_fifo *f, channel *ch, unsigned char *buf, unsigned len, int *eof) {
+    //Data past the end of the current packet isn't ours yet. If MM2S hasn't
+    //finished the packet, everything in the FIFO is fair game
+    int have_end = (f->ends_head != f->ends_tail);
+    uint64_t limit = have_end ? f->ends[f->ends_tail & (f->max_ends - 1)] : f->head;
+
+    while (ch->progress < len && f->tail < limit) {
+        size_t pos = f->tail & (f->size - 1);
+        size_t n = len - ch->progress;
+        if (n > limit - f->tail) n = limit - f->tail;
+        if (n > f->size - pos) n = f->size - pos;
+        memcpy(buf + ch->progress, f->buf + pos, n);
+        f->tail += n;
+        ch->progress += n;
+    }
+
+    *eof = (have_end && f->tail == limit);
+    if (*eof) f->ends_tail++;
+    else if (ch->progress < len) return 0; //Buffer isn't full and packet isn't over
+
+    unsigned ret = ch->progress;
+    ch->progress = 0;
+    return ret;
+}
+
+//Runs one descriptor. Returns 1 if it was processed, 0 if the source had no
+//data for it yet, -1 on error (the channel has been halted)
+static int do_descriptor(axidma_model *m, channel *ch, volatile sg_descriptor *d) {
+    uint64_t buf_phys = ((uint64_t) d->buffer_msb << 32) | d->buffer_lsb;
+    unsigned len = d->control.len;
+    int sof = d->control.sof;
+    int eof = d->control.eof;
+    void *buf = translate(m, buf_phys, len);
+
+    if (!buf) {
+        channel_error(m, ch, DMASR_DMA_DEC_ERR);
+        return -1;
+    }
+
+    if (m->lb && ch->is_s2mm) {
+        len = lb_pop(m->lb, ch, buf, len, &eof);
+        if (len == 0 && !eof) return 0;
+        sof = !ch->in_packet;
+        ch->in_packet = !eof;
+    } else if (m->lb) {
+        if (!lb_push(m->lb, ch, buf, len, eof)) return 0;
+    } else if (ch->is_s2mm) {
+        unsigned got;
+        if (m->source) {
+            got = m->source(buf, len, &eof, m->source_arg);
+        } else {
+            for (unsigned i = 0; i < len; i++) ((unsigned char *) buf)[i] = i;
+            got = len;
+        }
+        if (got == 0 && !eof) return 0;
+        if (got > len) got = len;
+
+        sof = !ch->in_packet;
+        ch->in_packet = !eof;
+        len = got;
+    } else if (m->sink) {
+        m->sink(buf, len, sof, eof, m->sink_arg);
+    }
+
+    //Status goes in as one word, with the complete bit, so software never
+    //sees a half-written status
+    sg_descriptor tmp;
+    uint32_t status;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.status.len = len;
+    tmp.status.sof = sof;
+    tmp.status.eof = eof;
+    tmp.status.complete = 1;
+    memcpy(&status, &tmp.status, sizeof(status));
+    __atomic_store_n((volatile uint32_t *) &d->status, status, __ATOMIC_RELEASE);
+
+    if (ch->is_s2mm) {
+        __atomic_fetch_add(&m->stats.s2mm_descs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&m->stats.s2mm_bytes, len, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&m->stats.mm2s_descs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&m->stats.mm2s_bytes, len, __ATOMIC_RELAXED);
+    }
+
+    //IOC fires at the end of every IRQThreshold packets
+    if (eof) {
+        uint32_t cr = *ch->cr;
+        unsigned thresh = (cr & DMACR_IRQ_THRESH_MASK) >> DMACR_IRQ_THRESH_SHIFT;
+        if (thresh == 0) thresh = 1;
+        if (++ch->pkts_since_irq >= thresh) {
+            ch->pkts_since_irq = 0;
+            sr_update(ch, DMASR_IOC_IRQ, 0);
+            if (cr & DMACR_IOC_IRQ_EN) raise_irq(m);
+        }
+    }
+
+    return 1;
+}
+
+//Does some work on a channel. Returns nonzero if anything happened
+static int step_channel(axidma_model *m, channel *ch) {
+    uint32_t cr = __atomic_load_n(ch->cr, __ATOMIC_ACQUIRE);
+
+    if (cr & DMACR_RESET) {
+        //Reset clears everything, and then the bit clears itself
+        __atomic_store_n(ch->cr, 0, __ATOMIC_RELEASE);
+        ch->sr_val = __atomic_load_n(ch->sr, __ATOMIC_ACQUIRE);
+        sr_update(ch, DMASR_HALTED | DMASR_SG_INCLD, ~0U);
+        ch->running = 0;
+        ch->pkts_since_irq = 0;
+        ch->in_packet = 0;
+        ch->progress = 0;
+        return 1;
+    }
+
+    if (!(cr & DMACR_RS)) {
+        if (ch->running) {
+            ch->running = 0;
+            sr_update(ch, DMASR_HALTED, DMASR_IDLE);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!ch->running) {
+        //Errors stick until a reset
+        sr_update(ch, 0, 0);
+        if (ch->sr_val & DMASR_ERR_MASK) return 0;
+        ch->running = 1;
+        ch->cur = read64(ch->cur_lsb, ch->cur_msb);
+        sr_update(ch, 0, DMASR_HALTED);
+    }
+
+    uint64_t tail = read64(ch->tail_lsb, ch->tail_msb);
+    volatile sg_descriptor *tail_d = translate(m, tail, sizeof(sg_descriptor));
+    if (!tail_d || tail_d->status.complete) return 0;
+
+    int did_something = 0;
+    for (int i = 0; i < DESCS_PER_TURN; i++) {
+        volatile sg_descriptor *d = translate(m, ch->cur, sizeof(sg_descriptor));
+        if (!d || (ch->cur & 0x3F)) {
+            channel_error(m, ch, DMASR_SG_DEC_ERR);
+            return 1;
+        }
+        if (d->status.complete) {
+            channel_error(m, ch, DMASR_SG_INT_ERR);
+            return 1;
+        }
+
+        //The real DMA fetches the whole descriptor up front. Grab the next
+        //pointer now, since software is free to reuse d as soon as it sees
+        //the Cmplt bit
+        uint64_t next = ((uint64_t) d->next_desc_msb << 32) | d->next_desc_lsb;
+
+        if (!did_something) sr_update(ch, 0, DMASR_IDLE);
+        int rc = do_descriptor(m, ch, d);
+        if (rc < 0) return 1;
+        if (rc == 0) break; //Source stalled
+        did_something = 1;
+
+        *ch->cur_lsb = (uint32_t) ch->cur;
+        *ch->cur_msb = (uint32_t) (ch->cur >> 32);
+
+        uint64_t done = ch->cur;
+        ch->cur = next;
+        if (done == tail) {
+            sr_update(ch, DMASR_IDLE, 0);
+            break;
+        }
+    }
+
+    return did_something;
+}
+
+static void *model_thread(void *arg) {
+    axidma_model *m = (axidma_model *) arg;
+    unsigned idle = 0;
+
+    while (!m->stop) {
+        int busy = step_channel(m, &m->mm2s);
+        busy |= step_channel(m, &m->s2mm);
+
+        if (busy) {
+            idle = 0;
+        } else if (++idle < IDLE_SPINS) {
+            sched_yield();
+        } else {
+            usleep(IDLE_SLEEP_US);
+        }
+    }
+
+    return NULL;
+}
+
+static void channel_init(channel *ch, volatile uint32_t *base, int is_s2mm) {
+    memset(ch, 0, sizeof(channel));
+    ch->cr = base + 0;
+    ch->sr = base + 1;
+    ch->cur_lsb = base + 2;
+    ch->cur_msb = base + 3;
+    ch->tail_lsb = base + 4;
+    ch->tail_msb = base + 5;
+    ch->is_s2mm = is_s2mm;
+    ch->sr_val = DMASR_HALTED | DMASR_SG_INCLD;
+    *ch->sr = ch->sr_val;
+}
+
+axidma_model *axidma_model_new(void) {
+    axidma_model *m = calloc(1, sizeof(axidma_model));
+    if (!m) {
+        perror("Could not allocate AXI DMA model");
+        return NULL;
+    }
+    m->sock[0] = m->sock[1] = -1;
+    m->next_phys = AXIDMA_MODEL_PHYS_BASE;
+    pthread_rwlock_init(&m->map_lock, NULL);
+
+    //Shared, so axidma_model_ctx can hand out a second mapping of it
+    m->regs = mmap(0, AXI_DMA_REG_SPAN, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m->regs == MAP_FAILED) {
+        perror("Could not allocate model registers");
+        goto axidma_model_new_error;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, m->sock) < 0) {
+        perror("Could not make model interrupt socket");
+        goto axidma_model_new_error;
+    }
+
+    channel_init(&m->mm2s, &m->regs->MM2S_DMACR, 0);
+    channel_init(&m->s2mm, &m->regs->S2MM_DMACR, 1);
+
+    if (pthread_create(&m->thread, NULL, model_thread, m)) {
+        perror("Could not start model thread");
+        goto axidma_model_new_error;
+    }
+
+    return m;
+
+    axidma_model_new_error:
+    if (m->regs && m->regs != MAP_FAILED) munmap(m->regs, AXI_DMA_REG_SPAN);
+    if (m->sock[0] != -1) close(m->sock[0]);
+    if (m->sock[1] != -1) close(m->sock[1]);
+    pthread_rwlock_destroy(&m->map_lock);
+    free(m);
+    return NULL;
+}
+
+static void lb_free(lb_fifo *f) {
+    if (!f) return;
+    free(f->buf);
+    free(f->ends);
+    free(f);
+}
+
+void axidma_model_del(axidma_model *m) {
+    if (!m) return;
+    m->stop = 1;
+    pthread_join(m->thread, NULL);
+    lb_free(m->lb);
+    munmap(m->regs, AXI_DMA_REG_SPAN);
+    close(m->sock[0]);
+    close(m->sock[1]);
+    pthread_rwlock_destroy(&m->map_lock);
+    free(m->chunks);
+    free(m);
+}
+
+axidma_ctx *axidma_model_ctx(axidma_model *m) {
+    axidma_ctx *ctx = malloc(sizeof(axidma_ctx));
+    if (!ctx) {
+        perror("Could not allocate axidma_ctx struct");
+        return NULL;
+    }
+
+    //axidma_close will close and munmap these, so they can't be the model's
+    //own copies. Growing a shared mapping from size 0 makes a second mapping
+    //of the same pages
+    ctx->reg_base = mremap(m->regs, 0, AXI_DMA_REG_SPAN, MREMAP_MAYMOVE);
+    if (ctx->reg_base == MAP_FAILED) {
+        perror("Could not map model registers");
+        free(ctx);
+        return NULL;
+    }
+    ctx->fd = dup(m->sock[0]);
+    if (ctx->fd == -1) {
+        perror("Could not dup model interrupt socket");
+        munmap(ctx->reg_base, AXI_DMA_REG_SPAN);
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+void axidma_model_set_source(axidma_model *m, axidma_model_source_fn fn, void *arg) {
+    m->source_arg = arg;
+    __atomic_store_n(&m->source, fn, __ATOMIC_RELEASE);
+}
+
+void axidma_model_set_sink(axidma_model *m, axidma_model_sink_fn fn, void *arg) {
+    m->sink_arg = arg;
+    __atomic_store_n(&m->sink, fn, __ATOMIC_RELEASE);
+}
+
+int axidma_model_set_loopback(axidma_model *m, size_t fifo_bytes) {
+    lb_fifo *f = NULL;
+
+    if (fifo_bytes) {
+        size_t sz = 64;
+        while (sz < fifo_bytes) sz <<= 1;
+
+        f = calloc(1, sizeof(lb_fifo));
+        if (!f) {
+            perror("Could not allocate loopback FIFO");
+            return -1;
+        }
+        f->size = sz;
+        //Room for the end of every packet, even if they were all one byte
+        //long, would be overkill. One per 64 bytes of FIFO is plenty
+        f->max_ends = sz / 64;
+        f->buf = malloc(f->size);
+        f->ends = malloc(f->max_ends * sizeof(uint64_t));
+        if (!f->buf || !f->ends) {
+            perror("Could not allocate loopback FIFO");
+            lb_free(f);
+            return -1;
+        }
+    }
+
+    //The model thread only looks at this between descriptors, and the caller
+    //promised both channels are idle
+    lb_fifo *old = __atomic_exchange_n(&m->lb, f, __ATOMIC_ACQ_REL);
+    lb_free(old);
+    return 0;
+}
+
+axidma_model_stats axidma_model_get_stats(axidma_model *m) {
+    axidma_model_stats ret = {
+        .mm2s_descs = __atomic_load_n(&m->stats.mm2s_descs, __ATOMIC_RELAXED),
+        .mm2s_bytes = __atomic_load_n(&m->stats.mm2s_bytes, __ATOMIC_RELAXED),
+        .s2mm_descs = __atomic_load_n(&m->stats.s2mm_descs, __ATOMIC_RELAXED),
+        .s2mm_bytes = __atomic_load_n(&m->stats.s2mm_bytes, __ATOMIC_RELAXED),
+        .irqs = __atomic_load_n(&m->stats.irqs, __ATOMIC_RELAXED)
+    };
+    return ret;
+}
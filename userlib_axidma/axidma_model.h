@@ -0,0 +1,102 @@
+#ifndef AXIDMA_MODEL_H
+#define AXIDMA_MODEL_H 1
+
+//A software model of the AXI DMA's scatter-gather engine, so the rest of this
+//library can be tested and benchmarked on any Linux box, no board required.
+//
+//The model runs in its own thread and behaves (as far as software can tell)
+//like the AXI DMA plus the axidma kernel module:
+//  - It gives you an axidma_ctx whose reg_base is an in-memory axidma_regs
+//    block and whose fd acts like the UIO file: read() blocks until an
+//    interrupt and returns the interrupt count
+//  - When a channel's RS bit is set, it latches curdesc. It then walks the
+//    descriptor chain up to taildesc and fills in each descriptor's status.
+//    The next time it continues from where it left off, like the real thing
+//  - S2MM buffers are filled from a "source" callback, and MM2S buffers are
+//    handed to a "sink" callback
+//  - It reports errors the same way the hardware does (SGIntErr for a
+//    descriptor that's already complete, SGDecErr/DMADecErr for addresses
+//    that don't map to anything, and so on) and halts the channel
+//
+//Instead of pinning buffers with the pinner module, register them with
+//axidma_model_add_region(). This hands out fake physical addresses (starting
+//at AXIDMA_MODEL_PHYS_BASE) and fills in a physlist just like pin_buf would.
+//Each page gets a separate, non-contiguous physical address, so the code that
+//splits buffers across physlist entries gets exercised too.
+//
+//Differences from the real hardware:
+//  - The model notices new work when the tail descriptor's Cmplt bit is
+//    clear, not when taildesc is written. Software that follows the rules
+//    (clear the status of descriptors before handing them back) can't tell
+//  - The interrupt delay timer isn't modelled; IRQThreshold is
+//  - Transfers happen as fast as memcpy allows
+//
+//Usage:
+//    axidma_model *m = axidma_model_new();
+//    axidma_model_add_region(m, sg_mem, sg_sz, &sg_plist);
+//    axidma_model_add_region(m, data_mem, data_sz, &data_plist);
+//    axidma_ctx *ctx = axidma_model_ctx(m);
+//    ... use ctx and the physlists with axidma.h as usual ...
+//    axidma_close(ctx);
+//    axidma_model_del(m);
+
+#include <stddef.h>
+#include <stdint.h>
+#include "axidma.h"
+
+#define AXIDMA_MODEL_PHYS_BASE 0x800000000ULL
+
+typedef struct axidma_model axidma_model;
+
+//Fills buf (len bytes, one S2MM descriptor's worth) with stream data. Returns
+//the number of bytes written. Set *eof if the packet (TLAST) ends in this
+//buffer; on entry, *eof is the descriptor's own EOF bit, which is a handy
+//default. Returning 0 without setting *eof means "no data yet", and the
+//model will try again later.
+typedef unsigned (*axidma_model_source_fn)(void *buf, unsigned len, int *eof, void *arg);
+
+//Consumes the data from one MM2S descriptor. sof and eof are the
+//descriptor's control bits
+typedef void (*axidma_model_sink_fn)(void const *buf, unsigned len, int sof, int eof, void *arg);
+
+//Makes a new model and starts its thread. Returns NULL on error. By default
+//S2MM buffers are filled with an incrementing byte pattern, ending packets
+//where the descriptors say, and MM2S data is thrown away.
+axidma_model *axidma_model_new(void);
+
+//Stops the thread and frees everything. Close any contexts from
+//axidma_model_ctx first.
+void axidma_model_del(axidma_model *m);
+
+//Makes a fake physical mapping for buf, page by page, and fills in plist to
+//describe it. Returns 0 on success, -1 on error
+int axidma_model_add_region(axidma_model *m, void *buf, size_t len, struct pinner_physlist *plist);
+
+//Returns a context that talks to the model. Free it with axidma_close
+axidma_ctx *axidma_model_ctx(axidma_model *m);
+
+//Change where S2MM data comes from and MM2S data goes. Only call these while
+//both channels are idle
+void axidma_model_set_source(axidma_model *m, axidma_model_source_fn fn, void *arg);
+void axidma_model_set_sink(axidma_model *m, axidma_model_sink_fn fn, void *arg);
+
+//Connects MM2S straight to S2MM through a FIFO of (at least) fifo_bytes, like
+//a loopback design in the PL would. While this is on, the source and sink
+//callbacks aren't used. A full FIFO holds up MM2S, and an empty one holds up
+//S2MM, so neither side needs to keep up with the other. Pass 0 to turn it
+//back off. Only call this while both channels are idle. Returns 0 on success,
+//-1 on error
+int axidma_model_set_loopback(axidma_model *m, size_t fifo_bytes);
+
+//Number of descriptors and bytes processed by each channel so far
+typedef struct {
+    uint64_t mm2s_descs;
+    uint64_t mm2s_bytes;
+    uint64_t s2mm_descs;
+    uint64_t s2mm_bytes;
+    uint64_t irqs;
+} axidma_model_stats;
+
+axidma_model_stats axidma_model_get_stats(axidma_model *m);
+
+#endif
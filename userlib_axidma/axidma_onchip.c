@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap
+#include <sys/ioctl.h> //ioctl
+#include <unistd.h> //close
+#include "axidma_onchip.h"
+#include "mpsoc_axiregs.h"
+#include "pinner.h"
+
+void *axidma_onchip_map(unsigned win, unsigned long off, unsigned long len, struct pinner_physlist *plist) {
+    int fd = -1;
+    void *ret = NULL;
+
+    if (!plist || len == 0 || (off & 0xFFF) || (len & 0xFFF) || len > 0xFFFFFFFFUL) {
+        fprintf(stderr, "axidma_onchip_map: Invalid function argument\n");
+        return NULL;
+    }
+
+    fd = open(AXIDMA_ONCHIP_DEV, O_RDWR);
+    if (fd == -1) {
+        perror("Could not open " AXIDMA_ONCHIP_DEV);
+        goto axidma_onchip_map_error;
+    }
+
+    struct mpsoc_axiregs_window info = {.index = win};
+    if (ioctl(fd, MPSOC_AXIREGS_GET_WINDOW, &info) < 0) {
+        perror("Could not get window info");
+        goto axidma_onchip_map_error;
+    }
+    if (off + len > info.size) {
+        fprintf(stderr, "axidma_onchip_map: 0x%lx bytes at 0x%lx won't fit in window %u (%s, 0x%lx bytes)\n",
+            len, off, win, info.name, info.size);
+        goto axidma_onchip_map_error;
+    }
+
+    //Normal non-cacheable rather than Device: the DMA sees our writes without
+    //any cache maintenance, but unaligned accesses and memset still work
+    void *buf = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     MPSOC_AXIREGS_MMAP_OFFSET_TYPE(win, off, MPSOC_AXIREGS_MAP_WC));
+    if (buf == MAP_FAILED) {
+        perror("Could not mmap on-chip memory");
+        goto axidma_onchip_map_error;
+    }
+    memset(buf, 0, len);
+
+    plist->num_entries = 1;
+    plist->entries[0].addr = info.phys + off;
+    plist->entries[0].len = len;
+    ret = buf;
+
+    axidma_onchip_map_error:
+    //The mapping outlives the file
+    if (fd != -1) close(fd);
+    return ret;
+}
+
+void axidma_onchip_unmap(void *buf, unsigned long len) {
+    if (buf) munmap(buf, len);
+}
@@ -0,0 +1,50 @@
+#ifndef AXIDMA_ONCHIP_H
+#define AXIDMA_ONCHIP_H 1
+
+//Puts scatter-gather descriptors in on-chip memory (the PS OCM, or a BRAM in
+//the PL) instead of pinned DDR.
+//
+//Every descriptor fetch and status write-back is a small, latency-bound
+//access. In DDR they compete with the payload traffic, and with a
+//non-coherent DMA you also have to flush them out of the cache on every
+//transfer. On-chip memory is closer, and since we map it uncached there's
+//nothing to flush.
+//
+//The memory has to be reachable through one of the mpsoc_axiregs module's
+//windows. The PL BRAMs usually are already (they sit behind HPM0/HPM1). For
+//the OCM, give the driver a window for the part you're allowed to use, e.g.
+//
+//    insmod mpsoc_axiregs.ko win_phys=0xA0000000,0xFFFC0000 win_size=0x10000000,0x20000
+//
+//(the top of the OCM usually belongs to the ATF and PMU firmware, so check
+//your boot setup before picking a range). The AXI DMA's SG port also needs a
+//path to it in the block design.
+//
+//axidma_onchip_map gives you a buffer and a one-entry physlist, which go
+//straight into axidma_list_new (or anything else that takes an SG buffer) in
+//place of a pinned one:
+//
+//    struct pinner_physlist sg_plist; //Only entries[0] is used
+//    void *sg = axidma_onchip_map(1, 0, 0x10000, &sg_plist);
+//    sg_list *lst = axidma_list_new(sg, &sg_plist, data_buf, &data_plist);
+//    ...
+//    axidma_list_del(lst);
+//    axidma_onchip_unmap(sg, 0x10000);
+//
+//Don't put packet data here: the mapping is Normal non-cacheable, which is
+//fine for descriptors but makes the CPU slow at touching anything bigger.
+
+#include "pinner.h"
+
+#define AXIDMA_ONCHIP_DEV "/dev/mpsoc_axiregs"
+
+//Maps len bytes, starting off bytes into mpsoc_axiregs window win, and fills
+//in plist to describe them. off and len must be multiples of the page size.
+//The memory is zeroed, since BRAM powers up with junk that the DMA could
+//mistake for finished descriptors. Returns NULL on error
+void *axidma_onchip_map(unsigned win, unsigned long off, unsigned long len, struct pinner_physlist *plist);
+
+//Unmaps a buffer from axidma_onchip_map. Reset the DMA first
+void axidma_onchip_unmap(void *buf, unsigned long len);
+
+#endif
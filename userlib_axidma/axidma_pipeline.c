@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_private.h"
+#include "axidma_pipeline.h"
+
+typedef enum {
+    SLOT_FREE, //MM2S only: never been sent, yours for the asking
+    SLOT_DMA, //Handed to the DMA
+    SLOT_APP, //Handed to the user by axidma_pipeline_next
+    SLOT_READY //Released by the user, waiting its turn to go back to the DMA
+} slot_state;
+
+struct axidma_pipeline {
+    axidma_ctx *ctx;
+    int is_s2mm;
+    unsigned num_slots;
+    unsigned bufs_per_slot;
+
+    sg_list **slots;
+    slot_state *state;
+    uint64_t *head_phys;
+    uint64_t *tail_phys;
+
+    unsigned next_out; //Next slot axidma_pipeline_next will return
+    unsigned next_arm; //Next slot to give back to the DMA
+    unsigned armed; //Number of slots in SLOT_DMA
+
+    uint64_t starve_start; //When armed last dropped to 0, or 0 if it hasn't
+    axidma_pipeline_stats stats;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Gives a slot to the DMA. Its last descriptor leads into the next slot, so
+//once that one is armed too the DMA never has to stop in between
+static void arm_slot(axidma_pipeline *p, unsigned i) {
+    unsigned next = (i + 1) % p->num_slots;
+    axidma_write_list(p->slots[i], p->is_s2mm, p->head_phys[next]);
+    axidma_kick(p->ctx, p->is_s2mm, p->head_phys[i], p->tail_phys[i]);
+    p->state[i] = SLOT_DMA;
+
+    if (p->armed++ == 0 && p->starve_start) {
+        p->stats.starved++;
+        p->stats.starved_ns += now_ns() - p->starve_start;
+        p->starve_start = 0;
+    }
+}
+
+//Arms every released slot whose turn has come
+static void arm_ready(axidma_pipeline *p) {
+    while (p->state[p->next_arm] == SLOT_READY) {
+        arm_slot(p, p->next_arm);
+        p->next_arm = (p->next_arm + 1) % p->num_slots;
+    }
+}
+
+static int slot_done(axidma_pipeline *p, unsigned i) {
+    sg_list *lst = p->slots[i];
+    return axidma_entry_done(lst, lst->sentinel.prev);
+}
+
+axidma_pipeline *axidma_pipeline_new(axidma_ctx *ctx, int is_s2mm,
+                                     unsigned num_slots, unsigned bufs_per_slot, unsigned buf_sz,
+                                     void *sg_buf, struct pinner_physlist const *sg_plist,
+                                     void *data_buf, struct pinner_physlist const *data_plist)
+{
+    if (!ctx || num_slots < 2 || bufs_per_slot == 0 || buf_sz == 0) {
+        fprintf(stderr, "axidma_pipeline_new: Invalid function argument\n");
+        return NULL;
+    }
+
+    //We need to choose where the DMA starts, and it only listens while the
+    //channel is stopped
+    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
+    uint32_t sr = is_s2mm ? regs->S2MM_DMASR : regs->MM2S_DMASR;
+    if (!(sr & DMASR_HALTED)) {
+        fprintf(stderr, "axidma_pipeline_new: channel is already running. Reset the DMA first\n");
+        return NULL;
+    }
+
+    axidma_pipeline *p = calloc(1, sizeof(axidma_pipeline));
+    if (!p) {
+        perror("Could not allocate pipeline");
+        return NULL;
+    }
+    p->ctx = ctx;
+    p->is_s2mm = is_s2mm;
+    p->num_slots = num_slots;
+    p->bufs_per_slot = bufs_per_slot;
+    p->slots = calloc(num_slots, sizeof(sg_list *));
+    p->state = calloc(num_slots, sizeof(slot_state));
+    p->head_phys = calloc(num_slots, sizeof(uint64_t));
+    p->tail_phys = calloc(num_slots, sizeof(uint64_t));
+    if (!p->slots || !p->state || !p->head_phys || !p->tail_phys) {
+        perror("Could not allocate pipeline");
+        goto axidma_pipeline_new_error;
+    }
+
+    //Each slot's list picks up in the SG and data memory where the last one
+    //left off
+    unsigned sg_offset = 0, data_offset = 0;
+    for (unsigned i = 0; i < num_slots; i++) {
+        sg_list *lst = axidma_list_new(sg_buf, sg_plist, data_buf, data_plist);
+        if (!lst) goto axidma_pipeline_new_error;
+        p->slots[i] = lst;
+        lst->sg_offset = sg_offset;
+        lst->data_offset = data_offset;
+
+        for (unsigned j = 0; j < bufs_per_slot; j++) {
+            if (axidma_add_entry(lst, buf_sz) != ADD_ENTRY_SUCCESS) {
+                fprintf(stderr, "axidma_pipeline_new: not enough memory for %u slots of %u x %u bytes\n", num_slots, bufs_per_slot, buf_sz);
+                goto axidma_pipeline_new_error;
+            }
+        }
+
+        sg_offset = lst->sg_offset;
+        data_offset = lst->data_offset;
+        p->head_phys[i] = axidma_list_head_phys(lst);
+        p->tail_phys[i] = axidma_list_tail_phys(lst);
+        lst->is_s2mm = is_s2mm;
+        p->state[i] = is_s2mm ? SLOT_READY : SLOT_FREE;
+    }
+
+    //Start receiving into every slot. MM2S waits until there's something to
+    //send
+    arm_ready(p);
+
+    return p;
+
+    axidma_pipeline_new_error:
+    axidma_pipeline_del(p);
+    return NULL;
+}
+
+void axidma_pipeline_del(axidma_pipeline *p) {
+    if (!p) return;
+    if (p->slots) {
+        for (unsigned i = 0; i < p->num_slots; i++) axidma_list_del(p->slots[i]);
+    }
+    free(p->slots);
+    free(p->state);
+    free(p->head_phys);
+    free(p->tail_phys);
+    free(p);
+}
+
+//Hands out the next slot, which we know is ready
+static int take_slot(axidma_pipeline *p) {
+    unsigned i = p->next_out;
+
+    if (p->state[i] == SLOT_DMA) {
+        p->stats.slots_done++;
+        if (--p->armed == 0) p->starve_start = now_ns();
+    }
+
+    //Let the user walk through the buffers from the start
+    p->slots[i]->to_vist = p->slots[i]->sentinel.next;
+    p->state[i] = SLOT_APP;
+    p->next_out = (i + 1) % p->num_slots;
+    return i;
+}
+
+int axidma_pipeline_next(axidma_pipeline *p, int use_irq) {
+    unsigned i = p->next_out;
+
+    switch (p->state[i]) {
+    case SLOT_FREE:
+        return take_slot(p);
+    case SLOT_DMA:
+        if (!slot_done(p, i)) {
+            uint64_t start = now_ns();
+            if (axidma_wait_list(p->ctx, p->slots[i], use_irq) < 0) return -1;
+            p->stats.app_waits++;
+            p->stats.app_wait_ns += now_ns() - start;
+        }
+        return take_slot(p);
+    default:
+        fprintf(stderr, "axidma_pipeline_next: all slots are in use\n");
+        return -1;
+    }
+}
+
+int axidma_pipeline_try_next(axidma_pipeline *p) {
+    unsigned i = p->next_out;
+
+    if (p->state[i] == SLOT_FREE || (p->state[i] == SLOT_DMA && slot_done(p, i))) {
+        return take_slot(p);
+    }
+    return -1;
+}
+
+unsigned axidma_pipeline_num_slots(axidma_pipeline const *p) {
+    return p->num_slots;
+}
+
+unsigned axidma_pipeline_bufs_per_slot(axidma_pipeline const *p) {
+    return p->bufs_per_slot;
+}
+
+int axidma_pipeline_is_s2mm(axidma_pipeline const *p) {
+    return p->is_s2mm;
+}
+
+int axidma_pipeline_dma_has_next(axidma_pipeline const *p) {
+    return p->state[p->next_out] == SLOT_DMA;
+}
+
+void axidma_pipeline_set_coherent(axidma_pipeline *p, int sg_coherent, int data_coherent) {
+    for (unsigned i = 0; i < p->num_slots; i++) {
+        axidma_list_set_coherent(p->slots[i], sg_coherent, data_coherent);
+    }
+}
+
+sg_list *axidma_pipeline_slot(axidma_pipeline *p, unsigned slot) {
+    return (slot < p->num_slots) ? p->slots[slot] : NULL;
+}
+
+void axidma_pipeline_release(axidma_pipeline *p, unsigned slot) {
+    if (slot >= p->num_slots || p->state[slot] != SLOT_APP) {
+        fprintf(stderr, "axidma_pipeline_release: slot %u isn't yours to release\n", slot);
+        return;
+    }
+
+    p->state[slot] = SLOT_READY;
+    arm_ready(p);
+}
+
+axidma_pipeline_stats axidma_pipeline_get_stats(axidma_pipeline *p) {
+    return p->stats;
+}
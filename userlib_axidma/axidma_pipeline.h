@@ -0,0 +1,98 @@
+#ifndef AXIDMA_PIPELINE_H
+#define AXIDMA_PIPELINE_H 1
+
+//Keeps one AXI DMA channel busy with a ring of N "slots" (think frames), so
+//the DMA can fill or drain one slot while your code works on another.
+//
+//Each slot is an sg_list with a fixed set of equal-sized buffers. The slots'
+//descriptors are chained into a ring, so the DMA goes straight from the end
+//of one slot into the next without waiting for software.
+//
+//S2MM (receive) pipelines start with every slot handed to the DMA:
+//
+//    axidma_pipeline *p = axidma_pipeline_new(ctx, 1, 3, 16, 4096, ...);
+//    for (;;) {
+//        int slot = axidma_pipeline_next(p, 1); //Wait for a full slot
+//        sg_list *lst = axidma_pipeline_slot(p, slot);
+//        ... axidma_dequeue_s2mm_buf(lst) and process ...
+//        axidma_pipeline_release(p, slot); //Give it back to the DMA
+//    }
+//
+//MM2S (send) pipelines start with every slot empty and owned by you:
+//
+//    int slot = axidma_pipeline_next(p, 1); //Wait for an empty slot
+//    ... fill its buffers (axidma_dequeue_s2mm_buf works here too) ...
+//    axidma_pipeline_release(p, slot); //Send it
+//
+//Slots come out of axidma_pipeline_next in ring order. You can hold on to
+//several at once and release them in any order, but the DMA only gets them
+//back in ring order, so holding one slot for a long time stalls the rest
+//behind it. If you hold every slot, the DMA has nothing to do; S2MM then
+//pushes back on the stream (which is usually what you want), and the
+//pipeline counts it as starvation in its stats.
+//
+//A pipeline owns its channel. Don't use other transfer functions on the
+//same channel while it exists. Not thread-safe; use it from one thread.
+
+#include <stdint.h>
+#include "axidma.h"
+
+typedef struct axidma_pipeline axidma_pipeline;
+
+//Makes a pipeline of num_slots slots, each with bufs_per_slot buffers of
+//buf_sz bytes, on the S2MM channel (is_s2mm = 1) or the MM2S channel. The
+//descriptors and buffers are carved out of the given SG and data memory,
+//just like axidma_list_new. S2MM pipelines start receiving right away.
+//Returns NULL on error (including not enough memory for all the slots)
+axidma_pipeline *axidma_pipeline_new(axidma_ctx *ctx, int is_s2mm,
+                                     unsigned num_slots, unsigned bufs_per_slot, unsigned buf_sz,
+                                     void *sg_buf, struct pinner_physlist const *sg_plist,
+                                     void *data_buf, struct pinner_physlist const *data_plist);
+
+//Frees the pipeline. Doesn't stop the DMA: reset the channel first if it
+//might still be running
+void axidma_pipeline_del(axidma_pipeline *p);
+
+//Waits until the next slot in ring order is ready for you (S2MM: filled,
+//MM2S: sent), and returns its index. With use_irq, sleeps on the interrupt;
+//otherwise spins. Returns -1 if the DMA stopped with an error, or if you
+//already hold every slot
+int axidma_pipeline_next(axidma_pipeline *p, int use_irq);
+
+//Like axidma_pipeline_next, but returns -1 straight away if the slot isn't
+//ready yet
+int axidma_pipeline_try_next(axidma_pipeline *p);
+
+//What the pipeline was made with
+unsigned axidma_pipeline_num_slots(axidma_pipeline const *p);
+unsigned axidma_pipeline_bufs_per_slot(axidma_pipeline const *p);
+int axidma_pipeline_is_s2mm(axidma_pipeline const *p);
+
+//Returns nonzero if the next slot in ring order is out with the DMA, i.e.
+//axidma_pipeline_next would wait for it instead of failing because you still
+//hold it (or a slot in front of it)
+int axidma_pipeline_dma_has_next(axidma_pipeline const *p);
+
+//Tells the pipeline whether its SG and data memory need cache maintenance
+//(see axidma_list_set_coherent). Applies to every slot from the next time
+//it's handed to the DMA
+void axidma_pipeline_set_coherent(axidma_pipeline *p, int sg_coherent, int data_coherent);
+
+//Returns the sg_list for a slot. Use axidma_dequeue_s2mm_buf on it to walk
+//through the slot's buffers
+sg_list *axidma_pipeline_slot(axidma_pipeline *p, unsigned slot);
+
+//Gives a slot you got from axidma_pipeline_next back to the DMA
+void axidma_pipeline_release(axidma_pipeline *p, unsigned slot);
+
+typedef struct {
+    uint64_t slots_done; //Slots the DMA has finished
+    uint64_t app_waits; //Times axidma_pipeline_next had to wait for the DMA
+    uint64_t app_wait_ns; //Total time spent waiting
+    uint64_t starved; //Times the DMA ran out of slots because you had them all
+    uint64_t starved_ns; //Roughly how long the DMA sat idle because of that
+} axidma_pipeline_stats;
+
+axidma_pipeline_stats axidma_pipeline_get_stats(axidma_pipeline *p);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef AXIDMA_PRIVATE_H
+#define AXIDMA_PRIVATE_H 1
+
+//Stuff shared between the files in this library that users of axidma.h
+//shouldn't need to see
+
+#include <stdint.h>
+#include "axidma.h"
+
+#define AXI_DMA_REG_SPAN 0x1000
+
+//Format of the AXI DMA's registers
+typedef struct {
+    uint32_t    MM2S_DMACR;
+    uint32_t    MM2S_DMASR;
+    uint32_t    MM2S_curdesc_lsb;
+    uint32_t    MM2S_curdesc_msb;
+    uint32_t    MM2S_taildesc_lsb;
+    uint32_t    MM2S_taildesc_msb;
+
+    uint32_t    unused[6];
+
+    uint32_t    S2MM_DMACR;
+    uint32_t    S2MM_DMASR;
+    uint32_t    S2MM_curdesc_lsb;
+    uint32_t    S2MM_curdesc_msb;
+    uint32_t    S2MM_taildesc_lsb;
+    uint32_t    S2MM_taildesc_msb;
+} axidma_regs;
+
+//Bits in DMACR
+#define DMACR_RS            (1 << 0)
+#define DMACR_RESET         (1 << 2)
+#define DMACR_IOC_IRQ_EN    (1 << 12)
+#define DMACR_DLY_IRQ_EN    (1 << 13)
+#define DMACR_ERR_IRQ_EN    (1 << 14)
+#define DMACR_IRQ_THRESH_SHIFT 16
+#define DMACR_IRQ_THRESH_MASK  (0xFF << DMACR_IRQ_THRESH_SHIFT)
+
+//Bits in DMASR
+#define DMASR_HALTED        (1 << 0)
+#define DMASR_IDLE          (1 << 1)
+#define DMASR_SG_INCLD      (1 << 3)
+#define DMASR_DMA_INT_ERR   (1 << 4)
+#define DMASR_DMA_SLV_ERR   (1 << 5)
+#define DMASR_DMA_DEC_ERR   (1 << 6)
+#define DMASR_SG_INT_ERR    (1 << 8)
+#define DMASR_SG_SLV_ERR    (1 << 9)
+#define DMASR_SG_DEC_ERR    (1 << 10)
+#define DMASR_IOC_IRQ       (1 << 12)
+#define DMASR_DLY_IRQ       (1 << 13)
+#define DMASR_ERR_IRQ       (1 << 14)
+//All the write-1-to-clear bits
+#define DMASR_IRQ_MASK      (DMASR_IOC_IRQ | DMASR_DLY_IRQ | DMASR_ERR_IRQ)
+#define DMASR_ERR_MASK      (DMASR_DMA_INT_ERR | DMASR_DMA_SLV_ERR | DMASR_DMA_DEC_ERR | \
+                             DMASR_SG_INT_ERR | DMASR_SG_SLV_ERR | DMASR_SG_DEC_ERR)
+
+//Lower-level pieces of axidma_s2mm_transfer and axidma_mm2s_transfer, for
+//code that needs to keep a channel busy with several lists at once.
+
+//Writes all of lst's descriptors to RAM (clearing their status) and resets
+//it for axidma_dequeue_s2mm_buf. The last descriptor points at wrap_phys, or
+//back at lst's own first descriptor if wrap_phys is 0. Also does the cache
+//maintenance (see axidma_list_set_coherent) that has to happen before the
+//DMA starts on the list
+void axidma_write_list(sg_list *lst, int is_s2mm, uint64_t wrap_phys);
+
+//Physical addresses of the first and last descriptors in a (non-empty) list
+uint64_t axidma_list_head_phys(sg_list const *lst);
+uint64_t axidma_list_tail_phys(sg_list const *lst);
+
+//Starts a channel (from curdesc_phys) if it isn't running already, and lets
+//it run up to and including taildesc_phys. While the channel is running, the
+//DMA carries on from wherever it is, so taildesc_phys must be reachable from
+//there by following next_desc
+void axidma_kick(axidma_ctx *ctx, int is_s2mm, uint64_t curdesc_phys, uint64_t taildesc_phys);
+
+//Makes the channel raise IOC once every pkts packets (1 to 255) instead of
+//after every one. Only change this while the channel is idle: the DMA keeps
+//counting from wherever it was
+void axidma_set_irq_threshold(axidma_ctx *ctx, int is_s2mm, unsigned pkts);
+
+//Cache maintenance for memory the DMA doesn't snoop. Clean after the CPU
+//writes, so the data reaches RAM. Invalidate before the CPU reads what the
+//DMA wrote (this also cleans, since dc ivac isn't allowed in userspace, so
+//don't use it on lines the CPU has written since the last clean). Both wait
+//for the maintenance to finish. They do nothing except on aarch64
+void axidma_clean_range(void const volatile *p, unsigned long n);
+void axidma_inval_range(void const volatile *p, unsigned long n);
+
+//Whether the DMA has finished with entry e of lst (which must have been
+//written out with axidma_write_list). Invalidates the descriptor first,
+//unless lst is sg_coherent
+int axidma_entry_done(sg_list const *lst, sg_entry const *e);
+
+//Converts an offset into the buffer described by plist to a physical address.
+//Returns 0 if it's past the end
+uint64_t virt_to_phys(struct pinner_physlist const *plist, unsigned offset);
+
+//Makes out describe bytes [start, start + len) of the buffer src describes,
+//so one pinned buffer can be carved up between several sg_lists. Returns the
+//number of bytes out covers, which is less than len if src runs out first
+unsigned axidma_slice_physlist(struct pinner_physlist const *src, unsigned start, unsigned len,
+                               struct pinner_physlist *out);
+
+#endif
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_private.h"
+#include "axidma_sched.h"
+#include "spsc_ring.h"
+
+#define DEFAULT_DEPTH 2
+#define DEFAULT_CHAIN_BYTES (64 << 10)
+#define DEFAULT_QUANTUM 4096
+
+typedef struct {
+    spsc_ring submit; //Tenant pushes, we pop
+    spsc_ring done; //We push, tenant pops
+
+    //Only touched by the tenant
+    _Alignas(SPSC_CACHE_LINE) unsigned outstanding;
+    unsigned queue_len;
+
+    //Only touched by the DMA thread
+    _Alignas(SPSC_CACHE_LINE) int is_control;
+    unsigned weight;
+    axidma_sched_req *held; //Popped off submit, but hasn't fit in a chain yet
+    unsigned deficit; //Bytes this tenant may still send in its current turn
+    int in_turn;
+    axidma_sched_tenant_stats stats;
+} tenant;
+
+//One chain of descriptors. The chains are linked into a ring, so the DMA
+//goes from one to the next by itself
+typedef struct {
+    sg_list *lst;
+    struct pinner_physlist sg_plist; //This chain's piece of the SG buffer
+    uint64_t head_phys;
+
+    axidma_sched_req **reqs;
+    unsigned *req_tenant;
+    unsigned nreqs;
+    unsigned max_reqs;
+} chain;
+
+struct axidma_sched {
+    axidma_ctx *ctx;
+    unsigned chain_bytes;
+    unsigned quantum;
+
+    tenant **tenants;
+    unsigned num_tenants;
+    unsigned *ctl; //IDs of the control tenants...
+    unsigned num_ctl;
+    unsigned *bulk; //...and the bulk ones
+    unsigned num_bulk;
+    unsigned ctl_pos; //Which control tenant goes first next time
+    unsigned drr_pos; //Whose turn it is among the bulk tenants
+
+    chain *chains;
+    unsigned depth;
+    unsigned next; //Next chain to fill
+    unsigned oldest; //Oldest chain out with the DMA
+    unsigned in_flight;
+    int failed;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned physlist_len(struct pinner_physlist const *plist) {
+    unsigned len = 0;
+    for (unsigned i = 0; i < plist->num_entries; i++) len += plist->entries[i].len;
+    return len;
+}
+
+axidma_sched *axidma_sched_new(axidma_ctx *ctx, void *sg_buf, struct pinner_physlist const *sg_plist,
+                               axidma_sched_cfg const *cfg)
+{
+    if (!ctx || !sg_buf || !sg_plist) {
+        fprintf(stderr, "axidma_sched_new: Invalid function argument\n");
+        return NULL;
+    }
+
+    volatile axidma_regs *regs = (volatile axidma_regs *) ctx->reg_base;
+    if (!(regs->MM2S_DMASR & DMASR_HALTED)) {
+        fprintf(stderr, "axidma_sched_new: MM2S channel is already running. Reset the DMA first\n");
+        return NULL;
+    }
+
+    axidma_sched *s = calloc(1, sizeof(axidma_sched));
+    if (!s) {
+        perror("Could not allocate scheduler");
+        return NULL;
+    }
+    s->ctx = ctx;
+    s->depth = (cfg && cfg->depth) ? cfg->depth : DEFAULT_DEPTH;
+    s->chain_bytes = (cfg && cfg->chain_bytes) ? cfg->chain_bytes : DEFAULT_CHAIN_BYTES;
+    s->quantum = (cfg && cfg->quantum) ? cfg->quantum : DEFAULT_QUANTUM;
+    if (s->depth < 2) s->depth = 2;
+
+    //Descriptors have to stay 64-byte aligned
+    unsigned per_chain = (physlist_len(sg_plist) / s->depth) & ~63U;
+    if (per_chain < sizeof(sg_descriptor)) {
+        fprintf(stderr, "axidma_sched_new: SG buffer is too small for %u chains\n", s->depth);
+        goto axidma_sched_new_error;
+    }
+
+    s->chains = calloc(s->depth, sizeof(chain));
+    if (!s->chains) {
+        perror("Could not allocate chains");
+        goto axidma_sched_new_error;
+    }
+    for (unsigned i = 0; i < s->depth; i++) {
+        chain *c = &s->chains[i];
+        axidma_slice_physlist(sg_plist, i * per_chain, per_chain, &c->sg_plist);
+        c->lst = axidma_list_new((char *) sg_buf + i * per_chain, &c->sg_plist, NULL, NULL);
+        c->max_reqs = per_chain / sizeof(sg_descriptor);
+        c->reqs = calloc(c->max_reqs, sizeof(axidma_sched_req *));
+        c->req_tenant = calloc(c->max_reqs, sizeof(unsigned));
+        if (!c->lst || !c->reqs || !c->req_tenant) {
+            perror("Could not allocate chains");
+            goto axidma_sched_new_error;
+        }
+        c->lst->is_s2mm = 0;
+        if (cfg) axidma_list_set_coherent(c->lst, cfg->sg_coherent, cfg->data_coherent);
+        c->head_phys = virt_to_phys(&c->sg_plist, 0);
+    }
+
+    return s;
+
+    axidma_sched_new_error:
+    axidma_sched_del(s);
+    return NULL;
+}
+
+void axidma_sched_del(axidma_sched *s) {
+    if (!s) return;
+
+    for (unsigned i = 0; i < s->num_tenants; i++) {
+        spsc_ring_destroy(&s->tenants[i]->submit);
+        spsc_ring_destroy(&s->tenants[i]->done);
+        free(s->tenants[i]);
+    }
+    free(s->tenants);
+    free(s->ctl);
+    free(s->bulk);
+
+    if (s->chains) {
+        for (unsigned i = 0; i < s->depth; i++) {
+            axidma_list_del(s->chains[i].lst);
+            free(s->chains[i].reqs);
+            free(s->chains[i].req_tenant);
+        }
+    }
+    free(s->chains);
+    free(s);
+}
+
+int axidma_sched_add_tenant(axidma_sched *s, int is_control, unsigned weight, unsigned queue_len) {
+    if (!s || queue_len == 0 || (!is_control && weight == 0)) {
+        fprintf(stderr, "axidma_sched_add_tenant: Invalid function argument\n");
+        return -1;
+    }
+
+    unsigned id = s->num_tenants;
+    tenant **tenants = realloc(s->tenants, (id + 1) * sizeof(tenant *));
+    unsigned *ctl = realloc(s->ctl, (id + 1) * sizeof(unsigned));
+    unsigned *bulk = realloc(s->bulk, (id + 1) * sizeof(unsigned));
+    if (tenants) s->tenants = tenants;
+    if (ctl) s->ctl = ctl;
+    if (bulk) s->bulk = bulk;
+    if (!tenants || !ctl || !bulk) {
+        perror("Could not add tenant");
+        return -1;
+    }
+
+    tenant *t = aligned_alloc(SPSC_CACHE_LINE, sizeof(tenant));
+    if (!t) {
+        perror("Could not add tenant");
+        return -1;
+    }
+    memset(t, 0, sizeof(tenant));
+    t->queue_len = queue_len;
+    t->is_control = is_control;
+    t->weight = weight;
+    //Nobody can have more than queue_len requests anywhere, so neither ring
+    //can overflow
+    if (spsc_ring_init(&t->submit, queue_len) < 0 || spsc_ring_init(&t->done, queue_len) < 0) {
+        perror("Could not add tenant");
+        spsc_ring_destroy(&t->submit);
+        free(t);
+        return -1;
+    }
+
+    s->tenants[id] = t;
+    s->num_tenants++;
+    if (is_control) s->ctl[s->num_ctl++] = id;
+    else s->bulk[s->num_bulk++] = id;
+    return id;
+}
+
+int axidma_sched_submit(axidma_sched *s, unsigned tenant_id, axidma_sched_req *r) {
+    tenant *t = s->tenants[tenant_id];
+    if (!r || !r->buf || r->len == 0 || r->len > r->buf->size) {
+        fprintf(stderr, "axidma_sched_submit: Invalid function argument\n");
+        return -1;
+    }
+    if (t->outstanding == t->queue_len) return -1;
+
+    r->status = 0;
+    r->submit_ns = now_ns();
+    spsc_ring_push(&t->submit, r);
+    t->outstanding++;
+    return 0;
+}
+
+axidma_sched_req *axidma_sched_reap(axidma_sched *s, unsigned tenant_id) {
+    tenant *t = s->tenants[tenant_id];
+    axidma_sched_req *r = spsc_ring_pop(&t->done);
+    if (r) t->outstanding--;
+    return r;
+}
+
+//Returns the tenant's next request without taking it, or NULL
+static axidma_sched_req *peek(tenant *t) {
+    if (!t->held) t->held = spsc_ring_pop(&t->submit);
+    return t->held;
+}
+
+//Adds a tenant's next request to a chain. Returns -1 if the chain is full
+static int add_req(chain *c, tenant *t, unsigned id) {
+    axidma_sched_req *r = t->held;
+    if (c->nreqs == c->max_reqs) return -1;
+    if (axidma_add_arena_buf(c->lst, r->buf, r->len) != ADD_ENTRY_SUCCESS) return -1;
+
+    c->reqs[c->nreqs] = r;
+    c->req_tenant[c->nreqs] = id;
+    c->nreqs++;
+    t->held = NULL;
+    return 0;
+}
+
+//Hands a tenant's next request straight back with status -1. For requests
+//that didn't fit in an empty chain, and so never will
+static void reject_req(tenant *t) {
+    axidma_sched_req *r = t->held;
+    t->held = NULL;
+    r->status = -1;
+    r->done_ns = now_ns();
+    spsc_ring_push(&t->done, r);
+}
+
+//Fills a chain: every waiting control request first, then bulk requests by
+//deficit round robin until the chain has chain_bytes of them. Returns the
+//number of requests in it
+static unsigned build_chain(axidma_sched *s, chain *c) {
+    axidma_clear_list(c->lst);
+    c->nreqs = 0;
+
+    for (unsigned i = 0; i < s->num_ctl; i++) {
+        unsigned id = s->ctl[(s->ctl_pos + i) % s->num_ctl];
+        tenant *t = s->tenants[id];
+        while (peek(t)) {
+            if (add_req(c, t, id) < 0) {
+                if (c->nreqs) return c->nreqs;
+                reject_req(t);
+            }
+        }
+    }
+    if (s->num_ctl) s->ctl_pos = (s->ctl_pos + 1) % s->num_ctl;
+
+    unsigned bulk_bytes = 0;
+    unsigned idle = 0; //Bulk tenants in a row with nothing to send
+    while (idle < s->num_bulk) {
+        unsigned id = s->bulk[s->drr_pos];
+        tenant *t = s->tenants[id];
+
+        if (!peek(t)) {
+            //Classic DRR: you don't get to save up while you're idle
+            t->deficit = 0;
+            t->in_turn = 0;
+            s->drr_pos = (s->drr_pos + 1) % s->num_bulk;
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        if (!t->in_turn) {
+            t->deficit += s->quantum * t->weight;
+            t->in_turn = 1;
+        }
+
+        while (peek(t) && t->held->len <= t->deficit) {
+            //Always let at least one through, or a big request could never go
+            if (bulk_bytes && bulk_bytes + t->held->len > s->chain_bytes) return c->nreqs;
+            if (add_req(c, t, id) < 0) {
+                if (c->nreqs) return c->nreqs;
+                reject_req(t);
+                continue;
+            }
+            t->deficit -= c->reqs[c->nreqs - 1]->len;
+            bulk_bytes += c->reqs[c->nreqs - 1]->len;
+        }
+
+        //Turn's over. Whatever's left of the deficit carries over if there's
+        //still something queued
+        if (!peek(t)) t->deficit = 0;
+        t->in_turn = 0;
+        s->drr_pos = (s->drr_pos + 1) % s->num_bulk;
+        if (bulk_bytes >= s->chain_bytes) break;
+    }
+
+    return c->nreqs;
+}
+
+//Gives a chain's requests back to their tenants
+static void finish_chain(axidma_sched *s, chain *c, int status) {
+    uint64_t now = now_ns();
+    for (unsigned i = 0; i < c->nreqs; i++) {
+        axidma_sched_req *r = c->reqs[i];
+        tenant *t = s->tenants[c->req_tenant[i]];
+        r->status = status;
+        r->done_ns = now;
+        if (status == 0) {
+            t->stats.reqs++;
+            t->stats.bytes += r->len;
+        }
+        spsc_ring_push(&t->done, r);
+    }
+    c->nreqs = 0;
+}
+
+int axidma_sched_poll(axidma_sched *s) {
+    if (s->failed) return -1;
+
+    volatile axidma_regs *regs = (volatile axidma_regs *) s->ctx->reg_base;
+
+    //The DMA finishes chains in order, so we only need to look at the oldest
+    while (s->in_flight) {
+        chain *c = &s->chains[s->oldest];
+        if (!axidma_entry_done(c->lst, c->lst->sentinel.prev)) {
+            if (regs->MM2S_DMASR & DMASR_ERR_MASK) {
+                fprintf(stderr, "axidma_sched_poll: DMA error (DMASR = 0x%08x)\n", regs->MM2S_DMASR);
+                while (s->in_flight) {
+                    finish_chain(s, &s->chains[s->oldest], -1);
+                    s->oldest = (s->oldest + 1) % s->depth;
+                    s->in_flight--;
+                }
+                s->failed = 1;
+                return -1;
+            }
+            break;
+        }
+
+        finish_chain(s, c, 0);
+        s->oldest = (s->oldest + 1) % s->depth;
+        s->in_flight--;
+    }
+
+    int started = 0;
+    while (s->in_flight < s->depth) {
+        chain *c = &s->chains[s->next];
+        unsigned n = build_chain(s, c);
+        if (n == 0) break;
+
+        //The last descriptor leads into the next chain, so the DMA can carry
+        //on there after the next taildesc write
+        axidma_write_list(c->lst, 0, s->chains[(s->next + 1) % s->depth].head_phys);
+        axidma_kick(s->ctx, 0, axidma_list_head_phys(c->lst), axidma_list_tail_phys(c->lst));
+
+        s->next = (s->next + 1) % s->depth;
+        s->in_flight++;
+        started += n;
+    }
+
+    return started;
+}
+
+axidma_sched_tenant_stats axidma_sched_get_stats(axidma_sched *s, unsigned tenant_id) {
+    return s->tenants[tenant_id]->stats;
+}
@@ -0,0 +1,110 @@
+#ifndef AXIDMA_SCHED_H
+#define AXIDMA_SCHED_H 1
+
+//Shares one MM2S channel between several "tenants" (producer threads), with
+//priorities and weights.
+//
+//Only one process can open the axidma module, and an axidma_ctx belongs to
+//one thread, so everyone else sends through this. One thread (the "DMA
+//thread") owns the context and calls axidma_sched_poll in a loop. Tenants
+//hand it requests through lock-free rings (see spsc_ring.h), and get them
+//back once they've been sent.
+//
+//There are two classes of tenant:
+//  - Control tenants always go first. Every chain starts with whatever
+//    control requests are waiting
+//  - Bulk tenants share what's left by weight (deficit round robin, counted
+//    in bytes), so a tenant with weight 2 gets twice the bandwidth of one
+//    with weight 1 when both have work queued
+//
+//To keep control traffic from getting stuck behind bulk data, each chain
+//handed to the DMA is limited to chain_bytes of bulk data, and only depth
+//chains are queued up in the DMA at once. A control request waits for at
+//most depth chains (plus one bulk request, since requests are never split:
+//each one is a whole AXI stream packet).
+//
+//    axidma_sched_cfg cfg = {.depth = 2, .chain_bytes = 32 << 10, .quantum = 4096};
+//    axidma_sched *s = axidma_sched_new(ctx, sg_buf, &sg_plist, &cfg);
+//    int ctl = axidma_sched_add_tenant(s, 1, 1, 64);
+//    int bulk = axidma_sched_add_tenant(s, 0, 3, 256);
+//    ... start the tenants' threads ...
+//    while (running) axidma_sched_poll(s);
+//
+//    //In a tenant thread. buf is from an axidma_arena
+//    axidma_sched_req r = {.buf = &buf, .len = len};
+//    while (axidma_sched_submit(s, bulk, &r) < 0) ... queue full ...
+//    ...
+//    axidma_sched_req *done = axidma_sched_reap(s, bulk); //NULL if nothing's done
+//
+//axidma_sched_submit and axidma_sched_reap for a tenant must only be called
+//from one thread at a time. Everything else belongs to the DMA thread. Add
+//all the tenants before anyone starts submitting.
+
+#include <stdint.h>
+#include "axidma.h"
+#include "axidma_arena.h"
+
+//One transfer. Owned by the tenant, who must leave it (and its buffer) alone
+//from axidma_sched_submit until it comes back from axidma_sched_reap
+typedef struct {
+    axidma_arena_buf const *buf; //What to send
+    unsigned len; //How much of it. Goes out as one packet
+
+    void *user; //Yours
+
+    //Filled in by the scheduler
+    int status; //0 if it was sent, -1 if the DMA failed or it needs more
+                //descriptors than fit in one chain
+    uint64_t submit_ns; //CLOCK_MONOTONIC times
+    uint64_t done_ns;
+} axidma_sched_req;
+
+typedef struct {
+    unsigned depth; //Chains queued in the DMA at once (at least 2, default 2)
+    unsigned chain_bytes; //Bulk bytes per chain (default 64 KB)
+    unsigned quantum; //Bytes a weight-1 bulk tenant gets per round (default 4 KB)
+    int sg_coherent; //Skip cache maintenance on sg_buf, or on the requests'
+    int data_coherent; //buffers. See axidma_list_set_coherent
+} axidma_sched_cfg;
+
+typedef struct axidma_sched axidma_sched;
+
+//Makes a scheduler for the MM2S channel of ctx, which must be halted. The
+//descriptors go in sg_buf, which is split evenly between the depth chains.
+//cfg can be NULL for the defaults. Returns NULL on error
+axidma_sched *axidma_sched_new(axidma_ctx *ctx, void *sg_buf, struct pinner_physlist const *sg_plist,
+                               axidma_sched_cfg const *cfg);
+
+//Frees the scheduler. Stop the tenants and reset the DMA first
+void axidma_sched_del(axidma_sched *s);
+
+//Adds a tenant. is_control picks the class, weight only matters for bulk
+//tenants, and queue_len is the most requests it can have outstanding
+//(submitted but not reaped). Returns the tenant's ID, or -1 on error
+int axidma_sched_add_tenant(axidma_sched *s, int is_control, unsigned weight, unsigned queue_len);
+
+//Tenant side. Queues a request. Returns 0 on success, or -1 if the tenant
+//already has queue_len requests outstanding or r is invalid (no buffer, or
+//len is 0 or bigger than the buffer)
+int axidma_sched_submit(axidma_sched *s, unsigned tenant, axidma_sched_req *r);
+
+//Tenant side. Returns a finished request (in the order they were sent), or
+//NULL if none are ready
+axidma_sched_req *axidma_sched_reap(axidma_sched *s, unsigned tenant);
+
+//DMA thread. Hands back finished requests and gives the DMA more work if it
+//has room. Never blocks. Returns the number of requests started, or -1 if
+//the DMA stopped with an error (in which case everything in flight comes
+//back with status -1, and the scheduler is no use until you reset the DMA
+//and make a new one)
+int axidma_sched_poll(axidma_sched *s);
+
+typedef struct {
+    uint64_t reqs; //Requests sent
+    uint64_t bytes; //Bytes sent
+} axidma_sched_tenant_stats;
+
+//DMA thread
+axidma_sched_tenant_stats axidma_sched_get_stats(axidma_sched *s, unsigned tenant);
+
+#endif
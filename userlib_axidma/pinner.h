@@ -7,6 +7,10 @@
 #define PINNER_PIN 1
 #define PINNER_UNPIN 2
 #define PINNER_FLUSH 3
+//Same as PINNER_PIN, but promises that the device will access the buffer 
+//coherently (e.g. through S_AXI_HPC with CCI snooping turned on). The driver
+//then skips all cache maintenance for it, and PINNER_FLUSH is a no-op.
+#define PINNER_PIN_COHERENT 4
 
 //Normally I would want this to be an opaque struct, but there's no easy way to
 //do that when kernel and userspace share a header
@@ -19,11 +19,9 @@ void pinner_close(int fd) {
     if (fd != -1) close(fd);
 }
 
-//Helper function to pin a buffer in RAM and get the returned handle and
-//physlist object. Returns -1 on error 
-int pin_buf(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p) {
+static int do_pin(int fd, unsigned cmd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p) {
     struct pinner_cmd pin_cmd = {
-        .cmd = PINNER_PIN,
+        .cmd = cmd,
         .usr_buf = buf,
         .usr_buf_sz = buf_sz,
         .handle = h,
@@ -50,6 +48,16 @@ int pin_buf(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct
     return 0;
 }
 
+//Helper function to pin a buffer in RAM and get the returned handle and
+//physlist object. Returns -1 on error 
+int pin_buf(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p) {
+    return do_pin(fd, PINNER_PIN, buf, buf_sz, h, p);
+}
+
+int pin_buf_coherent(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p) {
+    return do_pin(fd, PINNER_PIN_COHERENT, buf, buf_sz, h, p);
+}
+
 //Helper function to flush the cache on a pinned buffer. Returns -1 on error
 int flush_buf_cache(int fd, struct pinner_handle *h) {
     struct pinner_cmd flush_cmd = {
@@ -67,8 +75,7 @@ int flush_buf_cache(int fd, struct pinner_handle *h) {
     if (n < 0) {
         perror("Could not write pin command to pinner");
         return -1;
-    }    
-    sleep(3); //I don't know why, but sleeping seems to make it more consistent?
+    }
     return 0;
 }
 
@@ -11,7 +11,15 @@ void pinner_close(int fd);
 //physlist object. Returns -1 on error
 int pin_buf(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p);
 
-//Helper function to flush the cache on a pinned buffer. Returns -1 on error
+//Same as pin_buf, but tells the driver that the device accesses this buffer
+//coherently (S_AXI_HPC with CCI snooping on). You never need to call 
+//flush_buf_cache on a buffer pinned this way.
+int pin_buf_coherent(int fd, void *buf, unsigned buf_sz, struct pinner_handle *h, struct pinner_physlist *p);
+
+//Helper function to flush the cache on a pinned buffer. Returns -1 on error.
+//The transfer functions in axidma.h already do the cache maintenance they
+//need (for just the bytes they move), so this is only for data you pass to
+//the PL some other way
 int flush_buf_cache(int fd, struct pinner_handle *h);
 
 //Helper function to unpin a buffer. Returns -1 on error
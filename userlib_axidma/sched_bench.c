@@ -0,0 +1,385 @@
+//Fairness and tail-latency test for axidma_sched.h, on the software model in
+//axidma_model.h.
+//
+//Several bulk tenants with different weights keep the MM2S channel busy,
+//while a control tenant sends one small message at a time and times how
+//long each takes to get out. This runs twice:
+//
+//    sched    The control tenant is in the control class, and the bulk
+//             tenants share by weight
+//    noprio   What you get without a scheduler, when threads share the
+//             channel behind a mutex: everyone takes turns sending a whole
+//             chain (every tenant is bulk with weight 1, and the quantum is
+//             chain_bytes), so control messages queue up behind everyone
+//             else's data
+//
+//and prints each tenant's share of the bulk bandwidth next to the share its
+//weight entitles it to (all equal for noprio), the control latency percentiles, and Jain's fairness
+//index over (actual share / entitled share). It exits with an error unless
+//the index is at least 0.95 and control p99 latency is better with the
+//control class than without.
+//
+//    ./sched_bench [options]
+//        --weights LIST    Bulk tenants' weights (default 1,2,4)
+//        --bulk-size N     Bytes per bulk request (default 16384)
+//        --ctl-size N      Bytes per control message (default 64)
+//        --ctl-gap-us N    Pause between control messages (default 200)
+//        --secs S          Seconds per run (default 2)
+//        --depth N         Chains in the DMA at once (default 2)
+//        --chain-bytes N   Bulk bytes per chain (default 65536)
+//        --link-mbps N     How fast the model's MM2S stream drains, in MB/s
+//                          (default 2000). Without a limit, the model is so
+//                          fast that nothing ever queues up in the DMA
+//
+//The model, the DMA thread and every tenant are separate threads, so this
+//wants a few cores. Build with something like
+//    gcc -O2 -o sched_bench sched_bench.c axidma.c axidma_model.c axidma_arena.c
+//        axidma_sched.c pinner_fns.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_model.h"
+#include "axidma_arena.h"
+#include "axidma_sched.h"
+
+#define MAX_LIST 16
+#define SG_BYTES (256 << 10)
+#define DATA_BYTES (PINNER_MAX_PAGES << 12)
+#define BULK_QUEUE 32
+#define MAX_CTL_SAMPLES 100000
+
+typedef struct {
+    unsigned vals[MAX_LIST];
+    unsigned n;
+} uint_list;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int is_control;
+    unsigned weight;
+    unsigned req_sz;
+    axidma_arena_buf bufs[BULK_QUEUE];
+    axidma_sched_req reqs[BULK_QUEUE];
+    unsigned nbufs;
+    int err;
+} tenant_thread;
+
+static axidma_sched *sched;
+static volatile int stop;
+static unsigned ctl_gap_us = 200;
+static uint64_t *ctl_lat;
+static unsigned ctl_n;
+static double link_mbps = 2000;
+static uint64_t link_free_ns; //When the fake link is done with what it has
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_list(char const *s, uint_list *l) {
+    l->n = 0;
+    while (*s) {
+        char *end;
+        unsigned long v = strtoul(s, &end, 0);
+        if (end == s || l->n == MAX_LIST) return -1;
+        l->vals[l->n++] = v;
+        s = end;
+        if (*s == ',') s++;
+    }
+    return l->n ? 0 : -1;
+}
+
+static int cmp_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t const *sorted, unsigned n, double p) {
+    unsigned i = (unsigned) (p * (n - 1) + 0.5);
+    return sorted[i] / 1e3;
+}
+
+//Model MM2S sink that takes as long as a link of link_mbps would
+static void link_sink(void const *buf, unsigned len, int sof, int eof, void *arg) {
+    (void) buf; (void) sof; (void) eof; (void) arg;
+    uint64_t now = now_ns();
+    if (link_free_ns < now) link_free_ns = now;
+    link_free_ns += (uint64_t) (len * 1e3 / link_mbps);
+    while (now_ns() < link_free_ns) ;
+}
+
+//Keeps its queue full for as long as the test runs
+static void *bulk_main(void *arg) {
+    tenant_thread *t = (tenant_thread *) arg;
+    axidma_sched_req *free_reqs[BULK_QUEUE];
+    unsigned nfree = 0;
+
+    for (unsigned i = 0; i < t->nbufs; i++) {
+        t->reqs[i].buf = &t->bufs[i];
+        t->reqs[i].len = t->req_sz;
+        free_reqs[nfree++] = &t->reqs[i];
+    }
+
+    while (!stop) {
+        axidma_sched_req *r;
+        while ((r = axidma_sched_reap(sched, t->id)) != NULL) {
+            if (r->status != 0) t->err = 1;
+            free_reqs[nfree++] = r;
+        }
+        while (nfree && axidma_sched_submit(sched, t->id, free_reqs[nfree - 1]) == 0) nfree--;
+        sched_yield();
+    }
+    return NULL;
+}
+
+//Sends one message at a time and times it
+static void *ctl_main(void *arg) {
+    tenant_thread *t = (tenant_thread *) arg;
+    axidma_sched_req *r = &t->reqs[0];
+    r->buf = &t->bufs[0];
+    r->len = t->req_sz;
+
+    while (!stop && ctl_n < MAX_CTL_SAMPLES) {
+        if (axidma_sched_submit(sched, t->id, r) < 0) {
+            t->err = 1;
+            break;
+        }
+        axidma_sched_req *done;
+        while ((done = axidma_sched_reap(sched, t->id)) == NULL) {
+            if (stop) return NULL;
+            sched_yield();
+        }
+        if (done->status != 0) t->err = 1;
+        ctl_lat[ctl_n++] = done->done_ns - done->submit_ns;
+        usleep(ctl_gap_us);
+    }
+    return NULL;
+}
+
+typedef struct {
+    double share[MAX_LIST]; //Of the bulk bytes
+    double mbps[MAX_LIST];
+    double p50, p99, p999, max;
+    unsigned samples;
+    double jain;
+} run_result;
+
+//One complete run on a fresh model. Returns 0 on success
+static int run(char *sg, char *data, uint_list const *weights, unsigned bulk_sz, unsigned ctl_sz,
+               double secs, axidma_sched_cfg const *cfg, int ctl_is_control, run_result *res)
+{
+    static struct pinner_physlist sg_plist, data_plist;
+    static tenant_thread threads[MAX_LIST + 1];
+    unsigned nthreads = weights->n + 1;
+    unsigned started = 0;
+    int ret = -1;
+
+    axidma_arena *arena = NULL;
+    axidma_ctx *ctx = NULL;
+    axidma_model *m = axidma_model_new();
+    if (!m) return -1;
+    if (axidma_model_add_region(m, sg, SG_BYTES, &sg_plist) < 0) goto run_error;
+    if (axidma_model_add_region(m, data, DATA_BYTES, &data_plist) < 0) goto run_error;
+    axidma_model_set_sink(m, link_sink, NULL);
+    link_free_ns = 0;
+    ctx = axidma_model_ctx(m);
+    arena = axidma_arena_new();
+    if (!ctx || !arena || axidma_arena_add_region(arena, data, DATA_BYTES, &data_plist) < 0) goto run_error;
+
+    sched = axidma_sched_new(ctx, sg, &sg_plist, cfg);
+    if (!sched) goto run_error;
+
+    //Thread 0 is the control tenant
+    memset(threads, 0, sizeof(threads));
+    for (unsigned i = 0; i < nthreads; i++) {
+        tenant_thread *t = &threads[i];
+        t->is_control = (i == 0);
+        t->weight = (t->is_control || !ctl_is_control) ? 1 : weights->vals[i - 1];
+        t->req_sz = t->is_control ? ctl_sz : bulk_sz;
+        t->nbufs = t->is_control ? 1 : BULK_QUEUE;
+        t->id = axidma_sched_add_tenant(sched, t->is_control && ctl_is_control, t->weight, t->nbufs);
+        if (t->id < 0) goto run_error;
+        for (unsigned j = 0; j < t->nbufs; j++) {
+            if (axidma_arena_alloc(arena, t->req_sz, &t->bufs[j]) < 0) {
+                fprintf(stderr, "Out of buffer space\n");
+                goto run_error;
+            }
+        }
+    }
+
+    stop = 0;
+    ctl_n = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, i ? bulk_main : ctl_main, &threads[i])) {
+            perror("Could not start tenant");
+            stop = 1;
+            break;
+        }
+        started++;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t) (secs * 1e9);
+    int dma_err = 0;
+    while (!stop && now_ns() < end) {
+        int rc = axidma_sched_poll(sched);
+        if (rc < 0) {
+            dma_err = 1;
+            break;
+        }
+        if (rc == 0) sched_yield();
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    stop = 1;
+    for (unsigned i = 0; i < started; i++) pthread_join(threads[i].thread, NULL);
+    if (dma_err || started < nthreads) goto run_error;
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        if (threads[i].err) {
+            fprintf(stderr, "Tenant %u saw a failed request\n", i);
+            goto run_error;
+        }
+    }
+
+    //Bulk shares, and how they compare with the weights
+    double total_bytes = 0, total_weight = 0;
+    for (unsigned i = 1; i < nthreads; i++) {
+        total_bytes += axidma_sched_get_stats(sched, threads[i].id).bytes;
+        total_weight += threads[i].weight;
+    }
+    double sum = 0, sum_sq = 0;
+    for (unsigned i = 1; i < nthreads; i++) {
+        double bytes = axidma_sched_get_stats(sched, threads[i].id).bytes;
+        res->share[i - 1] = total_bytes ? bytes / total_bytes : 0;
+        res->mbps[i - 1] = bytes / elapsed / 1e6;
+        double x = res->share[i - 1] / (threads[i].weight / total_weight);
+        sum += x;
+        sum_sq += x * x;
+    }
+    res->jain = sum_sq ? sum * sum / (weights->n * sum_sq) : 0;
+
+    res->samples = ctl_n;
+    if (ctl_n == 0) {
+        fprintf(stderr, "Control tenant didn't get anything through\n");
+        goto run_error;
+    }
+    qsort(ctl_lat, ctl_n, sizeof(uint64_t), cmp_u64);
+    res->p50 = percentile_us(ctl_lat, ctl_n, 0.5);
+    res->p99 = percentile_us(ctl_lat, ctl_n, 0.99);
+    res->p999 = percentile_us(ctl_lat, ctl_n, 0.999);
+    res->max = ctl_lat[ctl_n - 1] / 1e3;
+    ret = 0;
+
+    run_error:
+    //Stop the model before freeing anything it might be looking at
+    if (ctx) axidma_close(ctx);
+    axidma_model_del(m);
+    axidma_sched_del(sched);
+    sched = NULL;
+    axidma_arena_del(arena);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    uint_list weights;
+    unsigned bulk_sz = 16384, ctl_sz = 64;
+    double secs = 2;
+    axidma_sched_cfg cfg = {.depth = 2, .chain_bytes = 64 << 10, .quantum = 4096};
+    int ret = 0;
+
+    parse_list("1,2,4", &weights);
+
+    for (int i = 1; i < argc; i++) {
+        char const *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "--weights") && next && !parse_list(next, &weights)) {
+            i++;
+        } else if (!strcmp(argv[i], "--bulk-size") && next) {
+            bulk_sz = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--ctl-size") && next) {
+            ctl_sz = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--ctl-gap-us") && next) {
+            ctl_gap_us = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--secs") && next) {
+            secs = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--depth") && next) {
+            cfg.depth = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--chain-bytes") && next) {
+            cfg.chain_bytes = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--link-mbps") && next) {
+            link_mbps = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Unrecognized option %s. See the top of sched_bench.c for usage\n", argv[i]);
+            return -1;
+        }
+    }
+    if (weights.n >= MAX_LIST || secs <= 0 || link_mbps <= 0 || bulk_sz == 0 || bulk_sz > AXIDMA_ARENA_MAX_SIZE ||
+        ctl_sz == 0 || ctl_sz > AXIDMA_ARENA_MAX_SIZE)
+    {
+        fprintf(stderr, "Bad options. See the top of sched_bench.c for usage\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < weights.n; i++) {
+        if (weights.vals[i] == 0) {
+            fprintf(stderr, "Weights have to be at least 1\n");
+            return -1;
+        }
+    }
+
+    char *sg = aligned_alloc(4096, SG_BYTES);
+    char *data = aligned_alloc(4096, DATA_BYTES);
+    ctl_lat = malloc(MAX_CTL_SAMPLES * sizeof(uint64_t));
+    if (!sg || !data || !ctl_lat) {
+        perror("Could not allocate buffers");
+        ret = -1;
+        goto cleanup;
+    }
+    memset(sg, 0, SG_BYTES);
+    memset(data, 0, DATA_BYTES);
+
+    run_result res[2];
+    char const *names[2] = {"sched", "noprio"};
+    double total_weight = 0;
+    for (unsigned i = 0; i < weights.n; i++) total_weight += weights.vals[i];
+
+    puts("mode,tenant,weight,MBps,share,entitled_share");
+    for (int mode = 0; mode < 2; mode++) {
+        axidma_sched_cfg mode_cfg = cfg;
+        if (mode == 1) mode_cfg.quantum = cfg.chain_bytes;
+        if (run(sg, data, &weights, bulk_sz, ctl_sz, secs, &mode_cfg, mode == 0, &res[mode]) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        for (unsigned i = 0; i < weights.n; i++) {
+            unsigned w = (mode == 0) ? weights.vals[i] : 1;
+            printf("%s,bulk%u,%u,%.1f,%.3f,%.3f\n", names[mode], i, w, res[mode].mbps[i], res[mode].share[i],
+                (mode == 0) ? w / total_weight : 1.0 / weights.n);
+        }
+    }
+
+    puts("\nmode,ctl_msgs,ctl_p50_us,ctl_p99_us,ctl_p999_us,ctl_max_us,jain_index");
+    for (int mode = 0; mode < 2; mode++) {
+        printf("%s,%u,%.1f,%.1f,%.1f,%.1f,%.4f\n", names[mode], res[mode].samples,
+            res[mode].p50, res[mode].p99, res[mode].p999, res[mode].max, res[mode].jain);
+    }
+
+    int fair = res[0].jain >= 0.95;
+    int fast = res[0].p99 < res[1].p99;
+    printf("\nfairness: %s\ncontrol latency: %s\n", fair ? "PASS" : "FAIL", fast ? "PASS" : "FAIL");
+    if (!fair || !fast) ret = 1;
+
+    cleanup:
+    free(sg);
+    free(data);
+    free(ctl_lat);
+    return ret;
+}
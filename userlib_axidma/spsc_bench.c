@@ -0,0 +1,453 @@
+//Measures the cost of handing received buffers from the thread that drives
+//the DMA to a pool of worker threads, and back again.
+//
+//    spsc      Buffers go out by pointer through spsc_ring.h, one ring pair
+//              per worker, and come back when the worker is done
+//    mutex     Every buffer is copied into a single mutex-protected queue
+//              that all the workers share (the old way of doing it)
+//    dispatch  The real thing: axidma_dispatch.h on an S2MM pipeline, fed by
+//              the software model in axidma_model.h
+//
+//The driving thread is pinned to CPU 0 and worker i to CPU i + 1 (wrapping
+//around if there aren't enough). Workers only look at the first few bytes of
+//each buffer, so the numbers are mostly hand-off overhead. Everybody calls
+//sched_yield() when they run out of work, so this still finishes on a
+//machine with fewer cores than threads, but you want spare cores for
+//meaningful numbers.
+//
+//    ./spsc_bench [options]
+//        --modes LIST      Any of spsc, mutex and dispatch (default all three)
+//        --workers LIST    Worker thread counts (default 1,2,4)
+//        --sizes LIST      Buffer sizes in bytes (default 64,1500,9000)
+//        --count N         Buffers per measurement (default 1000000, and a
+//                          tenth of that for dispatch)
+//
+//LISTs are comma-separated. Prints CSV. Build with something like
+//    gcc -O2 -o spsc_bench spsc_bench.c axidma.c axidma_model.c axidma_arena.c
+//        axidma_pipeline.c axidma_dispatch.c pinner_fns.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h> //clock_gettime
+#include "axidma.h"
+#include "axidma_model.h"
+#include "axidma_pipeline.h"
+#include "axidma_dispatch.h"
+#include "spsc_ring.h"
+
+#define MAX_LIST 32
+#define MAX_WORKERS 64
+#define POOL_BUFS 1024 //Buffers in flight at once for spsc and mutex
+#define RING_SZ 256
+#define MUTEX_QUEUE_SZ 1024
+
+//For dispatch
+#define SLOTS 8
+#define BUFS_PER_SLOT 32
+#define SG_BYTES (1 << 20)
+
+typedef struct {
+    unsigned vals[MAX_LIST];
+    unsigned n;
+} uint_list;
+
+typedef enum {
+    MODE_SPSC,
+    MODE_MUTEX,
+    MODE_DISPATCH
+} bench_mode;
+
+static char const *mode_names[] = {"spsc", "mutex", "dispatch"};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int parse_list(char const *s, uint_list *l) {
+    l->n = 0;
+    while (*s) {
+        char *end;
+        unsigned long v = strtoul(s, &end, 0);
+        if (end == s || l->n == MAX_LIST) return -1;
+        l->vals[l->n++] = v;
+        s = end;
+        if (*s == ',') s++;
+    }
+    return l->n ? 0 : -1;
+}
+
+static unsigned num_cpus;
+
+static void pin(unsigned i) {
+    //Not fatal: the numbers are just worse
+    if (num_cpus > 1) axidma_pin_to_cpu(i % num_cpus);
+}
+
+//Shared by every mode's workers
+typedef struct {
+    pthread_t thread;
+    unsigned id;
+    unsigned long got;
+    uint32_t last_seq; //dispatch: sequence numbers should only go up
+    int err;
+} worker;
+
+static worker workers[MAX_WORKERS];
+static volatile int stop;
+static unsigned buf_sz;
+
+/////////////////////////////////////////////
+// spsc: pointers out, pointers back
+
+typedef struct {
+    spsc_ring to_worker;
+    spsc_ring from_worker;
+} ring_pair;
+
+static ring_pair *pairs;
+
+static void *spsc_worker(void *arg) {
+    worker *w = (worker *) arg;
+    ring_pair *rp = &pairs[w->id];
+    pin(w->id + 1);
+
+    while (!stop) {
+        char *buf = spsc_ring_pop(&rp->to_worker);
+        if (!buf) {
+            sched_yield();
+            continue;
+        }
+        if (buf[0] != 0x5A) w->err = 1; //Pretend to look at it
+        w->got++;
+        while (spsc_ring_push(&rp->from_worker, buf) < 0) sched_yield();
+    }
+    return NULL;
+}
+
+static double run_spsc(char *pool, unsigned nworkers, unsigned long count) {
+    char *free_bufs[POOL_BUFS];
+    unsigned nfree = 0;
+    unsigned long sent = 0, back = 0;
+    unsigned rr = 0;
+
+    for (unsigned i = 0; i < POOL_BUFS; i++) free_bufs[nfree++] = pool + (size_t) i * buf_sz;
+
+    uint64_t start = now_ns();
+    while (back < count) {
+        int idle = 1;
+        for (unsigned i = 0; i < nworkers; i++) {
+            char *buf;
+            while ((buf = spsc_ring_pop(&pairs[i].from_worker)) != NULL) {
+                free_bufs[nfree++] = buf;
+                back++;
+                idle = 0;
+            }
+        }
+        while (nfree && sent < count) {
+            if (spsc_ring_push(&pairs[rr].to_worker, free_bufs[nfree - 1]) < 0) break;
+            nfree--;
+            sent++;
+            rr = (rr + 1) % nworkers;
+            idle = 0;
+        }
+        if (idle) sched_yield();
+    }
+    return (double) (now_ns() - start) / count;
+}
+
+/////////////////////////////////////////////
+// mutex: copy into one locked queue
+
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t q_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t q_not_full = PTHREAD_COND_INITIALIZER;
+static char *q_bufs; //MUTEX_QUEUE_SZ copies
+static unsigned q_head, q_tail;
+
+static void *mutex_worker(void *arg) {
+    worker *w = (worker *) arg;
+    char *mine = malloc(buf_sz);
+    if (!mine) {
+        w->err = 1;
+        return NULL;
+    }
+    pin(w->id + 1);
+
+    pthread_mutex_lock(&q_lock);
+    for (;;) {
+        while (q_head == q_tail && !stop) pthread_cond_wait(&q_not_empty, &q_lock);
+        if (q_head == q_tail) break;
+
+        memcpy(mine, q_bufs + (size_t) (q_tail % MUTEX_QUEUE_SZ) * buf_sz, buf_sz);
+        q_tail++;
+        pthread_cond_signal(&q_not_full);
+        pthread_mutex_unlock(&q_lock);
+
+        if (mine[0] != 0x5A) w->err = 1;
+        w->got++;
+
+        pthread_mutex_lock(&q_lock);
+    }
+    pthread_mutex_unlock(&q_lock);
+
+    free(mine);
+    return NULL;
+}
+
+static double run_mutex(char *pool, unsigned nworkers, unsigned long count) {
+    (void) nworkers;
+    uint64_t start = now_ns();
+    for (unsigned long i = 0; i < count; i++) {
+        //"DMA buffer" gets copied into the queue and can be reused right away
+        char const *src = pool + (size_t) (i % POOL_BUFS) * buf_sz;
+
+        pthread_mutex_lock(&q_lock);
+        while (q_head - q_tail == MUTEX_QUEUE_SZ) pthread_cond_wait(&q_not_full, &q_lock);
+        memcpy(q_bufs + (size_t) (q_head % MUTEX_QUEUE_SZ) * buf_sz, src, buf_sz);
+        q_head++;
+        pthread_cond_signal(&q_not_empty);
+        pthread_mutex_unlock(&q_lock);
+    }
+
+    //Wait for the workers to drain the queue
+    pthread_mutex_lock(&q_lock);
+    while (q_head != q_tail) pthread_cond_wait(&q_not_full, &q_lock);
+    pthread_mutex_unlock(&q_lock);
+
+    return (double) (now_ns() - start) / count;
+}
+
+/////////////////////////////////////////////
+// dispatch: the real thing, on the model
+
+static axidma_dispatch *disp;
+
+//Model S2MM source: one buffer per packet, stamped with a sequence number
+static unsigned seq_source(void *buf, unsigned len, int *eof, void *arg) {
+    uint32_t *seq = (uint32_t *) arg;
+    memcpy(buf, seq, sizeof(uint32_t));
+    (*seq)++;
+    *eof = 1;
+    return len;
+}
+
+static void *dispatch_worker(void *arg) {
+    worker *w = (worker *) arg;
+    pin(w->id + 1);
+
+    while (!stop) {
+        axidma_dispatch_buf *b = axidma_dispatch_get(disp, w->id);
+        if (!b) {
+            sched_yield();
+            continue;
+        }
+
+        uint32_t seq;
+        memcpy(&seq, b->buf.base, sizeof(seq));
+        if (b->buf.code != TRANSFER_SUCCESS || (w->got && seq <= w->last_seq)) w->err = 1;
+        w->last_seq = seq;
+        w->got++;
+        axidma_dispatch_put(disp, b);
+    }
+    return NULL;
+}
+
+//Each run gets a fresh model, so the pipeline starts from a halted channel
+static double run_dispatch(char *sg, char *data, size_t data_sz, unsigned nworkers, unsigned long count) {
+    static struct pinner_physlist sg_plist, data_plist; //Too big for the stack
+    uint32_t seq = 0;
+    double ret = -1;
+
+    axidma_model *m = axidma_model_new();
+    axidma_ctx *ctx = NULL;
+    axidma_pipeline *p = NULL;
+    if (!m) return -1;
+    if (axidma_model_add_region(m, sg, SG_BYTES, &sg_plist) < 0) goto run_dispatch_error;
+    if (axidma_model_add_region(m, data, data_sz, &data_plist) < 0) goto run_dispatch_error;
+    axidma_model_set_source(m, seq_source, &seq);
+
+    ctx = axidma_model_ctx(m);
+    if (!ctx) goto run_dispatch_error;
+    p = axidma_pipeline_new(ctx, 1, SLOTS, BUFS_PER_SLOT, buf_sz, sg, &sg_plist, data, &data_plist);
+    if (!p) goto run_dispatch_error;
+    disp = axidma_dispatch_new(p, nworkers, RING_SZ, NULL, NULL);
+    if (!disp) goto run_dispatch_error;
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        if (pthread_create(&workers[i].thread, NULL, dispatch_worker, &workers[i])) {
+            perror("Could not start worker");
+            stop = 1;
+            for (unsigned j = 0; j < i; j++) pthread_join(workers[j].thread, NULL);
+            goto run_dispatch_error;
+        }
+    }
+
+    uint64_t start = now_ns();
+    while (axidma_dispatch_get_stats(disp).returned < count) {
+        int rc = axidma_dispatch_poll(disp, 0);
+        if (rc < 0) break;
+        if (rc == 0) sched_yield();
+    }
+    ret = (double) (now_ns() - start) / count;
+
+    stop = 1;
+    for (unsigned i = 0; i < nworkers; i++) pthread_join(workers[i].thread, NULL);
+
+    run_dispatch_error:
+    //The model thread has to stop before the pipeline's memory goes away
+    if (ctx) axidma_close(ctx);
+    axidma_model_del(m);
+    axidma_dispatch_del(disp);
+    disp = NULL;
+    axidma_pipeline_del(p);
+    return ret;
+}
+
+/////////////////////////////////////////////
+
+static void *(*const worker_fns[])(void *) = {spsc_worker, mutex_worker};
+
+int main(int argc, char **argv) {
+    uint_list nworkers_list, sizes;
+    int modes[3] = {1, 1, 1};
+    unsigned long count = 1000000;
+    int ret = 0;
+
+    parse_list("1,2,4", &nworkers_list);
+    parse_list("64,1500,9000", &sizes);
+
+    for (int i = 1; i < argc; i++) {
+        char const *next = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "--modes") && next) {
+            for (unsigned j = 0; j < 3; j++) modes[j] = strstr(next, mode_names[j]) != NULL;
+            i++;
+        } else if (!strcmp(argv[i], "--workers") && next && !parse_list(next, &nworkers_list)) {
+            i++;
+        } else if (!strcmp(argv[i], "--sizes") && next && !parse_list(next, &sizes)) {
+            i++;
+        } else if (!strcmp(argv[i], "--count") && next) {
+            count = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "Unrecognized option %s. See the top of spsc_bench.c for usage\n", argv[i]);
+            return -1;
+        }
+    }
+    if (count == 0) {
+        fprintf(stderr, "Need at least one buffer\n");
+        return -1;
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_cpus = (n > 0) ? n : 1;
+
+    unsigned max_sz = 0;
+    for (unsigned i = 0; i < sizes.n; i++) {
+        if (sizes.vals[i] > max_sz) max_sz = sizes.vals[i];
+    }
+    size_t data_sz = ((size_t) SLOTS * BUFS_PER_SLOT * max_sz + 4095) & ~4095UL;
+    size_t pool_sz = (size_t) POOL_BUFS * max_sz;
+
+    char *pool = aligned_alloc(4096, (pool_sz + 4095) & ~4095UL);
+    char *sg = aligned_alloc(4096, SG_BYTES);
+    char *data = aligned_alloc(4096, data_sz);
+    q_bufs = malloc((size_t) MUTEX_QUEUE_SZ * max_sz);
+    pairs = aligned_alloc(SPSC_CACHE_LINE, MAX_WORKERS * sizeof(ring_pair));
+    if (!pool || !sg || !data || !q_bufs || !pairs) {
+        perror("Could not allocate buffers");
+        ret = -1;
+        goto cleanup;
+    }
+    memset(pool, 0x5A, pool_sz);
+    memset(sg, 0, SG_BYTES);
+    memset(data, 0, data_sz);
+    memset(pairs, 0, MAX_WORKERS * sizeof(ring_pair));
+    for (unsigned i = 0; i < MAX_WORKERS; i++) {
+        if (spsc_ring_init(&pairs[i].to_worker, RING_SZ) < 0 || spsc_ring_init(&pairs[i].from_worker, POOL_BUFS) < 0) {
+            perror("Could not allocate rings");
+            ret = -1;
+            goto cleanup;
+        }
+    }
+
+    pin(0);
+    puts("mode,workers,buf_bytes,bufs,ns_per_buf,Mbufs_per_s");
+    for (unsigned mi = 0; mi < 3; mi++) {
+        if (!modes[mi]) continue;
+        unsigned long n_bufs = (mi == MODE_DISPATCH) ? (count + 9) / 10 : count;
+
+        for (unsigned si = 0; si < sizes.n; si++) {
+            for (unsigned wi = 0; wi < nworkers_list.n; wi++) {
+                unsigned nw = nworkers_list.vals[wi];
+                buf_sz = sizes.vals[si];
+                if (nw == 0 || nw > MAX_WORKERS || buf_sz < sizeof(uint32_t)) {
+                    fprintf(stderr, "Skipping %u workers with %u byte buffers\n", nw, buf_sz);
+                    continue;
+                }
+
+                stop = 0;
+                q_head = q_tail = 0;
+                memset(workers, 0, sizeof(workers));
+
+                double ns;
+                if (mi == MODE_DISPATCH) {
+                    ns = run_dispatch(sg, data, data_sz, nw, n_bufs);
+                } else {
+                    unsigned started = 0;
+                    for (unsigned i = 0; i < nw; i++) {
+                        workers[i].id = i;
+                        if (pthread_create(&workers[i].thread, NULL, worker_fns[mi], &workers[i])) {
+                            perror("Could not start worker");
+                            break;
+                        }
+                        started++;
+                    }
+                    ns = (started == nw) ? ((mi == MODE_SPSC) ? run_spsc : run_mutex)(pool, nw, n_bufs) : -1;
+
+                    stop = 1;
+                    pthread_mutex_lock(&q_lock);
+                    pthread_cond_broadcast(&q_not_empty);
+                    pthread_mutex_unlock(&q_lock);
+                    for (unsigned i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+                }
+
+                unsigned long got = 0;
+                int err = 0;
+                for (unsigned i = 0; i < nw; i++) {
+                    got += workers[i].got;
+                    err |= workers[i].err;
+                }
+                if (ns < 0 || err || got < n_bufs) {
+                    fprintf(stderr, "%s with %u workers and %u byte buffers failed\n", mode_names[mi], nw, buf_sz);
+                    ret = -1;
+                    goto cleanup;
+                }
+
+                printf("%s,%u,%u,%lu,%.1f,%.3f\n", mode_names[mi], nw, buf_sz, n_bufs, ns, 1e3 / ns);
+                fflush(stdout);
+            }
+        }
+    }
+
+    cleanup:
+    if (pairs) {
+        for (unsigned i = 0; i < MAX_WORKERS; i++) {
+            spsc_ring_destroy(&pairs[i].to_worker);
+            spsc_ring_destroy(&pairs[i].from_worker);
+        }
+    }
+    free(pairs);
+    free(q_bufs);
+    free(pool);
+    free(sg);
+    free(data);
+    return ret;
+}
@@ -0,0 +1,99 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H 1
+
+//Lock-free ring of pointers for exactly one producer thread and one consumer
+//thread. Pushing and popping are a handful of loads and stores: no locks, no
+//system calls, and no atomic read-modify-writes.
+//
+//The producer's and consumer's indices live on separate cache lines, so the
+//two threads only bother each other when one of them actually needs to see
+//the other's progress. Each side also keeps a private copy of the other's
+//index and only rereads the real one when the ring looks full (or empty).
+//
+//Allocate spsc_rings with 64-byte alignment (aligned_alloc, or a static/stack
+//variable) so they don't share lines with whatever is next to them.
+//
+//Usage:
+//    spsc_ring r;
+//    spsc_ring_init(&r, 256);
+//    //Producer thread:
+//    if (spsc_ring_push(&r, ptr) < 0) ... full, try again later ...
+//    //Consumer thread:
+//    void *p = spsc_ring_pop(&r); //NULL if empty
+//    spsc_ring_destroy(&r);
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+    //Written by the producer
+    _Alignas(SPSC_CACHE_LINE) atomic_uint head; //Next place to push
+    unsigned tail_cache; //Last tail the producer saw
+
+    //Written by the consumer
+    _Alignas(SPSC_CACHE_LINE) atomic_uint tail; //Next place to pop
+    unsigned head_cache; //Last head the consumer saw
+
+    //Never written after init
+    _Alignas(SPSC_CACHE_LINE) unsigned mask;
+    void **items;
+} spsc_ring;
+
+//Makes room for at least capacity items (rounded up to a power of two).
+//Returns 0 on success, -1 if out of memory
+static inline int spsc_ring_init(spsc_ring *r, unsigned capacity) {
+    unsigned sz = 1;
+    while (sz < capacity) sz <<= 1;
+
+    r->items = calloc(sz, sizeof(void *));
+    if (!r->items) return -1;
+    r->mask = sz - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->tail_cache = 0;
+    r->head_cache = 0;
+    return 0;
+}
+
+static inline void spsc_ring_destroy(spsc_ring *r) {
+    free(r->items);
+    r->items = NULL;
+}
+
+static inline unsigned spsc_ring_capacity(spsc_ring const *r) {
+    return r->mask + 1;
+}
+
+//Producer only. Returns 0 on success, or -1 if the ring is full
+static inline int spsc_ring_push(spsc_ring *r, void *item) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head - r->tail_cache > r->mask) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - r->tail_cache > r->mask) return -1;
+    }
+
+    r->items[head & r->mask] = item;
+    //Release: the consumer must see the item before it sees the new head
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+//Consumer only. Returns the oldest item, or NULL if the ring is empty
+static inline void *spsc_ring_pop(spsc_ring *r) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail == r->head_cache) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail == r->head_cache) return NULL;
+    }
+
+    void *item = r->items[tail & r->mask];
+    //Release: we're done reading the slot before the producer can reuse it
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+#endif
@@ -0,0 +1,132 @@
+//Compares mmio_copy_to/mmio_copy_from against a plain 32-bit loop for every
+//mpsoc_axiregs mapping type and a sweep of transfer sizes. Point it at a BRAM
+//(or any AXI memory) in the PL:
+//
+//    ./mmio_bench <window index> <offset in window> <max size>
+//
+//Build with something like
+//    aarch64-linux-gnu-gcc -O2 -o mmio_bench mmio_bench.c mmio_copy.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h> //open
+#include <sys/mman.h> //mmap
+#include <sys/ioctl.h> //ioctl
+#include <unistd.h> //close
+#include <time.h> //clock_gettime
+#include "mpsoc_axiregs.h"
+#include "mmio_copy.h"
+
+//Move at least this many bytes per measurement, so small sizes still get
+//timed over a reasonable interval
+#define BYTES_PER_MEASUREMENT (16 << 20)
+
+static char const *type_names[] = {"nocache", "device", "wc", "cached"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void loop_copy_to(volatile void *dst, void const *src, size_t n) {
+    volatile uint32_t *d = (volatile uint32_t *) dst;
+    uint32_t const *s = (uint32_t const *) src;
+    for (size_t i = 0; i < n / 4; i++) d[i] = s[i];
+}
+
+static void loop_copy_from(void *dst, volatile void const *src, size_t n) {
+    uint32_t *d = (uint32_t *) dst;
+    volatile uint32_t const *s = (volatile uint32_t const *) src;
+    for (size_t i = 0; i < n / 4; i++) d[i] = s[i];
+}
+
+typedef void (*to_fn)(volatile void *, void const *, size_t);
+typedef void (*from_fn)(void *, volatile void const *, size_t);
+
+static double bench_to(to_fn fn, unsigned type, volatile void *pl, void const *buf, size_t sz) {
+    size_t reps = BYTES_PER_MEASUREMENT / sz + 1;
+    double start = now();
+    for (size_t i = 0; i < reps; i++) {
+        fn(pl, buf, sz);
+        if (type == MPSOC_AXIREGS_MAP_CACHED) mmio_clean_range(pl, sz);
+    }
+    return (double) sz * reps / (now() - start) / 1e6;
+}
+
+static double bench_from(from_fn fn, unsigned type, void *buf, volatile void const *pl, size_t sz) {
+    size_t reps = BYTES_PER_MEASUREMENT / sz + 1;
+    double start = now();
+    for (size_t i = 0; i < reps; i++) {
+        if (type == MPSOC_AXIREGS_MAP_CACHED) mmio_inval_range(pl, sz);
+        fn(buf, pl, sz);
+    }
+    return (double) sz * reps / (now() - start) / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int ret = 0;
+    int fd = -1;
+    char *buf = NULL;
+
+    if (argc != 4) {
+        puts("Usage: mmio_bench <window index> <offset in window> <max size>");
+        return 0;
+    }
+
+    unsigned win = strtoul(argv[1], NULL, 0);
+    unsigned long off = strtoul(argv[2], NULL, 0);
+    size_t max_sz = strtoul(argv[3], NULL, 0);
+    size_t map_sz = (max_sz + 0xFFF) & ~((size_t) 0xFFF);
+
+    fd = open("/dev/mpsoc_axiregs", O_RDWR);
+    if (fd == -1) {
+        perror("Could not open /dev/mpsoc_axiregs");
+        ret = -1;
+        goto cleanup;
+    }
+
+    struct mpsoc_axiregs_window info = {.index = win};
+    if (ioctl(fd, MPSOC_AXIREGS_GET_WINDOW, &info) < 0) {
+        perror("Could not get window info");
+        ret = -1;
+        goto cleanup;
+    }
+    fprintf(stderr, "Window %u is %s; testing up to 0x%zx bytes at 0x%lx\n", win, info.name, max_sz, info.phys + off);
+
+    buf = malloc(max_sz);
+    if (!buf) {
+        perror("Could not allocate buffer");
+        ret = -1;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < max_sz; i++) buf[i] = i;
+
+    //CSV, so it can go straight into a spreadsheet
+    puts("type,size,loop_write_MBps,mmio_write_MBps,loop_read_MBps,mmio_read_MBps");
+    for (unsigned type = MPSOC_AXIREGS_MAP_NOCACHE; type <= MPSOC_AXIREGS_MAP_CACHED; type++) {
+        void *pl = mmap(0, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, MPSOC_AXIREGS_MMAP_OFFSET_TYPE(win, off, type));
+        if (pl == MAP_FAILED) {
+            perror("Could not mmap PL memory");
+            continue;
+        }
+
+        for (size_t sz = 64; sz <= max_sz; sz <<= 1) {
+            printf("%s,%zu,%.1f,%.1f,%.1f,%.1f\n", type_names[type], sz,
+                bench_to(loop_copy_to, type, pl, buf, sz),
+                bench_to(mmio_copy_to, type, pl, buf, sz),
+                bench_from(loop_copy_from, type, buf, pl, sz),
+                bench_from(mmio_copy_from, type, buf, pl, sz)
+            );
+            fflush(stdout);
+        }
+
+        munmap(pl, map_sz);
+    }
+
+    cleanup:
+    if (buf) free(buf);
+    if (fd != -1) close(fd);
+    return ret;
+}
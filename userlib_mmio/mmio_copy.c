@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <string.h>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "mmio_copy.h"
+
+//Unaligned loads and stores on the CPU side. The compiler turns these into
+//single (unaligned-capable) instructions, which are fine on Normal memory
+static inline uint16_t ld16(uint8_t const *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static inline uint32_t ld32(uint8_t const *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t ld64(uint8_t const *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline void st16(uint8_t *p, uint16_t v) { memcpy(p, &v, 2); }
+static inline void st32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+static inline void st64(uint8_t *p, uint64_t v) { memcpy(p, &v, 8); }
+
+//Naturally aligned accesses on the PL side
+#define IO8(p)  (*(volatile uint8_t *)(p))
+#define IO16(p) (*(volatile uint16_t *)(p))
+#define IO32(p) (*(volatile uint32_t *)(p))
+#define IO64(p) (*(volatile uint64_t *)(p))
+
+void mmio_copy_to(volatile void *dst, void const *src, size_t n) {
+    uintptr_t d = (uintptr_t) dst;
+    uint8_t const *s = (uint8_t const *) src;
+
+    //Head: step up to a 16 byte boundary. Going smallest first means every
+    //access is naturally aligned
+    if ((d & 1) && n >= 1) { IO8(d) = *s; d += 1; s += 1; n -= 1; }
+    if ((d & 2) && n >= 2) { IO16(d) = ld16(s); d += 2; s += 2; n -= 2; }
+    if ((d & 4) && n >= 4) { IO32(d) = ld32(s); d += 4; s += 4; n -= 4; }
+    if ((d & 8) && n >= 8) { IO64(d) = ld64(s); d += 8; s += 8; n -= 8; }
+
+    //Body: d is now 16-byte aligned (or n is too small to get there)
+#if defined(__aarch64__)
+    if ((d & 15) == 0) {
+        while (n >= 64) {
+            asm volatile(
+                "ld1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%1]\n"
+                "stp q0, q1, [%0]\n"
+                "stp q2, q3, [%0, #32]\n"
+                :: "r"(d), "r"(s) : "v0", "v1", "v2", "v3", "memory"
+            );
+            d += 64; s += 64; n -= 64;
+        }
+        while (n >= 16) {
+            asm volatile(
+                "ld1 {v0.16b}, [%1]\n"
+                "str q0, [%0]\n"
+                :: "r"(d), "r"(s) : "v0", "memory"
+            );
+            d += 16; s += 16; n -= 16;
+        }
+    }
+#endif
+    while (n >= 8 && (d & 7) == 0) { IO64(d) = ld64(s); d += 8; s += 8; n -= 8; }
+
+    //Tail
+    if (n >= 4) { IO32(d) = ld32(s); d += 4; s += 4; n -= 4; }
+    if (n >= 2) { IO16(d) = ld16(s); d += 2; s += 2; n -= 2; }
+    if (n >= 1) { IO8(d) = *s; }
+}
+
+void mmio_copy_from(void *dst, volatile void const *src, size_t n) {
+    uint8_t *d = (uint8_t *) dst;
+    uintptr_t s = (uintptr_t) src;
+
+    if ((s & 1) && n >= 1) { *d = IO8(s); d += 1; s += 1; n -= 1; }
+    if ((s & 2) && n >= 2) { st16(d, IO16(s)); d += 2; s += 2; n -= 2; }
+    if ((s & 4) && n >= 4) { st32(d, IO32(s)); d += 4; s += 4; n -= 4; }
+    if ((s & 8) && n >= 8) { st64(d, IO64(s)); d += 8; s += 8; n -= 8; }
+
+#if defined(__aarch64__)
+    if ((s & 15) == 0) {
+        while (n >= 64) {
+            asm volatile(
+                "ldp q0, q1, [%1]\n"
+                "ldp q2, q3, [%1, #32]\n"
+                "st1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%0]\n"
+                :: "r"(d), "r"(s) : "v0", "v1", "v2", "v3", "memory"
+            );
+            d += 64; s += 64; n -= 64;
+        }
+        while (n >= 16) {
+            asm volatile(
+                "ldr q0, [%1]\n"
+                "st1 {v0.16b}, [%0]\n"
+                :: "r"(d), "r"(s) : "v0", "memory"
+            );
+            d += 16; s += 16; n -= 16;
+        }
+    }
+#endif
+    while (n >= 8 && (s & 7) == 0) { st64(d, IO64(s)); d += 8; s += 8; n -= 8; }
+
+    if (n >= 4) { st32(d, IO32(s)); d += 4; s += 4; n -= 4; }
+    if (n >= 2) { st16(d, IO16(s)); d += 2; s += 2; n -= 2; }
+    if (n >= 1) { *d = IO8(s); }
+}
+
+void mmio_fill(volatile void *dst, uint8_t val, size_t n) {
+    uintptr_t d = (uintptr_t) dst;
+    uint64_t v = 0x0101010101010101ULL * val;
+
+    if ((d & 1) && n >= 1) { IO8(d) = val; d += 1; n -= 1; }
+    if ((d & 2) && n >= 2) { IO16(d) = v; d += 2; n -= 2; }
+    if ((d & 4) && n >= 4) { IO32(d) = v; d += 4; n -= 4; }
+    if ((d & 8) && n >= 8) { IO64(d) = v; d += 8; n -= 8; }
+
+#if defined(__aarch64__)
+    if ((d & 15) == 0) {
+        uint8x16_t vv = vdupq_n_u8(val);
+        while (n >= 64) {
+            asm volatile(
+                "stp %q1, %q1, [%0]\n"
+                "stp %q1, %q1, [%0, #32]\n"
+                :: "r"(d), "w"(vv) : "memory"
+            );
+            d += 64; n -= 64;
+        }
+        while (n >= 16) {
+            asm volatile("str %q1, [%0]" :: "r"(d), "w"(vv) : "memory");
+            d += 16; n -= 16;
+        }
+    }
+#endif
+    while (n >= 8 && (d & 7) == 0) { IO64(d) = v; d += 8; n -= 8; }
+
+    if (n >= 4) { IO32(d) = v; d += 4; n -= 4; }
+    if (n >= 2) { IO16(d) = v; d += 2; n -= 2; }
+    if (n >= 1) { IO8(d) = val; }
+}
+
+#if defined(__aarch64__)
+//Linux lets userspace read CTR_EL0 and use dc cvac/civac, so we don't need
+//a syscall for any of this
+static uintptr_t dcache_line_size(void) {
+    uint64_t ctr;
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    return 4UL << ((ctr >> 16) & 0xF);
+}
+#endif
+
+void mmio_clean_range(volatile void const *p, size_t n) {
+#if defined(__aarch64__)
+    uintptr_t line = dcache_line_size();
+    uintptr_t addr = ((uintptr_t) p) & ~(line - 1);
+    uintptr_t end = (uintptr_t) p + n;
+    for (; addr < end; addr += line) {
+        asm volatile("dc cvac, %0" :: "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+#else
+    (void) p;
+    (void) n;
+#endif
+}
+
+void mmio_inval_range(volatile void const *p, size_t n) {
+#if defined(__aarch64__)
+    //dc ivac isn't allowed at EL0, so clean+invalidate instead. Same result
+    //as long as the CPU hasn't written to the range
+    uintptr_t line = dcache_line_size();
+    uintptr_t addr = ((uintptr_t) p) & ~(line - 1);
+    uintptr_t end = (uintptr_t) p + n;
+    for (; addr < end; addr += line) {
+        asm volatile("dc civac, %0" :: "r"(addr) : "memory");
+    }
+    asm volatile("dsb sy" ::: "memory");
+#else
+    (void) p;
+    (void) n;
+#endif
+}
@@ -0,0 +1,43 @@
+#ifndef MMIO_COPY_H
+#define MMIO_COPY_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Copy and fill routines for PL memory mapped through mpsoc_axiregs or UIO.
+//
+//libc's memcpy assumes Normal memory. On a Device mapping it can fault on
+//unaligned accesses, and it sometimes falls back to narrow ones. These
+//functions always keep the PL side of the copy naturally aligned:
+//  - A few byte/halfword/word/doubleword accesses bring it to a 16 byte boundary
+//  - The bulk moves 64 bytes at a time using 128-bit NEON load/store pairs
+//  - The tail is finished the same way as the head
+//The CPU side (the regular buffer) can have any alignment.
+//
+//They're safe on all of the mpsoc_axiregs mapping types (NOCACHE, DEVICE, WC
+//and CACHED), but keep in mind:
+//  - The head and tail use narrow accesses. BRAM controllers are fine with
+//    that, but some AXI-lite slaves ignore byte strobes. If that matters, keep
+//    your pointers and sizes 16-byte aligned and you'll only get 128-bit accesses
+//  - With a CACHED mapping, you still have to clean (after writing) or
+//    invalidate (before reading) the range yourself; see below
+//
+//On anything other than aarch64 these fall back to plain 64-bit loops, which
+//is only useful for compiling and testing on a desktop.
+
+//Copy n bytes from a normal buffer into PL memory
+void mmio_copy_to(volatile void *dst, void const *src, size_t n);
+
+//Copy n bytes from PL memory into a normal buffer
+void mmio_copy_from(void *dst, volatile void const *src, size_t n);
+
+//Set n bytes of PL memory to val
+void mmio_fill(volatile void *dst, uint8_t val, size_t n);
+
+//Cache maintenance for MPSOC_AXIREGS_MAP_CACHED mappings. Clean after the CPU
+//writes, so the data actually reaches the PL. Invalidate before the CPU reads,
+//so it doesn't see stale lines. Both finish with a dsb.
+void mmio_clean_range(volatile void const *p, size_t n);
+void mmio_inval_range(volatile void const *p, size_t n);
+
+#endif